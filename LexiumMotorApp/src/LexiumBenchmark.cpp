@@ -0,0 +1,361 @@
+//! @File : LexiumBenchmark.cpp
+//!         Poll throughput and latency benchmark for the Lexium driver.
+//!
+//!         LexiumBenchmark() clears the statistics of every Lexium controller in the IOC, lets the
+//!         pollers run for a fixed time (optionally moving every axis back and forth), then writes
+//!         one JSON object per axis with the achieved poll rate, poll duration and CPU time,
+//!         writeReadController() round trip percentiles and move()-to-done times.
+//!         Run it in an IOC against lexiumSim (see st-bench.cmd) to compare driver modes.
+//!
+//!         LexiumCommandBenchmark() times command formatting alone, the old two sprintf() calls
+//!         (command, then device name prefix) against LexiumCommand, no drive needed.
+//!         LexiumReplyBenchmark() times parsing of a combined poll reply, strtod()/strtol()
+//!         against the validating parser in LexiumReply.h, no drive needed.
+//
+//  Revision History
+//  ----------------
+//  Initial version
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <epicsThread.h>
+#include <iocsh.h>
+
+#include "asynMotorController.h"
+#include "asynMotorAxis.h"
+
+#include <epicsExport.h>
+#include "LexiumMotorController.h"
+#include "LexiumPollGroup.h"
+#include "LexiumReply.h"
+
+#define BENCH_BASE_VELOCITY 1000
+#define BENCH_VELOCITY 200000
+#define BENCH_ACCELERATION 2000000
+#define BENCH_MOVE_CHECK 0.01      // seconds between checks for finished moves
+#define BENCH_FORMAT_ITERATIONS 1000000  // default for LexiumCommandBenchmark()
+#define BENCH_PARSE_ITERATIONS 1000000   // default for LexiumReplyBenchmark()
+
+////////////////////////////////////
+// LexiumBenchmark class
+// friend of the controller and axis classes to get at their statistics
+////////////////////////////////////
+class LexiumBenchmark
+{
+public:
+	static int run(double seconds, int moveDistance, const char *fileName);
+
+	static int runFormat(int iterations);
+	static int runParse(int iterations);
+
+private:
+	static void startMoves(int moveDistance);
+	static void writeResults(FILE *fp, double elapsed);
+};
+
+////////////////////////////////////////////////////////
+//! startMoves()
+//! start a relative move on every axis whose previous move has finished,
+//! alternating direction so the axes stay around their start position
+//
+//! @param[in] moveDistance move distance in counts
+////////////////////////////////////////////////////////
+void LexiumBenchmark::startMoves(int moveDistance)
+{
+	LexiumMotorController *pC;
+	LexiumMotorAxis *pAxis;
+	int distance;
+	bool started;
+
+	for (pC = LexiumMotorController::pFirstController; pC; pC = pC->pNextController) {
+		started = false;
+		pC->lock();
+		for (int i=0; i<pC->numAxes_; i++) {
+			pAxis = pC->getAxis(i);
+			if (!pAxis || pAxis->moveTimed) continue;
+			distance = (pAxis->moveTime.count % 2) ? -abs(moveDistance) : abs(moveDistance);
+			if (pAxis->move(distance, 1, BENCH_BASE_VELOCITY, BENCH_VELOCITY, BENCH_ACCELERATION) == asynSuccess) started = true;
+		}
+		pC->unlock();
+		if (started) pC->wakeupPoller();
+	}
+}
+
+////////////////////////////////////////////////////////
+//! writeResults()
+//! one JSON object per line and axis
+//
+//! @param[in] fp      output file
+//! @param[in] elapsed benchmark duration in seconds
+////////////////////////////////////////////////////////
+void LexiumBenchmark::writeResults(FILE *fp, double elapsed)
+{
+	LexiumMotorController *pC;
+	LexiumMotorAxis *pAxis;
+	int combined;
+	unsigned long transactions, controllerPolls;
+
+	for (pC = LexiumMotorController::pFirstController; pC; pC = pC->pNextController) {
+		pC->lock();
+		// transactions are counted per controller, shared by its axes on a party mode link
+		transactions = pC->readTime.count + pC->writeTime.count;
+		controllerPolls = 0;
+		for (int i=0; i<pC->numAxes_; i++) {
+			if (pC->getAxis(i)) controllerPolls += pC->getAxis(i)->pollTime.count;
+		}
+		for (int i=0; i<pC->numAxes_; i++) {
+			pAxis = pC->getAxis(i);
+			if (!pAxis) continue;
+			pC->getIntegerParam(i, pC->LexiumCombinedPoll_, &combined);
+			fprintf(fp, "{\"port\":\"%s\",\"axis\":%d,\"seconds\":%.3f,\"pollGroup\":%d,\"combinedPoll\":%d,"
+					"\"polls\":%lu,\"pollRate\":%.3f,\"pollMean\":%.6f,\"pollP99\":%.6f,\"pollMax\":%.6f,\"cpuPerPoll\":%.6f,"
+					"\"transactions\":%lu,\"transactionsPerPoll\":%.3f,\"timeouts\":%lu,\"errors\":%lu,"
+					"\"rttMin\":%.6f,\"rttP50\":%.6f,\"rttP90\":%.6f,\"rttP99\":%.6f,\"rttMax\":%.6f,"
+					"\"moves\":%lu,\"moveDoneMean\":%.6f,\"moveDoneP50\":%.6f,\"moveDoneP99\":%.6f,\"moveDoneMax\":%.6f}\n",
+					pC->motorName, i, elapsed, pC->pPollGroupEntry ? 1 : 0, (combined && !pAxis->combinedPollRejected) ? 1 : 0,
+					pAxis->pollTime.count, pAxis->pollTime.count / elapsed, pAxis->pollTime.mean(), pAxis->pollTime.percentile(0.99),
+					pAxis->pollTime.max, pAxis->pollTime.count ? pAxis->pollCpuTime / pAxis->pollTime.count : 0,
+					transactions, controllerPolls ? (double)transactions / controllerPolls : 0, pC->ioTimeouts, pC->ioErrors,
+					pC->readTime.min, pC->readTime.percentile(0.5), pC->readTime.percentile(0.9), pC->readTime.percentile(0.99), pC->readTime.max,
+					pAxis->moveTime.count, pAxis->moveTime.mean(), pAxis->moveTime.percentile(0.5), pAxis->moveTime.percentile(0.99), pAxis->moveTime.max);
+		}
+		pC->unlock();
+	}
+	fflush(fp);
+}
+
+////////////////////////////////////////////////////////
+//! run()
+//! clear statistics, let the pollers run, write the results
+//
+//! @param[in] seconds      benchmark duration
+//! @param[in] moveDistance 0 to only poll, otherwise keep every axis moving by this many counts
+//! @param[in] fileName     file the results are appended to, stdout if empty
+////////////////////////////////////////////////////////
+int LexiumBenchmark::run(double seconds, int moveDistance, const char *fileName)
+{
+	static const char *functionName = "LexiumBenchmark()";
+	LexiumMotorController *pC;
+	epicsTimeStamp start;
+	double elapsed;
+	FILE *fp = stdout;
+
+	if (!LexiumMotorController::pFirstController) {
+		printf("%s:%s: ERROR no Lexium controllers created\n", DRIVER_NAME, functionName);
+		return(asynError);
+	}
+	if (seconds <= 0) {
+		printf("%s:%s: ERROR duration must be > 0\n", DRIVER_NAME, functionName);
+		return(asynError);
+	}
+	if (fileName && fileName[0]) {
+		fp = fopen(fileName, "a");
+		if (!fp) {
+			printf("%s:%s: ERROR can't open %s\n", DRIVER_NAME, functionName, fileName);
+			return(asynError);
+		}
+	}
+
+	for (pC = LexiumMotorController::pFirstController; pC; pC = pC->pNextController) {
+		pC->lock();
+		pC->resetStats();
+		pC->unlock();
+	}
+
+	epicsTimeGetCurrent(&start);
+	while ((elapsed = lexiumElapsed(&start)) < seconds) {
+		if (moveDistance) startMoves(moveDistance);
+		epicsThreadSleep(moveDistance ? BENCH_MOVE_CHECK : seconds - elapsed);
+	}
+
+	writeResults(fp, lexiumElapsed(&start));
+	if (fp != stdout) fclose(fp);
+	return(asynSuccess);
+}
+
+////////////////////////////////////////////////////////
+//! runFormat()
+//! time formatting of a party mode move command ("AMA <position>") both ways
+//
+//! @param[in] iterations number of commands formatted by each method
+////////////////////////////////////////////////////////
+int LexiumBenchmark::runFormat(int iterations)
+{
+	static const char *functionName = "LexiumCommandBenchmark()";
+	const char *devName = "A";
+	char cmd[MAX_CMD_LEN];
+	char outbuff[MAX_BUFF_LEN];
+	volatile size_t sink = 0;  // keeps the compiler from dropping the loops
+	epicsTimeStamp start;
+	double sprintfTime, builderTime;
+
+	if (iterations <= 0) iterations = BENCH_FORMAT_ITERATIONS;
+
+	epicsTimeGetCurrent(&start);
+	for (int i=0; i<iterations; i++) {
+		sprintf(cmd, "MA %ld", (long)(i - iterations/2) * 7);
+		sprintf(outbuff, "%s%s", devName, cmd);
+		sink += strlen(outbuff);
+	}
+	sprintfTime = lexiumElapsed(&start);
+
+	epicsTimeGetCurrent(&start);
+	for (int i=0; i<iterations; i++) {
+		LexiumCommand command(devName);
+		command.appendString("MA ").appendInteger((long)(i - iterations/2) * 7);
+		sink += command.length();
+	}
+	builderTime = lexiumElapsed(&start);
+
+	printf("%s: %d commands, sprintf %.1f ns/command, LexiumCommand %.1f ns/command (%lu chars)\n", functionName,
+		   iterations, sprintfTime / iterations * 1e9, builderTime / iterations * 1e9, (unsigned long)sink);
+	return(asynSuccess);
+}
+
+////////////////////////////////////////////////////////
+//! runParse()
+//! time parsing of a combined poll reply with switches ("P,MV,I1,I2,I3") both ways
+//
+//! @param[in] iterations number of replies parsed by each method
+////////////////////////////////////////////////////////
+int LexiumBenchmark::runParse(int iterations)
+{
+	static const char *functionName = "LexiumReplyBenchmark()";
+	static const char *replies[] = {"123456,0,1,0,0", "-7654321,1,0,1,0", "0,0,0,0,1", "42,1,1,1,1"};
+	const int numReplies = sizeof(replies) / sizeof(replies[0]);
+	size_t lengths[numReplies];
+	volatile double sink = 0;  // keeps the compiler from dropping the loops
+	epicsTimeStamp start;
+	double strtodTime, parserTime;
+	unsigned long failed = 0;
+
+	if (iterations <= 0) iterations = BENCH_PARSE_ITERATIONS;
+	for (int j=0; j<numReplies; j++) lengths[j] = strlen(replies[j]);
+
+	// what pollCombined() did before: no check of the reply as a whole
+	epicsTimeGetCurrent(&start);
+	for (int i=0; i<iterations; i++) {
+		const char *reply = replies[i % numReplies];
+		char *pEnd;
+		double position = strtod(reply, &pEnd);
+		long sum = 0;
+		for (int k=0; k<4 && *pEnd == ','; k++) sum += strtol(pEnd + 1, &pEnd, 10);
+		sink += position + sum;
+	}
+	strtodTime = lexiumElapsed(&start);
+
+	epicsTimeGetCurrent(&start);
+	for (int i=0; i<iterations; i++) {
+		const char *reply = replies[i % numReplies];
+		const char *last = reply + lengths[i % numReplies];
+		LexiumParseResult result;
+		double position;
+		long value, sum = 0;
+		if (lexiumCheckReply(reply, last - reply, "PR P") != lexiumReplyOk) { failed++; continue; }
+		result = lexiumFromChars(reply, last, &position);
+		for (int k=0; k<4 && !result.error && result.ptr < last && *result.ptr == ','; k++) {
+			result = lexiumFromChars(result.ptr + 1, last, &value);
+			sum += value;
+		}
+		if (result.error || result.ptr != last) { failed++; continue; }
+		sink += position + sum;
+	}
+	parserTime = lexiumElapsed(&start);
+
+	printf("%s: %d replies, strtod/strtol %.1f ns/reply, LexiumReply %.1f ns/reply (%lu rejected, sum %g)\n", functionName,
+		   iterations, strtodTime / iterations * 1e9, parserTime / iterations * 1e9, failed, (double)sink);
+	return(asynSuccess);
+}
+
+////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////
+// Start code for iocsh Registration :
+// Available Functions :
+//   LexiumBenchmark()
+//   LexiumCommandBenchmark()
+//   LexiumReplyBenchmark()
+////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////
+//! LexiumBenchmark()
+//! IOCSH function
+//! Measure poll rate, poll duration, I/O round trip and move times of all Lexium controllers
+//
+//! @param[in] seconds      benchmark duration
+//! @param[in] moveDistance 0 to only poll, otherwise keep every axis moving back and forth by this many counts
+//! @param[in] fileName     file the JSON results are appended to, stdout if empty
+////////////////////////////////////////////////////////
+extern "C" int LexiumBenchmark(double seconds, int moveDistance, const char *fileName)
+{
+	return LexiumBenchmark::run(seconds, moveDistance, fileName);
+}
+
+////////////////////////////////////////////////////////
+// Duration          : seconds to run
+// Move distance     : 0 to only poll, otherwise counts to move each axis back and forth
+// Output file       : JSON results are appended to this file, stdout if empty
+////////////////////////////////////////////////////////
+static const iocshArg LexiumBenchmarkArg0 = {"Duration (s)", iocshArgDouble};
+static const iocshArg LexiumBenchmarkArg1 = {"Move distance (counts)", iocshArgInt};
+static const iocshArg LexiumBenchmarkArg2 = {"Output file", iocshArgString};
+static const iocshArg * const LexiumBenchmarkArgs[] = {&LexiumBenchmarkArg0,
+                                                       &LexiumBenchmarkArg1,
+                                                       &LexiumBenchmarkArg2};
+static const iocshFuncDef LexiumBenchmarkDef = {"LexiumBenchmark", 3, LexiumBenchmarkArgs};
+static void LexiumBenchmarkCallFunc(const iocshArgBuf *args)
+{
+	LexiumBenchmark(args[0].dval, args[1].ival, args[2].sval);
+}
+
+////////////////////////////////////////////////////////
+//! LexiumCommandBenchmark()
+//! IOCSH function
+//! Compare the cost of formatting a command with sprintf() and with LexiumCommand
+//
+//! @param[in] iterations number of commands to format each way, 0 for the default
+////////////////////////////////////////////////////////
+extern "C" int LexiumCommandBenchmark(int iterations)
+{
+	return LexiumBenchmark::runFormat(iterations);
+}
+
+static const iocshArg LexiumCommandBenchmarkArg0 = {"Iterations", iocshArgInt};
+static const iocshArg * const LexiumCommandBenchmarkArgs[] = {&LexiumCommandBenchmarkArg0};
+static const iocshFuncDef LexiumCommandBenchmarkDef = {"LexiumCommandBenchmark", 1, LexiumCommandBenchmarkArgs};
+static void LexiumCommandBenchmarkCallFunc(const iocshArgBuf *args)
+{
+	LexiumCommandBenchmark(args[0].ival);
+}
+
+////////////////////////////////////////////////////////
+//! LexiumReplyBenchmark()
+//! IOCSH function
+//! Compare the cost of parsing a poll reply with strtod()/strtol() and with LexiumReply
+//
+//! @param[in] iterations number of replies to parse each way, 0 for the default
+////////////////////////////////////////////////////////
+extern "C" int LexiumReplyBenchmark(int iterations)
+{
+	return LexiumBenchmark::runParse(iterations);
+}
+
+static const iocshArg LexiumReplyBenchmarkArg0 = {"Iterations", iocshArgInt};
+static const iocshArg * const LexiumReplyBenchmarkArgs[] = {&LexiumReplyBenchmarkArg0};
+static const iocshFuncDef LexiumReplyBenchmarkDef = {"LexiumReplyBenchmark", 1, LexiumReplyBenchmarkArgs};
+static void LexiumReplyBenchmarkCallFunc(const iocshArgBuf *args)
+{
+	LexiumReplyBenchmark(args[0].ival);
+}
+
+static void LexiumBenchmarkRegister(void)
+{
+	iocshRegister(&LexiumBenchmarkDef, LexiumBenchmarkCallFunc);
+	iocshRegister(&LexiumCommandBenchmarkDef, LexiumCommandBenchmarkCallFunc);
+	iocshRegister(&LexiumReplyBenchmarkDef, LexiumReplyBenchmarkCallFunc);
+}
+
+extern "C" {
+	epicsExportRegistrar(LexiumBenchmarkRegister);
+}
@@ -0,0 +1,120 @@
+//! @File : LexiumCapture.cpp
+//!         Capture buffer used by LexiumMotorAxis, see LexiumCapture.h.
+//!         add() runs in the poll path with the controller lock held, so it only stores;
+//!         the buffer is put in time order once, when the capture is stopped.
+//
+//  Revision History
+//  ----------------
+//  Initial version
+
+#include <stddef.h>
+#include <algorithm>
+
+#include "LexiumCapture.h"
+#include "LexiumStats.h"
+
+LexiumCapture::LexiumCapture()
+	: armed(false), oneShot(false), count(0), next(0)
+{
+	times = new double[CAPTURE_LEN];
+	positions = new double[CAPTURE_LEN];
+	movingFlags = new epicsInt32[CAPTURE_LEN];
+	switchBits = new epicsInt32[CAPTURE_LEN];
+	epicsTimeGetCurrent(&start);
+}
+
+LexiumCapture::~LexiumCapture()
+{
+	delete [] times;
+	delete [] positions;
+	delete [] movingFlags;
+	delete [] switchBits;
+}
+
+////////////////////////////////////////
+//! arm()
+//! empty the buffer and start adding samples
+//
+//! @param[in] oneShot stop when full, otherwise keep the last CAPTURE_LEN samples
+////////////////////////////////////////
+void LexiumCapture::arm(bool oneShot)
+{
+	this->oneShot = oneShot;
+	count = 0;
+	next = 0;
+	epicsTimeGetCurrent(&start);
+	armed = true;
+}
+
+////////////////////////////////////////
+//! stop()
+//! stop adding samples and put the buffer in time order
+////////////////////////////////////////
+void LexiumCapture::stop()
+{
+	if (!armed) return;
+	armed = false;
+	linearize();
+}
+
+////////////////////////////////////////
+//! add()
+//! store one sample, time stamped now
+//
+//! @param[in] position position read from the drive
+//! @param[in] moving   moving flag
+//! @param[in] switches CAPTURE_HOME, CAPTURE_HIGH_LIMIT, CAPTURE_LOW_LIMIT bits
+//! @return true if a one shot capture has just filled up and stopped
+////////////////////////////////////////
+bool LexiumCapture::add(double position, int moving, int switches)
+{
+	if (!armed) return false;
+	times[next] = lexiumElapsed(&start);
+	positions[next] = position;
+	movingFlags[next] = moving;
+	switchBits[next] = switches;
+	next = (next + 1) % CAPTURE_LEN;
+	if (count < CAPTURE_LEN) count++;
+	if (oneShot && count == CAPTURE_LEN) {
+		stop();
+		return true;
+	}
+	return false;
+}
+
+////////////////////////////////////////
+//! copy()
+//! copy samples out oldest first, armed or not
+//
+//! @param[out] times      seconds since arm(), or NULL
+//! @param[out] positions  positions, or NULL
+//! @param[out] moving     moving flags, or NULL
+//! @param[out] switches   switch bits, or NULL
+//! @param[in]  maxSamples size of the arrays
+//! @return number of samples copied
+////////////////////////////////////////
+size_t LexiumCapture::copy(double *times, double *positions, epicsInt32 *moving, epicsInt32 *switches, size_t maxSamples) const
+{
+	size_t n = count < maxSamples ? count : maxSamples;
+	size_t oldest = count < CAPTURE_LEN ? 0 : next;
+	size_t j;
+
+	for (size_t i=0; i<n; i++) {
+		j = (oldest + i) % CAPTURE_LEN;
+		if (times) times[i] = this->times[j];
+		if (positions) positions[i] = this->positions[j];
+		if (moving) moving[i] = movingFlags[j];
+		if (switches) switches[i] = switchBits[j];
+	}
+	return n;
+}
+
+void LexiumCapture::linearize()
+{
+	if (count < CAPTURE_LEN || next == 0) return;
+	std::rotate(times, times + next, times + CAPTURE_LEN);
+	std::rotate(positions, positions + next, positions + CAPTURE_LEN);
+	std::rotate(movingFlags, movingFlags + next, movingFlags + CAPTURE_LEN);
+	std::rotate(switchBits, switchBits + next, switchBits + CAPTURE_LEN);
+	next = 0;
+}
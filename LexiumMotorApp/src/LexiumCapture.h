@@ -0,0 +1,54 @@
+//  Description : Per-axis capture buffer for the Lexium driver.
+//                Keeps the samples of every poll (time, position, moving flag, switches) in arrays
+//                allocated once when the axis is created, so capturing costs a few stores per poll.
+
+#ifndef LexiumCapture_H
+#define LexiumCapture_H
+
+#include <stddef.h>
+#include <epicsTypes.h>
+#include <epicsTime.h>
+
+#define CAPTURE_LEN 4096          // samples per axis, NELM of the capture waveform records
+
+// bits of the switches array
+#define CAPTURE_HOME       0x1
+#define CAPTURE_HIGH_LIMIT 0x2
+#define CAPTURE_LOW_LIMIT  0x4
+
+////////////////////////////////////
+// LexiumCapture class
+// ring buffer, or a single pass that stops when full
+////////////////////////////////////
+class LexiumCapture
+{
+public:
+	LexiumCapture();
+	~LexiumCapture();
+	void arm(bool oneShot);
+	void stop();
+	bool add(double position, int moving, int switches);
+	size_t copy(double *times, double *positions, epicsInt32 *moving, epicsInt32 *switches, size_t maxSamples) const;
+
+	bool armed;               // samples are being added
+	bool oneShot;             // stop when full instead of overwriting the oldest sample
+	size_t count;             // samples in the buffer
+	epicsTimeStamp start;     // arm() time, sample times are relative to it
+
+	// oldest first, valid while not armed
+	double *timeArray() { return times; }
+	double *positionArray() { return positions; }
+	epicsInt32 *movingArray() { return movingFlags; }
+	epicsInt32 *switchArray() { return switchBits; }
+
+private:
+	double *times;            // seconds since start
+	double *positions;
+	epicsInt32 *movingFlags;
+	epicsInt32 *switchBits;
+	size_t next;              // where the next sample goes
+
+	void linearize();
+};
+
+#endif // LexiumCapture_H
@@ -0,0 +1,89 @@
+//  Description : Fixed-capacity MCode command builder for the Lexium driver.
+//                Commands are formatted straight into a stack buffer, device name prefix included,
+//                without printf or heap allocation. Anything that doesn't fit marks the command
+//                as overflowed instead of being truncated, and the controller refuses to send it.
+
+#ifndef LexiumCommand_H
+#define LexiumCommand_H
+
+#include <stddef.h>
+#include <string.h>
+
+////////////////////////////////////
+// LexiumCommandBuffer class
+// N is the buffer size including the terminating 0
+////////////////////////////////////
+template <size_t N>
+class LexiumCommandBuffer
+{
+public:
+	LexiumCommandBuffer() : len(0), prefixLen(0), overflow(false) { buf[0] = '\0'; }
+	explicit LexiumCommandBuffer(const char *prefix) : len(0), prefixLen(0), overflow(false)
+	{
+		buf[0] = '\0';
+		appendString(prefix);
+		prefixLen = len;
+	}
+
+	LexiumCommandBuffer &appendString(const char *s) { return appendString(s, strlen(s)); }
+	LexiumCommandBuffer &appendString(const char *s, size_t n)
+	{
+		if (overflow || n > N - 1 - len) {
+			overflow = true;
+			return *this;
+		}
+		memcpy(buf + len, s, n);
+		len += n;
+		buf[len] = '\0';
+		return *this;
+	}
+
+	LexiumCommandBuffer &appendChar(char c) { return appendString(&c, 1); }
+
+	// decimal, no locale, no leading zeros
+	LexiumCommandBuffer &appendInteger(long value)
+	{
+		char digits[24];
+		char *p = digits + sizeof(digits);
+		unsigned long u = value < 0 ? 0UL - (unsigned long)value : (unsigned long)value;
+
+		do {
+			*--p = (char)('0' + u % 10);
+			u /= 10;
+		} while (u);
+		if (value < 0) *--p = '-';
+		return appendString(p, digits + sizeof(digits) - p);
+	}
+
+	// add a further command to the same buffer, to be sent in one write:
+	// the separator (the output EOS) and the prefix, nothing if the buffer holds no command yet
+	LexiumCommandBuffer &next(char separator)
+	{
+		if (len == prefixLen) return *this;
+		appendChar(separator);
+		return appendString(buf, prefixLen);
+	}
+
+	// start the next command, keeping the prefix given to the constructor
+	LexiumCommandBuffer &restart()
+	{
+		len = prefixLen;
+		buf[len] = '\0';
+		overflow = false;
+		return *this;
+	}
+
+	const char *c_str() const { return buf; }
+	const char *body() const { return buf + prefixLen; }  // without the prefix
+	size_t length() const { return len; }
+	bool ok() const { return !overflow; }
+	static size_t capacity() { return N - 1; }
+
+private:
+	char buf[N];
+	size_t len;
+	size_t prefixLen;
+	bool overflow;
+};
+
+#endif // LexiumCommand_H
@@ -0,0 +1,304 @@
+//! @File : LexiumFaultInjector.cpp
+//!         Fault injection for the transactions of a Lexium controller, see LexiumFaultInjector.h.
+//!
+//!         draw() picks the faults of each command; LexiumMotorController::ioWrite() closes the connection
+//!         or delays the write, ioRead() holds back, drops or corrupts the reply. The time from a fault
+//!         to the next transaction that went through cleanly is kept as the recovery time.
+//
+//  Revision History
+//  ----------------
+//  Initial version
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <iocsh.h>
+
+#include "asynMotorController.h"
+#include "asynMotorAxis.h"
+
+#include <epicsExport.h>
+#include "LexiumMotorController.h"
+#include "LexiumFaultInjector.h"
+
+// faults that replace the reply, at most one of them hits a transaction
+#define FAULT_REPLY_MASK (FAULT_BIT(lexiumFaultDrop) | FAULT_BIT(lexiumFaultTruncate) | FAULT_BIT(lexiumFaultEcho) | FAULT_BIT(lexiumFaultPrompt))
+
+static const char *faultNames[NUM_LEXIUM_FAULTS] = {"latency", "drop", "truncate", "echo", "prompt", "close"};
+
+LexiumFaultInjector::LexiumFaultInjector()
+	: echoLen(0), latency(0), active(0), anyEnabled(false), state(FAULT_SEED), replyHit(0), recoveryPending(false)
+{
+	lock = epicsMutexMustCreate();
+	memset(rate, 0, sizeof(rate));
+	memset(injected, 0, sizeof(injected));
+	epicsTimeGetCurrent(&latencyEnd);
+	faultTime = latencyEnd;
+}
+
+// xorshift32, uniform in [0, 1)
+double LexiumFaultInjector::random()
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state / 4294967296.0;
+}
+
+////////////////////////////////////////
+//! set()
+//! set the rate of one fault; the first fault set after clear() restarts the random sequence and the counts
+//
+//! @param[in] fault LexiumFault
+//! @param[in] rate  fraction of the transactions hit, 0 to disable the fault
+//! @param[in] value seconds for lexiumFaultLatency, unused otherwise
+////////////////////////////////////////
+void LexiumFaultInjector::set(int fault, double rate, double value)
+{
+	epicsMutexLock(lock);
+	if (!anyEnabled) {
+		state = FAULT_SEED;
+		memset(injected, 0, sizeof(injected));
+		recovery.reset();
+		recoveryPending = false;
+	}
+	this->rate[fault] = rate;
+	if (fault == lexiumFaultLatency) latency = value;
+	anyEnabled = false;
+	for (int i=0; i<NUM_LEXIUM_FAULTS; i++) {
+		if (this->rate[i] > 0) anyEnabled = true;
+	}
+	epicsMutexUnlock(lock);
+}
+
+////////////////////////////////////////
+//! clear()
+//! disable all faults, the counts are kept for report()
+////////////////////////////////////////
+void LexiumFaultInjector::clear()
+{
+	epicsMutexLock(lock);
+	memset(rate, 0, sizeof(rate));
+	anyEnabled = false;
+	active = 0;
+	replyHit = 0;
+	epicsMutexUnlock(lock);
+}
+
+////////////////////////////////////////
+//! draw()
+//! pick the faults of a command about to be written
+//
+//! @param[in] output command
+//! @param[in] len    command length
+//! @param[in] reply  the command has a reply, all faults apply; otherwise only latency and close
+//! @return bits FAULT_BIT(fault) of the faults that hit the command
+////////////////////////////////////////
+int LexiumFaultInjector::draw(const char *output, size_t len, bool reply)
+{
+	int hit = 0;
+	int candidates = reply ? FAULT_BIT(NUM_LEXIUM_FAULTS) - 1 : FAULT_WRITE_MASK;
+
+	epicsMutexLock(lock);
+	for (int i=0; i<NUM_LEXIUM_FAULTS; i++) {
+		if (!(candidates & FAULT_BIT(i)) || rate[i] <= 0) continue;
+		if ((hit & FAULT_REPLY_MASK) && (FAULT_BIT(i) & FAULT_REPLY_MASK)) continue;
+		if (random() < rate[i]) {
+			hit |= FAULT_BIT(i);
+			injected[i]++;
+		}
+	}
+	if (hit && !recoveryPending) {
+		recoveryPending = true;
+		epicsTimeGetCurrent(&faultTime);
+	}
+	if (reply) {
+		replyHit = hit;
+		active = hit & ~FAULT_BIT(lexiumFaultClose);
+		if (hit & FAULT_BIT(lexiumFaultLatency)) {
+			epicsTimeGetCurrent(&latencyEnd);
+			epicsTimeAddSeconds(&latencyEnd, latency);
+		}
+		if (hit & FAULT_BIT(lexiumFaultEcho)) {
+			echoLen = len < FAULT_ECHO_LEN ? len : FAULT_ECHO_LEN;
+			memcpy(echo, output, echoLen);
+		}
+	}
+	epicsMutexUnlock(lock);
+	return hit;
+}
+
+////////////////////////////////////////
+//! pending()
+//! @return bits FAULT_BIT(fault) of the reply faults drawn for the transaction in progress and not applied yet
+////////////////////////////////////////
+int LexiumFaultInjector::pending()
+{
+	int faults;
+
+	epicsMutexLock(lock);
+	faults = active;
+	epicsMutexUnlock(lock);
+	return faults;
+}
+
+////////////////////////////////////////
+//! applied()
+//! clear reply faults once ioRead() has applied them
+//
+//! @param[in] faults bits FAULT_BIT(fault)
+////////////////////////////////////////
+void LexiumFaultInjector::applied(int faults)
+{
+	epicsMutexLock(lock);
+	active &= ~faults;
+	epicsMutexUnlock(lock);
+}
+
+////////////////////////////////////////
+//! transactionDone()
+//! result of a transaction with reply; the first one without fault that succeeds ends the recovery
+//
+//! @param[in] status asyn status of the transaction
+////////////////////////////////////////
+void LexiumFaultInjector::transactionDone(asynStatus status)
+{
+	if (!recoveryPending) return;
+	epicsMutexLock(lock);
+	if (recoveryPending && !replyHit && status == asynSuccess) {
+		recovery.add(lexiumElapsed(&faultTime));
+		recoveryPending = false;
+	}
+	epicsMutexUnlock(lock);
+}
+
+////////////////////////////////////////
+//! report()
+//! print rates, counts and recovery times
+//
+//! @param[in] fp   output
+//! @param[in] name heading, e.g. the controller name
+////////////////////////////////////////
+void LexiumFaultInjector::report(FILE *fp, const char *name)
+{
+	epicsMutexLock(lock);
+	fprintf(fp, "%s: fault injection %s\n", name, anyEnabled ? "on" : "off");
+	for (int i=0; i<NUM_LEXIUM_FAULTS; i++) {
+		if (rate[i] <= 0 && injected[i] == 0) continue;
+		fprintf(fp, "  %-8s rate %.4f, injected %lu", faultNames[i], rate[i], injected[i]);
+		if (i == lexiumFaultLatency) fprintf(fp, ", %.3f s", latency);
+		fprintf(fp, "\n");
+	}
+	recovery.report(fp, "  recovery");
+	epicsMutexUnlock(lock);
+}
+
+int LexiumFaultInjector::findFault(const char *name)
+{
+	for (int i=0; name && i<NUM_LEXIUM_FAULTS; i++) {
+		if (strcmp(name, faultNames[i]) == 0) return i;
+	}
+	return -1;
+}
+
+const char *LexiumFaultInjector::faultName(int fault)
+{
+	return (fault >= 0 && fault < NUM_LEXIUM_FAULTS) ? faultNames[fault] : "?";
+}
+
+////////////////////////////////////////
+//! configureControllers()
+//! set, clear or report the faults of one or all Lexium controllers
+//
+//! @param[in] motorName controller name given to LexiumCreateController(), NULL or empty for all
+//! @param[in] fault     fault name, "off" to clear all faults, NULL or empty to report
+//! @param[in] rate      fraction of the transactions hit
+//! @param[in] value     seconds for latency
+//! @return number of controllers, -1 if the fault name is unknown
+////////////////////////////////////////
+int LexiumFaultInjector::configureControllers(const char *motorName, const char *fault, double rate, double value)
+{
+	LexiumMotorController *pC;
+	bool show = !fault || !fault[0];
+	bool off = !show && strcmp(fault, "off") == 0;
+	int f = -1, configured = 0;
+
+	if (!show && !off && (f = findFault(fault)) < 0) return -1;
+	for (pC = LexiumMotorController::pFirstController; pC; pC = pC->pNextController) {
+		if (motorName && motorName[0] && strcmp(motorName, pC->motorName)) continue;
+		if (show) pC->faults.report(stdout, pC->motorName);
+		else if (off) pC->faults.clear();
+		else pC->faults.set(f, rate, value);
+		configured++;
+	}
+	return configured;
+}
+
+////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////
+// Start code for iocsh Registration :
+// Available Functions :
+//   LexiumInjectFault()
+////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////
+//! LexiumInjectFault()
+//! IOCSH function
+//! Injects faults into the drive transactions of one or all Lexium controllers, for testing
+//
+//! @param[in] motorName controller name given to LexiumCreateController(), empty for all controllers
+//! @param[in] fault     latency, drop, truncate, echo, prompt or close; off to clear all faults, empty to print them
+//! @param[in] rate      fraction of the transactions hit, 0 to 1; 0 disables the fault
+//! @param[in] value     for latency, seconds added to each reply it hits
+////////////////////////////////////////////////////////
+extern "C" int LexiumInjectFault(const char *motorName, const char *fault, double rate, double value)
+{
+	int configured;
+	static const char *functionName = "LexiumInjectFault()";
+
+	if (rate < 0 || rate > 1) {
+		printf("%s:%s: ERROR rate must be between 0 and 1\n", DRIVER_NAME, functionName);
+		return(asynError);
+	}
+	if (fault && strcmp(fault, "latency") == 0 && rate > 0 && value <= 0) {
+		printf("%s:%s: ERROR latency needs a value in seconds\n", DRIVER_NAME, functionName);
+		return(asynError);
+	}
+	configured = LexiumFaultInjector::configureControllers(motorName, fault, rate, value);
+	if (configured < 0) {
+		printf("%s:%s: ERROR unknown fault %s, use latency, drop, truncate, echo, prompt, close or off\n", DRIVER_NAME, functionName, fault);
+		return(asynError);
+	}
+	if (configured == 0) {
+		printf("%s:%s: ERROR no Lexium controller %s\n", DRIVER_NAME, functionName, motorName ? motorName : "");
+		return(asynError);
+	}
+	return(asynSuccess);
+}
+
+////////////////////////////////////////////////////////
+// Motor Port Name : name given to LexiumCreateController(), empty for all
+// Fault           : latency, drop, truncate, echo, prompt, close, off, or empty to print
+// Rate            : fraction of the transactions hit
+// Value           : seconds for latency
+////////////////////////////////////////////////////////
+static const iocshArg LexiumInjectFaultArg0 = {"Motor Port Name", iocshArgString};
+static const iocshArg LexiumInjectFaultArg1 = {"Fault", iocshArgString};
+static const iocshArg LexiumInjectFaultArg2 = {"Rate", iocshArgDouble};
+static const iocshArg LexiumInjectFaultArg3 = {"Value", iocshArgDouble};
+static const iocshArg * const LexiumInjectFaultArgs[] = {&LexiumInjectFaultArg0, &LexiumInjectFaultArg1, &LexiumInjectFaultArg2, &LexiumInjectFaultArg3};
+static const iocshFuncDef LexiumInjectFaultDef = {"LexiumInjectFault", 4, LexiumInjectFaultArgs};
+static void LexiumInjectFaultCallFunc(const iocshArgBuf *args)
+{
+	LexiumInjectFault(args[0].sval, args[1].sval, args[2].dval, args[3].dval);
+}
+
+static void LexiumFaultInjectorRegister(void)
+{
+	iocshRegister(&LexiumInjectFaultDef, LexiumInjectFaultCallFunc);
+}
+
+extern "C" {
+	epicsExportRegistrar(LexiumFaultInjectorRegister);
+}
@@ -0,0 +1,77 @@
+//  Description : Fault injection between a Lexium controller and its IO port, for testing the error paths.
+//                Set per controller with LexiumInjectFault(): each fault hits a given fraction of the
+//                transactions, drawn from a fixed seed so a test run can be repeated. With no fault set
+//                the IO goes straight to the port, the only cost is one flag test per transaction.
+
+#ifndef LexiumFaultInjector_H
+#define LexiumFaultInjector_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <epicsTypes.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include "asynDriver.h"
+#include "LexiumStats.h"
+
+#define FAULT_ECHO_LEN 256         // longest command echoed back by the echo fault
+#define FAULT_SEED 12345           // first state of the random sequence, reset by clear()
+
+enum LexiumFault
+{
+	lexiumFaultLatency = 0,    // reply held back for the latency given, a write waits as long
+	lexiumFaultDrop,           // reply lost, the reader sees silence until its timeout
+	lexiumFaultTruncate,       // reply cut to half its length
+	lexiumFaultEcho,           // command echoed instead of the reply, as a drive not in EM=2
+	lexiumFaultPrompt,         // "?" instead of the reply
+	lexiumFaultClose,          // connection closed before the command is written
+	NUM_LEXIUM_FAULTS
+};
+
+#define FAULT_BIT(fault) (1 << (fault))
+#define FAULT_WRITE_MASK (FAULT_BIT(lexiumFaultLatency) | FAULT_BIT(lexiumFaultClose))  // faults of a command without reply
+
+////////////////////////////////////
+// LexiumFaultInjector class
+// draw() is called when a command is written, from any thread; the reply faults it sets are
+// applied by LexiumMotorController::ioRead(), which takes them with pending() and clears them with applied()
+////////////////////////////////////
+class LexiumFaultInjector
+{
+public:
+	LexiumFaultInjector();
+	bool enabled() const { return anyEnabled; }
+	void set(int fault, double rate, double value);
+	void clear();
+	int draw(const char *output, size_t len, bool reply);
+	int pending();
+	void applied(int faults);
+	void transactionDone(asynStatus status);
+	void report(FILE *fp, const char *name);
+
+	static int configureControllers(const char *motorName, const char *fault, double rate, double value);
+
+	static int findFault(const char *name);
+	static const char *faultName(int fault);
+
+	epicsTimeStamp latencyEnd;    // reply held back until then
+	char echo[FAULT_ECHO_LEN];    // command of the transaction in progress
+	size_t echoLen;
+	double latency;               // seconds, for lexiumFaultLatency
+
+private:
+	epicsMutexId lock;
+	int active;                   // reply faults still to apply to the transaction in progress
+	bool anyEnabled;
+	epicsUInt32 state;            // xorshift state
+	double rate[NUM_LEXIUM_FAULTS];
+	unsigned long injected[NUM_LEXIUM_FAULTS];
+	int replyHit;                 // faults drawn for the last command with reply
+	bool recoveryPending;         // a fault was injected, no clean transaction since
+	epicsTimeStamp faultTime;     // first fault injected since the last clean transaction
+	LexiumHistogram recovery;     // first fault to the end of the next clean transaction
+
+	double random();
+};
+
+#endif // LexiumFaultInjector_H
@@ -0,0 +1,201 @@
+//! @File : LexiumFlightRecorder.cpp
+//!         Always-on record of the drive transactions of a controller, see LexiumFlightRecorder.h.
+//!
+//!         add() claims a slot with an atomic increment and marks it busy through its sequence
+//!         number while it copies the strings in, so writers never wait for each other or for a
+//!         dump. dump() copies each entry and keeps it only if its sequence number is the same
+//!         before and after the copy.
+//
+//  Revision History
+//  ----------------
+//  Initial version
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <epicsAtomic.h>
+#include <iocsh.h>
+
+#include "asynMotorController.h"
+#include "asynMotorAxis.h"
+
+#include <epicsExport.h>
+#include "LexiumMotorController.h"
+#include "LexiumFlightRecorder.h"
+
+// copy at most RECORDER_TEXT_LEN - 1 characters, control characters shown as '.'
+static void recorderCopyText(char *dest, const char *src)
+{
+	int i;
+
+	for (i=0; src && src[i] && i<RECORDER_TEXT_LEN-1; i++) {
+		dest[i] = (src[i] < ' ' || src[i] == 0x7f) ? '.' : src[i];
+	}
+	dest[i] = '\0';
+}
+
+static const char *recorderStatusName(int status)
+{
+	switch (status) {
+	case asynSuccess: return "ok";
+	case asynTimeout: return "timeout";
+	case asynOverflow: return "overflow";
+	case asynError: return "error";
+	case asynDisconnected: return "disconn";
+	case asynDisabled: return "disabled";
+	default: return "?";
+	}
+}
+
+LexiumFlightRecorder::LexiumFlightRecorder()
+	: next(0)
+{
+	memset(entries, 0, sizeof(entries));
+}
+
+////////////////////////////////////////
+//! add()
+//! record one transaction, safe to call from any thread without a lock
+//
+//! @param[in] start   time the command was written
+//! @param[in] command command sent, with the device name in party mode
+//! @param[in] reply   reply read, NULL or empty for commands without reply
+//! @param[in] status  asyn status of the transaction
+////////////////////////////////////////
+void LexiumFlightRecorder::add(const epicsTimeStamp *start, const char *command, const char *reply, asynStatus status)
+{
+	size_t n = epicsAtomicIncrSizeT(&next) - 1;
+	LexiumRecorderEntry *pEntry = &entries[n % RECORDER_ENTRIES];
+
+	epicsAtomicSetSizeT(&pEntry->seq, 2 * n + 1);
+	epicsAtomicWriteMemoryBarrier();
+	pEntry->start = *start;
+	pEntry->latency = lexiumElapsed(start);
+	pEntry->status = status;
+	recorderCopyText(pEntry->command, command);
+	recorderCopyText(pEntry->reply, reply);
+	epicsAtomicWriteMemoryBarrier();
+	epicsAtomicSetSizeT(&pEntry->seq, 2 * n + 2);
+}
+
+////////////////////////////////////////
+//! copyEntry()
+//! @param[in]  n    transaction number
+//! @param[out] copy the transaction
+//! @return false if transaction n is being written or has been overwritten
+////////////////////////////////////////
+bool LexiumFlightRecorder::copyEntry(size_t n, LexiumRecorderEntry *copy) const
+{
+	const LexiumRecorderEntry *pEntry = &entries[n % RECORDER_ENTRIES];
+	size_t seq = epicsAtomicGetSizeT(&pEntry->seq);
+
+	if (seq != 2 * n + 2) return false;
+	epicsAtomicReadMemoryBarrier();
+	memcpy(copy, pEntry, sizeof(*copy));
+	epicsAtomicReadMemoryBarrier();
+	return epicsAtomicGetSizeT(&pEntry->seq) == seq;
+}
+
+////////////////////////////////////////
+//! dump()
+//! print the last transactions, oldest first
+//
+//! @param[in] fp    output
+//! @param[in] name  controller name for the heading
+//! @param[in] count number of transactions, at most RECORDER_ENTRIES
+////////////////////////////////////////
+void LexiumFlightRecorder::dump(FILE *fp, const char *name, int count) const
+{
+	size_t last = epicsAtomicGetSizeT(&next);
+	size_t first;
+	LexiumRecorderEntry entry;
+	char timeText[40];
+
+	if (count > RECORDER_ENTRIES) count = RECORDER_ENTRIES;
+	first = last > (size_t)count ? last - count : 0;
+	fprintf(fp, "%s: last %d of %lu transactions\n", name, (int)(last - first), (unsigned long)last);
+	for (size_t n=first; n<last; n++) {
+		if (!copyEntry(n, &entry)) {
+			fprintf(fp, "  (transaction %lu overwritten or in progress)\n", (unsigned long)n);
+			continue;
+		}
+		epicsTimeToStrftime(timeText, sizeof(timeText), "%Y-%m-%d %H:%M:%S.%06f", &entry.start);
+		fprintf(fp, "  %s %9.6f %-8s %s%s%s\n", timeText, entry.latency, recorderStatusName(entry.status),
+		        entry.command, entry.reply[0] ? " -> " : "", entry.reply);
+	}
+}
+
+////////////////////////////////////////
+//! dumpControllers()
+//! dump() one or all Lexium controllers to stdout
+//
+//! @param[in] motorName controller name given to LexiumCreateController(), NULL or empty for all
+//! @param[in] count     number of transactions per controller
+//! @return number of controllers dumped
+////////////////////////////////////////
+int LexiumFlightRecorder::dumpControllers(const char *motorName, int count)
+{
+	LexiumMotorController *pC;
+	int dumped = 0;
+
+	for (pC = LexiumMotorController::pFirstController; pC; pC = pC->pNextController) {
+		if (motorName && motorName[0] && strcmp(motorName, pC->motorName)) continue;
+		pC->recorder.dump(stdout, pC->motorName, count);
+		dumped++;
+	}
+	return dumped;
+}
+
+////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////
+// Start code for iocsh Registration :
+// Available Functions :
+//   LexiumDumpIO()
+////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////
+//! LexiumDumpIO()
+//! IOCSH function
+//! Prints the last drive transactions of one or all Lexium controllers
+//
+//! @param[in] motorName controller name given to LexiumCreateController(), empty for all controllers
+//! @param[in] count     transactions per controller, DEFAULT_DUMP_ENTRIES if 0, at most RECORDER_ENTRIES
+////////////////////////////////////////////////////////
+extern "C" int LexiumDumpIO(const char *motorName, int count)
+{
+	static const char *functionName = "LexiumDumpIO()";
+
+	if (count < 0) {
+		printf("%s:%s: ERROR count must not be negative\n", DRIVER_NAME, functionName);
+		return(asynError);
+	}
+	if (count == 0) count = DEFAULT_DUMP_ENTRIES;
+	if (LexiumFlightRecorder::dumpControllers(motorName, count) == 0) {
+		printf("%s:%s: ERROR no Lexium controller %s\n", DRIVER_NAME, functionName, motorName ? motorName : "");
+		return(asynError);
+	}
+	return(asynSuccess);
+}
+
+////////////////////////////////////////////////////////
+// Motor Port Name : name given to LexiumCreateController(), empty for all
+// Count           : transactions per controller
+////////////////////////////////////////////////////////
+static const iocshArg LexiumDumpIOArg0 = {"Motor Port Name", iocshArgString};
+static const iocshArg LexiumDumpIOArg1 = {"Count", iocshArgInt};
+static const iocshArg * const LexiumDumpIOArgs[] = {&LexiumDumpIOArg0, &LexiumDumpIOArg1};
+static const iocshFuncDef LexiumDumpIODef = {"LexiumDumpIO", 2, LexiumDumpIOArgs};
+static void LexiumDumpIOCallFunc(const iocshArgBuf *args)
+{
+	LexiumDumpIO(args[0].sval, args[1].ival);
+}
+
+static void LexiumFlightRecorderRegister(void)
+{
+	iocshRegister(&LexiumDumpIODef, LexiumDumpIOCallFunc);
+}
+
+extern "C" {
+	epicsExportRegistrar(LexiumFlightRecorderRegister);
+}
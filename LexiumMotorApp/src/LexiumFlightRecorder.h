@@ -0,0 +1,52 @@
+//  Description : Flight recorder of the drive transactions of one Lexium controller.
+//                Keeps the last RECORDER_ENTRIES commands with their reply, status, start time and
+//                latency in a fixed ring, written without lock or allocation on every transaction,
+//                so it can stay on all the time and be dumped with LexiumDumpIO() after an incident.
+
+#ifndef LexiumFlightRecorder_H
+#define LexiumFlightRecorder_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <epicsTime.h>
+#include "asynDriver.h"
+
+#define RECORDER_ENTRIES 256       // transactions kept per controller, a power of 2
+#define RECORDER_TEXT_LEN 40       // command and reply are truncated to this length - 1
+#define DEFAULT_DUMP_ENTRIES 20    // LexiumDumpIO() count if 0
+
+////////////////////////////////////
+// LexiumRecorderEntry
+// one transaction, seq is odd while the entry is being written
+////////////////////////////////////
+struct LexiumRecorderEntry
+{
+	size_t seq;
+	epicsTimeStamp start;
+	double latency;            // seconds
+	int status;                // asynStatus
+	char command[RECORDER_TEXT_LEN];
+	char reply[RECORDER_TEXT_LEN];   // empty for commands without reply
+};
+
+////////////////////////////////////
+// LexiumFlightRecorder class
+// many writers, any number of readers; a reader skips the entries overwritten while it copies them
+////////////////////////////////////
+class LexiumFlightRecorder
+{
+public:
+	LexiumFlightRecorder();
+	void add(const epicsTimeStamp *start, const char *command, const char *reply, asynStatus status);
+	void dump(FILE *fp, const char *name, int count) const;
+
+	static int dumpControllers(const char *motorName, int count);
+
+private:
+	size_t next;               // transactions added so far, transaction n goes to entries[n % RECORDER_ENTRIES]
+	LexiumRecorderEntry entries[RECORDER_ENTRIES];
+
+	bool copyEntry(size_t n, LexiumRecorderEntry *copy) const;
+};
+
+#endif // LexiumFlightRecorder_H
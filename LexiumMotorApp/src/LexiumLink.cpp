@@ -0,0 +1,82 @@
+//! @File : LexiumLink.cpp
+//!         Connection state of a drive, see LexiumLink.h.
+//!         LexiumMotorController counts the result of every transaction with addResult(),
+//!         LexiumMotorAxis::pollAxis() probes the drive while the link is down.
+//
+//  Revision History
+//  ----------------
+//  Initial version
+
+#include <stddef.h>
+
+#include "LexiumLink.h"
+
+LexiumLink::LexiumLink()
+	: up(true), probing(false), timeouts(0), backoff(LINK_PROBE_MIN), reconnects(0), replied(false)
+{
+	epicsTimeGetCurrent(&nextProbe);
+	lastReply = nextProbe;
+}
+
+////////////////////////////////////////
+//! addResult()
+//! count the result of one transaction with the drive
+//! Any reply, even a wrong or truncated one, shows the drive is there
+//
+//! @param[in] status      asyn status of the transaction, timeout, disconnect or other port error if no reply came
+//! @param[in] maxTimeouts failed transactions in a row that take the link down, 0 to never take it down
+//! @return true if this result has taken the link down
+////////////////////////////////////////
+bool LexiumLink::addResult(asynStatus status, int maxTimeouts)
+{
+	if (status == asynSuccess || status == asynOverflow) {
+		timeouts = 0;
+		replied = true;
+		epicsTimeGetCurrent(&lastReply);
+		return false;
+	}
+	timeouts++;
+	if (!up || maxTimeouts <= 0 || timeouts < maxTimeouts) return false;
+
+	up = false;
+	backoff = LINK_PROBE_MIN;
+	epicsTimeGetCurrent(&nextProbe);
+	epicsTimeAddSeconds(&nextProbe, backoff);
+	return true;
+}
+
+////////////////////////////////////////
+//! probeDue()
+//! @param[in] now current time
+//! @return true if the link is down and the next probe is due
+////////////////////////////////////////
+bool LexiumLink::probeDue(const epicsTimeStamp *now) const
+{
+	return !up && epicsTimeDiffInSeconds(now, &nextProbe) >= 0;
+}
+
+////////////////////////////////////////
+//! probeFailed()
+//! the drive didn't answer the probe, wait twice as long for the next one, up to LINK_PROBE_MAX
+//
+//! @param[in] now current time
+////////////////////////////////////////
+void LexiumLink::probeFailed(const epicsTimeStamp *now)
+{
+	backoff *= 2;
+	if (backoff > LINK_PROBE_MAX) backoff = LINK_PROBE_MAX;
+	nextProbe = *now;
+	epicsTimeAddSeconds(&nextProbe, backoff);
+}
+
+////////////////////////////////////////
+//! reconnected()
+//! the drive answered the probe
+////////////////////////////////////////
+void LexiumLink::reconnected()
+{
+	up = true;
+	timeouts = 0;
+	backoff = LINK_PROBE_MIN;
+	reconnects++;
+}
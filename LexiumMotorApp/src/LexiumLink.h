@@ -0,0 +1,41 @@
+//  Description : Connection state of one Lexium drive.
+//                A drive that fails to answer Lexium_LINKTIMEOUTS transactions in a row is marked down;
+//                commands to it then fail straight away instead of each waiting out the timeout,
+//                and the poller probes it with PR VR at growing intervals until it answers again.
+
+#ifndef LexiumLink_H
+#define LexiumLink_H
+
+#include <epicsTime.h>
+#include "asynDriver.h"
+
+#define DEFAULT_LINK_TIMEOUTS 3    // default for Lexium_LINKTIMEOUTS
+#define LINK_PROBE_MIN 0.5         // seconds from link down to the first probe
+#define LINK_PROBE_MAX 30.0        // longest time between probes
+#define LINK_PROBE_TIMEOUT 0.5     // reply timeout of the probe, a live drive answers in milliseconds
+
+////////////////////////////////////
+// LexiumLink class
+// up -> down after maxTimeouts timeouts in a row, down -> up when a probe is answered
+////////////////////////////////////
+class LexiumLink
+{
+public:
+	LexiumLink();
+	bool allowIO() const { return up || probing; }
+	bool addResult(asynStatus status, int maxTimeouts);
+	bool probeDue(const epicsTimeStamp *now) const;
+	void probeFailed(const epicsTimeStamp *now);
+	void reconnected();
+
+	bool up;
+	bool probing;                 // probe in progress, its commands are sent while the link is down
+	int timeouts;                 // transactions without reply in a row
+	double backoff;               // seconds from the last probe to the next one
+	epicsTimeStamp nextProbe;
+	unsigned long reconnects;     // times the link came back up
+	bool replied;                 // lastReply is valid
+	epicsTimeStamp lastReply;     // end of the last transaction that got a reply
+};
+
+#endif // LexiumLink_H
@@ -0,0 +1,203 @@
+//! @File : LexiumModbus.cpp
+//!         Modbus/TCP frames used by LexiumMotorController::modbusTransaction(), see LexiumModbus.h.
+//!         Frames are built and checked in place, big endian as on the wire; a response is only
+//!         used if it matches its request in every field the drive echoes.
+//
+//  Revision History
+//  ----------------
+//  Initial version
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <epicsStdio.h>
+
+#include "LexiumModbus.h"
+
+static inline void put16(unsigned char *p, unsigned value)
+{
+	p[0] = (unsigned char)(value >> 8);
+	p[1] = (unsigned char)value;
+}
+
+static inline unsigned get16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+// MBAP header for a PDU of pduLen bytes
+static void putHeader(unsigned char *frame, epicsUInt16 tid, size_t pduLen)
+{
+	put16(frame, tid);
+	put16(frame + 2, 0);                    // protocol id, always 0
+	put16(frame + 4, (unsigned)pduLen + 1); // unit id and PDU
+	frame[6] = LEXIUM_MB_UNIT;
+}
+
+////////////////////////////////////////
+//! lexiumModbusReadRequest()
+//! build a Read Holding Registers request
+//
+//! @param[out] frame at least LEXIUM_MB_MAX_FRAME bytes
+//! @param[in]  tid   transaction id, echoed in the response
+//! @param[in]  addr  first register
+//! @param[in]  count number of registers, at most LEXIUM_MB_MAX_REGS
+//! @return frame length
+////////////////////////////////////////
+size_t lexiumModbusReadRequest(unsigned char *frame, epicsUInt16 tid, int addr, int count)
+{
+	putHeader(frame, tid, 5);
+	frame[7] = LEXIUM_MB_READ;
+	put16(frame + 8, addr);
+	put16(frame + 10, count);
+	return LEXIUM_MB_HEADER_LEN + 5;
+}
+
+////////////////////////////////////////
+//! lexiumModbusWriteRequest()
+//! build a Write Multiple Registers request
+//
+//! @param[out] frame  at least LEXIUM_MB_MAX_FRAME bytes
+//! @param[in]  tid    transaction id, echoed in the response
+//! @param[in]  addr   first register
+//! @param[in]  values register values
+//! @param[in]  count  number of registers, at most LEXIUM_MB_MAX_REGS
+//! @return frame length
+////////////////////////////////////////
+size_t lexiumModbusWriteRequest(unsigned char *frame, epicsUInt16 tid, int addr, const epicsUInt16 *values, int count)
+{
+	putHeader(frame, tid, 6 + 2 * count);
+	frame[7] = LEXIUM_MB_WRITE;
+	put16(frame + 8, addr);
+	put16(frame + 10, count);
+	frame[12] = (unsigned char)(2 * count);
+	for (int i=0; i<count; i++) put16(frame + 13 + 2 * i, values[i]);
+	return LEXIUM_MB_HEADER_LEN + 6 + 2 * count;
+}
+
+size_t lexiumModbusFrameLength(const unsigned char *frame, size_t len)
+{
+	unsigned length;
+
+	if (len < LEXIUM_MB_HEADER_LEN) return LEXIUM_MB_HEADER_LEN;
+	length = get16(frame + 4);
+	if (get16(frame + 2) != 0 || length < 2 || length > LEXIUM_MB_MAX_FRAME - 6) return 0;
+	return 6 + length;
+}
+
+epicsUInt16 lexiumModbusTid(const unsigned char *frame)
+{
+	return (epicsUInt16)get16(frame);
+}
+
+////////////////////////////////////////
+//! lexiumModbusCheckResponse()
+//! check a complete response frame against the request it answers
+//
+//! @param[in]  request       request frame
+//! @param[in]  response      response frame
+//! @param[in]  len           response length
+//! @param[out] values        registers read by a Read Holding Registers request, may be NULL
+//! @param[out] exceptionCode exception code if lexiumModbusException is returned
+//! @return lexiumModbusOk, or why the response can't be used
+////////////////////////////////////////
+LexiumModbusError lexiumModbusCheckResponse(const unsigned char *request, const unsigned char *response, size_t len,
+                                            epicsUInt16 *values, int *exceptionCode)
+{
+	int count = get16(request + 10);
+
+	if (len < LEXIUM_MB_HEADER_LEN + 2 || len != lexiumModbusFrameLength(response, len)) return lexiumModbusShort;
+	if (get16(response) != get16(request) || response[6] != request[6]) return lexiumModbusHeader;
+
+	if (response[7] == (request[7] | 0x80)) {
+		*exceptionCode = response[8];
+		return lexiumModbusException;
+	}
+	if (response[7] != request[7]) return lexiumModbusFunction;
+
+	if (request[7] == LEXIUM_MB_READ) {
+		if (response[8] != 2 * count) return lexiumModbusFunction;
+		if (len != (size_t)LEXIUM_MB_HEADER_LEN + 2 + 2 * count) return lexiumModbusShort;
+		for (int i=0; values && i<count; i++) values[i] = (epicsUInt16)get16(response + 9 + 2 * i);
+		return lexiumModbusOk;
+	}
+
+	// write response echoes address and count
+	if (len != LEXIUM_MB_HEADER_LEN + 5) return lexiumModbusShort;
+	if (memcmp(response + 8, request + 8, 4)) return lexiumModbusFunction;
+	return lexiumModbusOk;
+}
+
+void lexiumModbusPut32(epicsUInt16 *regs, long value)
+{
+	epicsUInt32 u = (epicsUInt32)value;
+
+	regs[0] = (epicsUInt16)(u >> 16);
+	regs[1] = (epicsUInt16)u;
+}
+
+long lexiumModbusGet32(const epicsUInt16 *regs)
+{
+	return (long)(epicsInt32)(((epicsUInt32)regs[0] << 16) | regs[1]);
+}
+
+////////////////////////////////////////
+//! lexiumModbusDescribe()
+//! text of a request or response, registers as unsigned decimal
+//
+//! @param[in]  frame request or response frame
+//! @param[in]  len   frame length
+//! @param[out] text  the text, truncated to size
+//! @param[in]  size  size of text
+////////////////////////////////////////
+void lexiumModbusDescribe(const unsigned char *frame, size_t len, char *text, size_t size)
+{
+	size_t n = 0;
+	int count = 0;
+	const unsigned char *data = NULL;
+
+	if (size == 0) return;
+	text[0] = '\0';
+	if (len < LEXIUM_MB_HEADER_LEN + 2) {
+		epicsSnprintf(text, size, "%u bytes", (unsigned)len);
+		return;
+	}
+	if (frame[7] & 0x80) {
+		epicsSnprintf(text, size, "exception %u", frame[8]);
+		return;
+	}
+
+	if (frame[7] == LEXIUM_MB_READ && len == LEXIUM_MB_HEADER_LEN + 5) {
+		epicsSnprintf(text, size, "R 0x%04x+%u", get16(frame + 8), get16(frame + 10));
+		return;
+	} else if (frame[7] == LEXIUM_MB_READ) {      // response
+		count = frame[8] / 2;
+		data = frame + 9;
+	} else if (frame[7] == LEXIUM_MB_WRITE && len == LEXIUM_MB_HEADER_LEN + 5) {
+		epicsSnprintf(text, size, "ok");
+		return;
+	} else if (frame[7] == LEXIUM_MB_WRITE) {     // request
+		n = epicsSnprintf(text, size, "W 0x%04x+%u ", get16(frame + 8), get16(frame + 10));
+		count = frame[12] / 2;
+		data = frame + 13;
+	} else {
+		epicsSnprintf(text, size, "function %u", frame[7]);
+		return;
+	}
+
+	for (int i=0; i<count && n < size && data + 2 * i + 2 <= frame + len; i++) {
+		n += epicsSnprintf(text + n, size - n, i ? ",%u" : "%u", get16(data + 2 * i));
+	}
+}
+
+const char *lexiumModbusErrorString(LexiumModbusError error)
+{
+	switch (error) {
+	case lexiumModbusOk: return "no error";
+	case lexiumModbusShort: return "response truncated";
+	case lexiumModbusHeader: return "response to another request";
+	case lexiumModbusFunction: return "response doesn't match request";
+	case lexiumModbusException: return "exception response";
+	}
+	return "unknown error";
+}
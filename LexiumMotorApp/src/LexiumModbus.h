@@ -0,0 +1,78 @@
+//  Description : Modbus/TCP framing and register map for Lexium MDrive Ethernet units.
+//                Used instead of MCode by controllers created after LexiumModbusTransport(1):
+//                each poll reads position, moving flag, inputs and LR/ER/ST with one Read Holding
+//                Registers request, and every command is a Write Multiple Registers request
+//                that the drive acknowledges or answers with an exception.
+
+#ifndef LexiumModbus_H
+#define LexiumModbus_H
+
+#include <stddef.h>
+#include <epicsTypes.h>
+
+#define LEXIUM_MB_PORT 502          // Modbus/TCP port of the drive, MCode is on 503
+#define LEXIUM_MB_UNIT 0xFF         // unit identifier, 0xFF addresses the drive itself
+#define LEXIUM_MB_HEADER_LEN 7      // MBAP header: transaction id, protocol id, length, unit id
+#define LEXIUM_MB_MAX_FRAME 260     // MBAP header and longest PDU
+#define LEXIUM_MB_MAX_REGS 16       // most registers the driver reads or writes in one request
+#define LEXIUM_MB_READ 0x03         // Read Holding Registers
+#define LEXIUM_MB_WRITE 0x10        // Write Multiple Registers
+
+// register map, also served by lexiumSim -m
+// 32 bit values take two registers, high word first
+#define LEXIUM_MB_P      0x0000     // P, position (2)
+#define LEXIUM_MB_MV     0x0002     // MV
+#define LEXIUM_MB_IN     0x0003     // inputs, bit n-1 is I<n>
+#define LEXIUM_MB_ER     0x0004     // ER
+#define LEXIUM_MB_LR     0x0005     // LR
+#define LEXIUM_MB_ST     0x0006     // ST
+#define LEXIUM_MB_STATUS_LEN 7      // P to ST, read by each poll
+#define LEXIUM_MB_VI     0x0010     // VI (2)
+#define LEXIUM_MB_VM     0x0012     // VM (2)
+#define LEXIUM_MB_A      0x0014     // A (2)
+#define LEXIUM_MB_EE     0x0016     // EE
+#define LEXIUM_MB_VR     0x0017     // firmware version times 1000, e.g. 3009 for 3.009
+#define LEXIUM_MB_IS     0x0018     // IS type of inputs 1-4, one register each
+#define LEXIUM_MB_NUM_INPUTS 4
+#define LEXIUM_MB_MA     0x0020     // writing starts an absolute move (2)
+#define LEXIUM_MB_MR     0x0022     // writing starts a relative move (2)
+#define LEXIUM_MB_SL     0x0024     // writing slews at this velocity, 0 stops (2)
+#define LEXIUM_MB_HM     0x0026     // writing homes, HM type
+#define LEXIUM_MB_PSET   0x0028     // writing sets P (2), followed by C1 and C2
+#define LEXIUM_MB_C1     0x002A     // C1 (2)
+#define LEXIUM_MB_C2     0x002C     // C2 (2)
+#define LEXIUM_MB_CF     0x002E     // writing clears LR and ER
+#define LEXIUM_MB_S      0x002F     // writing stores the settings in NVM
+
+enum LexiumModbusError
+{
+	lexiumModbusOk = 0,
+	lexiumModbusShort,          // response shorter than its header or PDU says
+	lexiumModbusHeader,         // transaction, protocol or unit id not those of the request
+	lexiumModbusFunction,       // function code or echoed address/count not those of the request
+	lexiumModbusException       // drive answered with an exception code
+};
+
+// requests, return the frame length
+size_t lexiumModbusReadRequest(unsigned char *frame, epicsUInt16 tid, int addr, int count);
+size_t lexiumModbusWriteRequest(unsigned char *frame, epicsUInt16 tid, int addr, const epicsUInt16 *values, int count);
+
+// length of the frame starting at frame, from its header; LEXIUM_MB_HEADER_LEN until len covers the header,
+// 0 if the header is not a Modbus/TCP one
+size_t lexiumModbusFrameLength(const unsigned char *frame, size_t len);
+epicsUInt16 lexiumModbusTid(const unsigned char *frame);
+
+// check a response against its request, copy the registers read to values (may be NULL)
+LexiumModbusError lexiumModbusCheckResponse(const unsigned char *request, const unsigned char *response, size_t len,
+                                            epicsUInt16 *values, int *exceptionCode);
+
+// 32 bit values in two registers
+void lexiumModbusPut32(epicsUInt16 *regs, long value);
+long lexiumModbusGet32(const epicsUInt16 *regs);
+
+// short text of a frame for the flight recorder and traces, e.g. "R 0x0000+7", "W 0x0020+2 5000"
+void lexiumModbusDescribe(const unsigned char *frame, size_t len, char *text, size_t size);
+
+const char *lexiumModbusErrorString(LexiumModbusError error);
+
+#endif // LexiumModbus_H
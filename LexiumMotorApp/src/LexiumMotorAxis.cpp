@@ -17,6 +17,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 #include <exception>
 #include <epicsThread.h>
 #include <iocsh.h>
@@ -27,6 +28,8 @@
 
 #include <epicsExport.h>
 #include "LexiumMotorController.h"
+#include "LexiumReply.h"
+#include "LexiumModbus.h"
 
 ////////////////////////////////////////////////////////
 //! LexiumMotorAxis()
@@ -34,16 +37,54 @@
 //
 //! @param[in] pC pointer to LexiumMotorController
 //! @param[in] axisNum axis number
+//! @param[in] devName party mode device name (DN) of the drive, "" if not using party mode
 ////////////////////////////////////////////////////////
-LexiumMotorAxis::LexiumMotorAxis(LexiumMotorController *pC, int axisNum)
-  : asynMotorAxis(pC, axisNum), pController(pC)
+LexiumMotorAxis::LexiumMotorAxis(LexiumMotorController *pC, int axisNum, const char *devName)
+  : asynMotorAxis(pC, axisNum), pController(pC),
+    homeSwitchInput(-1), posLimitSwitchInput(-1), negLimitSwitchInput(-1), probed(!pC->backgroundStartup), combinedPollRejected(false), combinedPollAccepted(false), slowReplyDue(false),
+    pollRequested(true), lastMoving(false), lastPollStatus(asynSuccess), lastErrorCode(-1), errorCodeRead(false), healthDue(true), lastPosition(0), endPredicted(false),
+    baseVelocityValid(false), maxVelocityValid(false), accelerationValid(false),
+    lastBaseVelocity(0), lastMaxVelocity(0), lastAcceleration(0), unconfirmedMoveParameters(0), skippedWrites(0),
+    pollCpuTime(0), moveTimed(false), captureNextMove(false), captureThisMove(false),
+    nvmPositionValid(false), nvmPosition(0), nvmSavePending(false), nvmPendingPosition(0), nvmSaves(0),
+    streamPending(false), streamMinVelocity(0), streamMaxVelocity(0), streamAcceleration(0), streamCoalesced(0)
 {
 	static const char *functionName = "LexiumMotorAxis()";
-	asynPrint(pC->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: Create Axis %d\n", DRIVER_NAME, functionName, axisNum);
+	asynPrint(pC->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: Create Axis %d, deviceName=%s\n", DRIVER_NAME, functionName, axisNum, devName);
+
+	strncpy(deviceName, devName, MAX_NAME_LEN - 1);
+	deviceName[MAX_NAME_LEN - 1] = '\0';
+	epicsTimeGetCurrent(&idleStart);
+
+	// per axis parameter defaults
+	setIntegerParam(pC->LexiumCombinedPoll_, 1);
+	setIntegerParam(pC->LexiumSkippedWrites_, 0);
+	setIntegerParam(pC->LexiumLockedRotor_, 0);
+	setIntegerParam(pC->LexiumErrorCode_, 0);
+	setIntegerParam(pC->LexiumStalled_, 0);
+	setIntegerParam(pC->LexiumClearLock_, 0);
+	setDoubleParam(pC->LexiumHealthPeriod_, DEFAULT_HEALTH_PERIOD);
+	setDoubleParam(pC->LexiumStopLatency_, 0);
+	setIntegerParam(pC->LexiumCaptureArm_, 0);
+	setIntegerParam(pC->LexiumCaptureMode_, 0);
+	setIntegerParam(pC->LexiumCaptureTrigger_, 0);
+	setIntegerParam(pC->LexiumCaptureCount_, 0);
+	setDoubleParam(pC->LexiumCaptureStart_, 0);
+	setDoubleParam(pC->LexiumNVMSaveIdle_, 0);
+	setIntegerParam(pC->LexiumNVMSaves_, 0);
+	setIntegerParam(pC->LexiumLinkTimeouts_, DEFAULT_LINK_TIMEOUTS);
+	setIntegerParam(pC->LexiumLinkUp_, 1);
+	setIntegerParam(pC->LexiumReconnects_, 0);
+	setIntegerParam(pC->LexiumStreamVelocity_, 0);
+	setDoubleParam(pC->LexiumStreamLatency_, 0);
+	setIntegerParam(pC->LexiumStreamCoalesced_, 0);
 
     // run setup/initialize routines here
     // check communication, set moving status
-	if (configAxis() == asynError) {
+	if (pC->backgroundStartup) { // configAxis() runs later in LexiumMotorController::startupProbe()
+		setIntegerParam(pC->motorStatusProblem_, 1);
+		setIntegerParam(pC->motorStatusCommsError_, 1);
+	} else if (configAxis() == asynError) {
     	asynPrint(pC->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: controller config failed for motor port=%s\n", DRIVER_NAME, functionName, pController->motorName);
     	// TODO throw exception
     }
@@ -60,22 +101,29 @@ LexiumMotorAxis::LexiumMotorAxis(LexiumMotorController *pC, int axisNum)
 asynStatus LexiumMotorAxis::configAxis()
 {
 	asynStatus status = asynError;
-	char cmd[MAX_CMD_LEN];
+	LexiumCommand cmd(deviceName);
 	char resp[MAX_BUFF_LEN];
 	size_t nread;
 	int maxRetries=3;
+	long encoderEnable;
 	static const char *functionName = "configAxis()";
 	// figure out what needs to be done to initialize controller
 
+	// drive may have been power cycled, nothing cached from before is trusted
+	invalidateMoveParameters();
+	healthDue = true;
+	combinedPollAccepted = false;
+	if (pController->modbus) return configAxisModbus();
+
 	// try getting firmware version to make sure communication works
-	sprintf(cmd, "PR VR");
+	cmd.appendString("PR VR");
 	for (int i=0; i<maxRetries; i++) {
 		status = pController->writeReadController(cmd, resp, sizeof(resp), &nread, Lexium_TIMEOUT);
 		asynPrint(pController->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: Version retry.\n", pController->motorName, functionName);
 		if (status == asynError) {
 			asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Version inquiry FAILED.\n", pController->motorName, functionName);
 		} else { // ok to check firmware level/format or just strlen? v3.009
-			if (strlen(resp) < 2) {
+			if (strlen(resp) < 2 || lexiumCheckReply(resp, nread, cmd.body()) != lexiumReplyOk) {
 				asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Version inquiry FAILED version=%s.\n", pController->motorName, functionName, resp);
 				setIntegerParam(pController->motorStatusProblem_, 1);
 				setIntegerParam(pController->motorStatusCommsError_, 1);
@@ -86,21 +134,99 @@ asynStatus LexiumMotorAxis::configAxis()
 	}
 
 	// set encoder flags
-	sprintf(cmd, "PR EE");
-	status = pController->writeReadController(cmd, resp, sizeof(resp), &nread, Lexium_TIMEOUT);
+	cmd.restart().appendString("PR EE");
+	status = queryValue(cmd, &encoderEnable);
 	if (status == asynSuccess) {
-		int val = atoi(resp);
+		int val = (int)encoderEnable;
 		setIntegerParam(pController->motorStatusHasEncoder_, val ? 1:0);
 		setIntegerParam(pController->motorStatusGainSupport_, val ? 1:0);
 		asynPrint(pController->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: set motorStatusHasEncoder_=%d, motorStatusGainSupport_=%d.\n", pController->motorName, functionName, val, val);
 	}
 
-	// start idle timer
-	//idleTimeStart = epicsTime::getCurrent();
-
 	return status;
 }
 
+////////////////////////////////////////
+//! configAxisModbus()
+//! configAxis() for the Modbus/TCP transport: EE and VR with one read
+////////////////////////////////////////
+asynStatus LexiumMotorAxis::configAxisModbus()
+{
+	asynStatus status = asynError;
+	epicsUInt16 regs[2];
+	int maxRetries=3;
+	static const char *functionName = "configAxisModbus()";
+
+	for (int i=0; i<maxRetries && status; i++) {
+		status = pController->readRegisters(this, LEXIUM_MB_EE, 2, regs, Lexium_TIMEOUT);
+	}
+	if (status || regs[LEXIUM_MB_VR - LEXIUM_MB_EE] == 0) {
+		asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: Version inquiry FAILED.\n", pController->motorName, functionName);
+		setIntegerParam(pController->motorStatusProblem_, 1);
+		setIntegerParam(pController->motorStatusCommsError_, 1);
+		return asynError;
+	}
+
+	int val = regs[0] ? 1 : 0;
+	setIntegerParam(pController->motorStatusHasEncoder_, val);
+	setIntegerParam(pController->motorStatusGainSupport_, val);
+	asynPrint(pController->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: version %d, set motorStatusHasEncoder_=%d, motorStatusGainSupport_=%d.\n", pController->motorName, functionName,
+	          regs[LEXIUM_MB_VR - LEXIUM_MB_EE], val, val);
+	return asynSuccess;
+}
+
+////////////////////////////////////////
+//! readHomeAndLimitConfig
+//! read home, positive limit, and neg limit switch configuration from MCode S1-S4 settings
+//! Limits must be set up beforehand with IS command: 
+// IS = <input#>, <type>, <active>
+//! I1-I4 are used to read the status of
+//  Use logic from existing drvMDrive.cc
+////////////////////////////////////////
+int LexiumMotorAxis::readHomeAndLimitConfig()
+{
+	asynStatus status;
+	LexiumInputConfig config[MAX_REPLY_LINES];
+	int numInputs;
+	static const char *functionName = "readHomeAndLimitConfig()";
+
+	// iterate through response of IS = and parse each configuration to see if home, pos, and neg limits are set
+	if (pController->modbus) { // one register per input, holding its type
+		epicsUInt16 types[LEXIUM_MB_NUM_INPUTS];
+		status = pController->readRegisters(this, LEXIUM_MB_IS, LEXIUM_MB_NUM_INPUTS, types, Lexium_TIMEOUT);
+		for (numInputs=0; status == asynSuccess && numInputs<LEXIUM_MB_NUM_INPUTS; numInputs++) {
+			config[numInputs].input = numInputs + 1;
+			config[numInputs].type = types[numInputs];
+			config[numInputs].active = 1;
+		}
+	} else {
+		status = pController->readInputConfig(deviceName, config, MAX_REPLY_LINES, &numInputs);
+	}
+	if (status) {
+		printf("%s:%s: ERROR reading input configuration (PR IS)\n", DRIVER_NAME, functionName);
+		return status;
+	}
+	// rerun by reconnect(), the drive may have come back with other or no switch inputs
+	homeSwitchInput = posLimitSwitchInput = negLimitSwitchInput = -1;
+	for (int j=0; j<numInputs; j++) {
+		switch (config[j].type) {
+		case 0: break; // general purpose input
+		case 1: // home switch input
+			homeSwitchInput = config[j].input; break;
+		case 2: // positive limit switch input
+			posLimitSwitchInput = config[j].input; break;
+		case 3: // negative limit switch input
+			negLimitSwitchInput = config[j].input; break;
+		default:
+			printf("%s:%s: ERROR invalid data type for IS%d=%d\n", DRIVER_NAME, functionName, config[j].input, config[j].type);
+		}
+	}
+	
+	if (deviceName[0]) printf("%s: ", deviceName);
+	printf("+LimitInput = %d,  -LimitInput = %d,   homeSwitch = %d\n", posLimitSwitchInput, negLimitSwitchInput,homeSwitchInput);
+
+	return status;
+}
 
 ////////////////////////////////////////////////////////
 //! setAxisMoveParameters()
@@ -109,13 +235,26 @@ asynStatus LexiumMotorAxis::configAxis()
 //! @param[in] minVelocity
 //! @param[in] maxVelocity
 //! @param[in] acceleration
+//! @param[in,out] seq sequence to add the commands to, see writeSequence()
+//! @param[out] appended MOVE_VI, MOVE_VM and/or MOVE_A added to seq, for confirmMoveParameters()
+//! @param[in] checked seq ends with PR ER, see writeSequence(); values not confirmed yet are then sent again
 ////////////////////////////////////////////////////////
-asynStatus LexiumMotorAxis::setAxisMoveParameters(double minVelocity, double maxVelocity, double acceleration)
+asynStatus LexiumMotorAxis::setAxisMoveParameters(double minVelocity, double maxVelocity, double acceleration, LexiumCommand *seq, int *appended, bool checked)
 {
 	asynStatus status = asynError;
-	char cmd[MAX_CMD_LEN];
+	bool maxVelocityFirst;
 	static const char *functionName = "setAxisMoveParameters()";
 
+	*appended = 0;
+	if (checked && unconfirmedMoveParameters) invalidateMoveParameters(unconfirmedMoveParameters);
+
+	// drive rejects VI >= VM, so when VM goes up write it before VI, otherwise VI first
+	maxVelocityFirst = !maxVelocityValid || (long)maxVelocity > lastMaxVelocity;
+	if (maxVelocityFirst) {
+		status = setMaxVelocity(maxVelocity, seq, appended);
+		if (status) goto bail;
+	}
+
 	// check if using base velocity (VI)
 	// for MDrivePlus initial velocity must be below max_velocity
 	if (minVelocity > 0) { // base velocity set
@@ -127,21 +266,19 @@ asynStatus LexiumMotorAxis::setAxisMoveParameters(double minVelocity, double max
 		//}
 
 		// set base velocity
-		sprintf(cmd, "VI=%ld", (long)minVelocity);
-		status = pController->writeController(cmd, Lexium_TIMEOUT);
+		status = setBaseVelocity(minVelocity, seq, appended);
 		if (status) goto bail;
 	}
 
-
 	// set velocity
-	sprintf(cmd, "VM=%ld", (long)maxVelocity);
-	status = pController->writeController(cmd, Lexium_TIMEOUT);
-	if (status) goto bail;
+	if (!maxVelocityFirst) {
+		status = setMaxVelocity(maxVelocity, seq, appended);
+		if (status) goto bail;
+	}
 
 	// set accceleration
 	if (acceleration != 0) {
-		sprintf(cmd, "A=%ld", (long)acceleration);
-		status = pController->writeController(cmd, Lexium_TIMEOUT);
+		status = setAcceleration(acceleration, seq, appended);
 		if (status) goto bail;
 	}
 
@@ -152,10 +289,189 @@ asynStatus LexiumMotorAxis::setAxisMoveParameters(double minVelocity, double max
 		handleAxisError(buff);
 	}
 
+	setIntegerParam(pController->LexiumSkippedWrites_, (int)skippedWrites);
 	callParamCallbacks();
 	return status;
 }
 
+////////////////////////////////////////////////////////
+//! setBaseVelocity()
+//! write base velocity (VI=), skipped if the drive already has this value
+//! Over Modbus the drive acknowledges the write and the value is cached at once; added to seq it is
+//! unknown until confirmMoveParameters(), once the sequence is written
+//
+//! @param[in] minVelocity
+//! @param[in,out] seq sequence to add the command to
+//! @param[in,out] appended MOVE_VI is set if the command was added to seq
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::setBaseVelocity(double minVelocity, LexiumCommand *seq, int *appended)
+{
+	asynStatus status;
+
+	if (baseVelocityValid && (long)minVelocity == lastBaseVelocity) {
+		skippedWrites++;
+		return asynSuccess;
+	}
+	if (!pController->modbus) {
+		seq->next(pController->outputEos).appendString("VI=").appendInteger((long)minVelocity);
+		invalidateMoveParameters(MOVE_VI);
+		*appended |= MOVE_VI;
+		return asynSuccess;
+	}
+	status = writeRegister(LEXIUM_MB_VI, 2, (long)minVelocity);
+	if (status == asynSuccess) {
+		lastBaseVelocity = (long)minVelocity;
+		baseVelocityValid = true;
+	}
+	return status;
+}
+
+////////////////////////////////////////////////////////
+//! setMaxVelocity()
+//! write velocity (VM=), skipped if the drive already has this value, cached as in setBaseVelocity()
+//
+//! @param[in] maxVelocity
+//! @param[in,out] seq sequence to add the command to
+//! @param[in,out] appended MOVE_VM is set if the command was added to seq
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::setMaxVelocity(double maxVelocity, LexiumCommand *seq, int *appended)
+{
+	asynStatus status;
+
+	if (maxVelocityValid && (long)maxVelocity == lastMaxVelocity) {
+		skippedWrites++;
+		return asynSuccess;
+	}
+	if (!pController->modbus) {
+		seq->next(pController->outputEos).appendString("VM=").appendInteger((long)maxVelocity);
+		invalidateMoveParameters(MOVE_VM);
+		*appended |= MOVE_VM;
+		return asynSuccess;
+	}
+	status = writeRegister(LEXIUM_MB_VM, 2, (long)maxVelocity);
+	if (status == asynSuccess) {
+		lastMaxVelocity = (long)maxVelocity;
+		maxVelocityValid = true;
+	}
+	return status;
+}
+
+////////////////////////////////////////////////////////
+//! setAcceleration()
+//! write acceleration (A=), skipped if the drive already has this value, cached as in setBaseVelocity()
+//
+//! @param[in] acceleration
+//! @param[in,out] seq sequence to add the command to
+//! @param[in,out] appended MOVE_A is set if the command was added to seq
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::setAcceleration(double acceleration, LexiumCommand *seq, int *appended)
+{
+	asynStatus status;
+
+	if (accelerationValid && (long)acceleration == lastAcceleration) {
+		skippedWrites++;
+		return asynSuccess;
+	}
+	if (!pController->modbus) {
+		seq->next(pController->outputEos).appendString("A=").appendInteger((long)acceleration);
+		invalidateMoveParameters(MOVE_A);
+		*appended |= MOVE_A;
+		return asynSuccess;
+	}
+	status = writeRegister(LEXIUM_MB_A, 2, (long)acceleration);
+	if (status == asynSuccess) {
+		lastAcceleration = (long)acceleration;
+		accelerationValid = true;
+	}
+	return status;
+}
+
+////////////////////////////////////////////////////////
+//! writeSequence()
+//! send the commands collected in seq with LexiumCommand::next() in a single write, between ER=0 and PR ER,
+//! so a move costs one write and one reply whatever the number of parameters that changed
+//! The drive executes the commands in order and doesn't answer them, a failed one only shows in ER.
+//! VI/VM/A added by the set functions are only cached by confirmMoveParameters() once this succeeds
+//
+//! @param[in] seq  commands
+//! @param[in] what for the error message
+//! @return asynError if the drive reports an error code
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::writeSequence(const LexiumCommand &seq, const char *what)
+{
+	asynStatus status;
+	long errCode;
+	LexiumCommand cmd(deviceName);
+	static const char *functionName = "writeSequence()";
+
+	errorCodeRead = false;
+	if (!seq.ok()) { // the last command was cut off, it must not be sent
+		asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: ERROR command longer than %d characters: %s...\n", pController->motorName, functionName, (int)seq.capacity(), seq.c_str());
+		return asynError;
+	}
+
+	// ER keeps the last error until cleared, clear it so any code read back is the sequence's;
+	// this also clears any error from VI/VM/A written without PR ER, so they are no longer trusted
+	if (unconfirmedMoveParameters) invalidateMoveParameters(unconfirmedMoveParameters);
+	cmd.appendString("ER=0");
+	cmd.next(pController->outputEos).appendString(seq.body());
+	cmd.next(pController->outputEos).appendString("PR ER");
+	status = queryValue(cmd, &errCode);
+	if (status) return status;
+	setIntegerParam(pController->LexiumErrorCode_, (int)errCode);
+	if (errCode) {
+		asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: drive error %ld after %s\n", pController->motorName, functionName, errCode, what);
+		status = asynError;
+		errorCodeRead = true;
+	}
+	lastErrorCode = (int)errCode;
+	return status;
+}
+
+////////////////////////////////////////////////////////
+//! invalidateMoveParameters()
+//! forget the VI/VM/A values cached by setAxisMoveParameters(),
+//! called whenever the drive may no longer hold them (comms or drive error, reconnect)
+//
+//! @param[in] params MOVE_VI, MOVE_VM and/or MOVE_A, all three by default
+////////////////////////////////////////////////////////
+void LexiumMotorAxis::invalidateMoveParameters(int params)
+{
+	if (params & MOVE_VI) baseVelocityValid = false;
+	if (params & MOVE_VM) maxVelocityValid = false;
+	if (params & MOVE_A) accelerationValid = false;
+	unconfirmedMoveParameters &= ~params;
+}
+
+////////////////////////////////////////////////////////
+//! confirmMoveParameters()
+//! cache the VI/VM/A values the set functions added to a sequence, once writeSequence() has written it
+//! A sequence written without PR ER is cached too, but only until the next ER read shows whether the
+//! drive took it, see pollAxis(); further writes until then are not slowed down by a reply
+//
+//! @param[in] appended     MOVE_VI, MOVE_VM and/or MOVE_A, from the set functions
+//! @param[in] minVelocity  value added with MOVE_VI
+//! @param[in] maxVelocity  value added with MOVE_VM
+//! @param[in] acceleration value added with MOVE_A
+//! @param[in] checked      the sequence ended with PR ER and the drive reported no error
+////////////////////////////////////////////////////////
+void LexiumMotorAxis::confirmMoveParameters(int appended, double minVelocity, double maxVelocity, double acceleration, bool checked)
+{
+	if (appended & MOVE_VI) {
+		lastBaseVelocity = (long)minVelocity;
+		baseVelocityValid = true;
+	}
+	if (appended & MOVE_VM) {
+		lastMaxVelocity = (long)maxVelocity;
+		maxVelocityValid = true;
+	}
+	if (appended & MOVE_A) {
+		lastAcceleration = (long)acceleration;
+		accelerationValid = true;
+	}
+	if (!checked) unconfirmedMoveParameters |= appended;
+}
+
 ////////////////////////////////////////////////////////
 //! move()
 //! Override asynMotorAxis class implementation
@@ -170,22 +486,35 @@ asynStatus LexiumMotorAxis::setAxisMoveParameters(double minVelocity, double max
 asynStatus LexiumMotorAxis::move(double position, int relative, double minVelocity, double maxVelocity, double acceleration)
 {
 	asynStatus status = asynError;
-	char cmd[MAX_CMD_LEN];
+	LexiumCommand cmd(deviceName);
+	int appended;
 	static const char *functionName = "move()";
 
-	// sent commands to motor to set velocities and acceleration
-	status = setAxisMoveParameters(minVelocity, maxVelocity, acceleration);
+	streamPending = false;  // the move replaces any jog velocity still queued
+
+	// velocities and acceleration, then the move, in one write
+	status = setAxisMoveParameters(minVelocity, maxVelocity, acceleration, &cmd, &appended);
 	if (status) goto bail;
 
 	// move
 	asynPrint(pController->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: VBASE=%f, VELO=%f, ACCL=%f, position=%f, relative=%d\n", pController->motorName, functionName, minVelocity, maxVelocity, acceleration, position, relative);
-	if (relative) { // relative move MR
-		sprintf(cmd, "MR %ld", (long)position);
-	} else { // absolute move MA
-		sprintf(cmd, "MA %ld", (long)position);
+	if (pController->modbus) { // acknowledged or refused by the drive, no PR ER needed
+		status = writeRegister(relative ? LEXIUM_MB_MR : LEXIUM_MB_MA, 2, (long)position);
+	} else {
+		if (relative) { // relative move MR
+			cmd.next(pController->outputEos).appendString("MR ").appendInteger((long)position);
+		} else { // absolute move MA
+			cmd.next(pController->outputEos).appendString("MA ").appendInteger((long)position);
+		}
+		status = writeSequence(cmd, "move");
 	}
-	status = pController->writeController(cmd, Lexium_TIMEOUT);
 	if (status) goto bail;
+	confirmMoveParameters(appended, minVelocity, maxVelocity, acceleration);
+	epicsTimeGetCurrent(&moveStartTime);
+	moveTimed = true;
+	if (captureNextMove) startMoveCapture();
+	pollRequested = true;
+	predictMoveEnd(relative ? position : position - lastPosition, minVelocity, maxVelocity, acceleration);
 
 	bail:
 	if (status) {
@@ -211,18 +540,30 @@ asynStatus LexiumMotorAxis::move(double position, int relative, double minVeloci
 asynStatus LexiumMotorAxis::moveVelocity(double minVelocity, double maxVelocity, double acceleration)
 {
 	asynStatus status = asynError;
-	char cmd[MAX_CMD_LEN];
+	LexiumCommand cmd(deviceName);
+	int stream = 0;
+	int appended;
 	static const char *functionName = "moveVelocity()";
 
-	// sent commands to motor to set velocities and acceleration
-	status = setAxisMoveParameters(minVelocity, maxVelocity, acceleration);
+	pController->getIntegerParam(axisNo_, pController->LexiumStreamVelocity_, &stream);
+	if (stream) return queueVelocity(minVelocity, maxVelocity, acceleration);
+
+	// velocities and acceleration, then the jog, in one write
+	status = setAxisMoveParameters(minVelocity, maxVelocity, acceleration, &cmd, &appended);
 	if (status) goto bail;
 
 	// move
 	asynPrint(pController->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: VBASE=%f, VELO=%f, ACCL=%f\n", pController->motorName, functionName, minVelocity, maxVelocity, acceleration);
-	sprintf(cmd, "SL %ld", (long)maxVelocity);
-	status = pController->writeController(cmd, Lexium_TIMEOUT);
+	if (pController->modbus) {
+		status = writeRegister(LEXIUM_MB_SL, 2, (long)maxVelocity);
+	} else {
+		cmd.next(pController->outputEos).appendString("SL ").appendInteger((long)maxVelocity);
+		status = writeSequence(cmd, "jog");
+	}
 	if (status) goto bail;
+	confirmMoveParameters(appended, minVelocity, maxVelocity, acceleration);
+	pollRequested = true;
+	endPredicted = false;  // motor record enforces soft limits on the readback while jogging, keep polling fast
 
 	bail:
 	if (status) {
@@ -245,20 +586,35 @@ asynStatus LexiumMotorAxis::moveVelocity(double minVelocity, double maxVelocity,
 asynStatus LexiumMotorAxis::stop(double acceleration)
 {
 	asynStatus status = asynError;
-	char cmd[MAX_CMD_LEN];
+	LexiumCommand cmd(deviceName);
+	epicsTimeStamp start;
+	double latency;
+	int appended = 0;
 	static const char *functionName = "stop()";
 
-	// set accceleration
+	epicsTimeGetCurrent(&start);
+	streamPending = false;  // a jog velocity still queued must not follow the stop
+
+	// set accceleration, in the same write as the stop
 	if (acceleration != 0) {
-		sprintf(cmd, "A=%ld", (long)acceleration);
-		status = pController->writeController(cmd, Lexium_TIMEOUT);
+		status = setAcceleration(acceleration, &cmd, &appended);
 		if (status) goto bail;
 	}
 
-	// move
-	sprintf(cmd, "SL 0");
-	status = pController->writeController(cmd, Lexium_TIMEOUT);
+	// move, no PR ER so the stop doesn't wait for a reply
+	if (pController->modbus) {
+		status = writeRegister(LEXIUM_MB_SL, 2, 0);
+	} else {
+		cmd.next(pController->outputEos).appendString("SL 0");
+		status = pController->writeController(cmd, Lexium_TIMEOUT);
+	}
 	if (status) goto bail;
+	confirmMoveParameters(appended, 0, 0, acceleration, false);
+	latency = lexiumElapsed(&start);
+	stopTime.add(latency);
+	setDoubleParam(pController->LexiumStopLatency_, latency);
+	pollRequested = true;
+	endPredicted = false;
 
 	bail:
 	if (status) {
@@ -287,13 +643,14 @@ asynStatus LexiumMotorAxis::stop(double acceleration)
 asynStatus LexiumMotorAxis::home(double minVelocity, double maxVelocity, double acceleration, int forwards)
 {
 	asynStatus status = asynError;
-	char cmd[MAX_CMD_LEN];
-	char resp[MAX_BUFF_LEN];
-	size_t nread;
+	LexiumCommand cmd(deviceName);
 	int direction = 1;  // direction to home, initialize homing in minus direction
 	double baseVelocity=0;
+	int appended;
 	static const char *functionName = "home()";
 
+	streamPending = false;  // homing replaces any jog velocity still queued
+
 	// check if using base velocity (VI)
 	// for MDrivePlus initial velocity must be below max_velocity
 	if (minVelocity > 0) { // base velocity being configured
@@ -302,26 +659,42 @@ asynStatus LexiumMotorAxis::home(double minVelocity, double maxVelocity, double
 			goto bail;
 		}
 	} else { // base velocity needs to be set because creeping back to home switch at base velocity, so make sure it's nonzero
-		sprintf(cmd, "PR VI");  // get base velocity setting
-		status = pController->writeReadController(cmd, resp, sizeof(resp), &nread, Lexium_TIMEOUT);
+		if (pController->modbus) {
+			long value;
+			status = readRegister(LEXIUM_MB_VI, 2, &value);
+			baseVelocity = value;
+		} else {
+			cmd.appendString("PR VI");  // get base velocity setting
+			status = queryValue(cmd, &baseVelocity);
+		}
 		if (status) goto bail;
-		baseVelocity = atof(resp);
 		if (baseVelocity == 0) { // set to factory default of 1000
 			baseVelocity=1000;
 		}
 	}
 
-	// sent commands to motor to set velocities and acceleration
-	if (status = setAxisMoveParameters(minVelocity, maxVelocity, acceleration)) goto bail;
+	// velocities and acceleration, then the home command, in one write
+	cmd.restart();
+	if (status = setAxisMoveParameters(minVelocity, maxVelocity, acceleration, &cmd, &appended)) goto bail;
 
 	// home
 	if (forwards == 1) { // homing in forward direction
 		direction = 3;
 	}
 	asynPrint(pController->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: VBASE=%f, VELO=%f, ACCL=%f, forwards=%d\n", pController->motorName, functionName, minVelocity, maxVelocity, acceleration, forwards);
-	sprintf(cmd, "HM %d", direction);
-	status  = pController->writeController(cmd, Lexium_TIMEOUT);
+	if (pController->modbus) {
+		status = writeRegister(LEXIUM_MB_HM, 1, direction);
+	} else {
+		cmd.next(pController->outputEos).appendString("HM ").appendInteger(direction);
+		status = writeSequence(cmd, "home");
+	}
 	if (status) goto bail;
+	confirmMoveParameters(appended, minVelocity, maxVelocity, acceleration);
+	epicsTimeGetCurrent(&moveStartTime);
+	moveTimed = true;
+	if (captureNextMove) startMoveCapture();
+	pollRequested = true;
+	endPredicted = false;  // length of the switch search and creep is unknown
 
 	bail:
 	if (status) {
@@ -344,19 +717,25 @@ asynStatus LexiumMotorAxis::home(double minVelocity, double maxVelocity, double
 asynStatus LexiumMotorAxis::setPosition(double position)
 {
 	asynStatus status = asynError;
-	char cmd[MAX_CMD_LEN];
+	LexiumCommand cmd(deviceName);
 	static const char *functionName = "setPosition()";
 
 	// set position
 	asynPrint(pController->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: position=%f\n", pController->motorName, functionName, position);
-	  sprintf(cmd, "P=%ld", (long)position);
-	status = pController->writeController(cmd, Lexium_TIMEOUT);
+	if (pController->modbus) { // P, C1 and C2 are next to each other, one write
+		epicsUInt16 regs[6];
+		lexiumModbusPut32(&regs[0], (long)position);
+		lexiumModbusPut32(&regs[2], (long)position);
+		lexiumModbusPut32(&regs[4], (long)position*4000/51200);
+		status = pController->writeRegisters(this, LEXIUM_MB_PSET, regs, 6, Lexium_TIMEOUT);
+	} else {
+	  cmd.appendString("P=").appendInteger((long)position);
      // ZY add cmd to set C1 and C2 to the position for internal encoders 
      // (DAExxx model).
-        sprintf(cmd, "C1=%ld", (long)position);
-        status = pController->writeController(cmd, Lexium_TIMEOUT);
-        sprintf(cmd, "C2=%ld", (long)position*4000/51200);
-        status = pController->writeController(cmd, Lexium_TIMEOUT);
+        cmd.next(pController->outputEos).appendString("C1=").appendInteger((long)position);
+        cmd.next(pController->outputEos).appendString("C2=").appendInteger((long)position*4000/51200);
+		status = writeSequence(cmd, "setting position");
+	}
 	if (status) goto bail;
 
 	bail:
@@ -374,92 +753,166 @@ asynStatus LexiumMotorAxis::setPosition(double position)
 ////////////////////////////////////////////////////////
 //! poll()
 //! Override asynMotorAxis class implementation
-// Based on smarActMCSMotorDriver.cpp
 //
-//! Set position and moving flag
+//! The drive is read by pollAxis(), which LexiumMotorController::poll() schedules for all axes
+//! of the controller before the poller calls this; only report the result of the last read here
 //
 //! @param[in] moving pointer to moving flag
 ////////////////////////////////////////////////////////
 asynStatus LexiumMotorAxis::poll(bool *moving)
 {
-	asynStatus status = asynError;
-	char cmd[MAX_CMD_LEN];
-	char resp[MAX_BUFF_LEN];
-	size_t nread;
-	int val=0;
-	double position;
-	*moving = false;
-	static const char *functionName = "poll()";
-	//epicsTime currentTime;
+	*moving = lastMoving;
+	return lastPollStatus;
+}
 
-	// get position
-	sprintf(cmd, "PR P");
-	status = pController->writeReadController(cmd, resp, sizeof(resp), &nread, Lexium_TIMEOUT);
-	if (status) goto bail;
-	position = atof(resp);
-	// update motor record position values, just update encoder's even if not using one
-	setDoubleParam(pController->motorEncoderPosition_, position);
-	setDoubleParam(pController->motorPosition_, position);
+////////////////////////////////////////////////////////
+//! pollAxis()
+// Based on smarActMCSMotorDriver.cpp
+//
+//! Set position and moving flag
+//! Uses a single combined PR query per cycle when Lexium_COMBINEDPOLL is set,
+//! falls back to one query per field if the drive does not answer the combined form
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::pollAxis()
+{
+	asynStatus status = asynError;
+	LexiumPollData data;
+	int combined = 0;
+	LexiumReplyError replyError = lexiumReplyOk;
+	epicsTimeStamp pollStart;
+	double cpuStart = lexiumThreadCpuTime();
+	bool moving = false;
+	bool moveDone = false;
+	int fields = 0;
+	double healthPeriod = DEFAULT_HEALTH_PERIOD;
+	static const char *functionName = "pollAxis()";
+
+	epicsTimeGetCurrent(&pollStart);
+
+	// P and MV every cycle; switches every cycle while moving or after a motion command, so the
+	// poll that sees the end of a move also reads them; LR, ER, ST, and idle switches every Lexium_HEALTHPERIOD
+	pController->getDoubleParam(axisNo_, pController->LexiumHealthPeriod_, &healthPeriod);
+	if (lastMoving || pollRequested) fields |= POLL_SWITCHES;
+	if (healthDue || epicsTimeDiffInSeconds(&pollStart, &lastHealthPoll) >= healthPeriod) fields |= POLL_SWITCHES | POLL_HEALTH;
+	pollRequested = false;
+
+	data.position = 0;
+	data.moving = 0;
+	data.home = data.highLimit = data.lowLimit = -1;
+	data.lockedRotor = data.errorCode = data.stalled = -1;
+
+	// drive not probed yet, see LexiumBackgroundStartup()
+	if (!probed) {
+		setIntegerParam(pController->motorStatusProblem_, 1);
+		setIntegerParam(pController->motorStatusCommsError_, 1);
+		callParamCallbacks();
+		lastMoving = false;
+		lastPollStatus = asynError;
+		return asynError;
+	}
 
-	// get moving flag
-	sprintf(cmd, "PR MV");
-	status = pController->writeReadController(cmd, resp, sizeof(resp), &nread, Lexium_TIMEOUT);
-	if (status) goto bail;
-	val = atoi(resp);
-	if (val == 1) *moving = true;  	// updating moving flag
-/*	else { // not moving
-		if (prevMovingState == 1) {// state changed, moving before, start idle timer
-			idleTimeStart = epicsTime::getCurrent();
+	// link down, see LexiumLink.h: no I/O until the next probe is due
+	if (!link.up && (!link.probeDue(&pollStart) || reconnect(&pollStart))) {
+		if (pController->isPollPreempted()) {
+			pollRequested = true;
+			return asynError;
 		}
+		setIntegerParam(pController->motorStatusProblem_, 1);
+		setIntegerParam(pController->motorStatusCommsError_, 1);
+		callParamCallbacks();
+		moveTimed = false;
+		lastMoving = false;
+		lastPollStatus = asynDisconnected;
+		return asynDisconnected;
 	}
-	prevMovingState = val;
-*/
-	// update motor record status done with moving status
-	setIntegerParam(pController->motorStatusDone_, ! *moving );
-
-/*
-	// if position has changed and moving stopped for over 30sec, update NVM with current position so the motor will remember
-	// its location just in case its power dies
-	currentTime = epicsTime::getCurrent();
-	idleTime = currentTime - idleTimeStart;
-	//printf("prevPos=%f, pos=%f, moving=%d, idleTime=%f\n", prevPosition, position, *moving, idleTime);
-	if (prevPosition != position && *moving == false && idleTime > 30) {
-		sprintf(cmd, "S");
-		if (status = pController->writeController(cmd, Lexium_TIMEOUT)) {
-			asynPrint(pController->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:poll(): ERROR saving position to NVM\n", pController->motorName);
-			goto bail;
+
+	pController->getIntegerParam(axisNo_, pController->LexiumCombinedPoll_, &combined);
+	if (pController->modbus) {
+		fields |= POLL_SWITCHES | POLL_HEALTH;  // all in the one register read
+		status = pollModbus(&data);
+	} else if (combined && !combinedPollRejected) {
+		status = pollCombined(&data, fields, &replyError);
+		if (status == asynSuccess) combinedPollAccepted = true;
+		// only a ? prompt or a reply that doesn't parse is a rejection: a timeout is a drive not answering,
+		// and a drive that has answered the combined form before isn't rejecting it
+		if ((replyError == lexiumReplyPrompt || replyError == lexiumReplyInvalid) && !combinedPollAccepted && !pController->isPollPreempted()) {
+			// if the per-field path works the drive is alive and only rejected the combined form
+			status = pollPerField(&data, fields);
+			if (status == asynSuccess) {
+				combinedPollRejected = true;
+				asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: combined PR query rejected, using one query per field\n", pController->motorName, functionName);
+			}
 		}
-		asynPrint(pController->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:poll(): saving parameters to NVM\n", pController->motorName);
-		idleTimeStart = epicsTime::getCurrent();
-		prevPosition = position;
+	} else {
+		status = pollPerField(&data, fields);
+	}
+	if (status && pController->isPollPreempted()) {
+		// a stop or other command went out while waiting for the reply, this data may predate it
+		pollRequested = true;
+		return status;
 	}
-*/
+	if (status) goto bail;
 
-	// get home switch value
-	if (pController->homeSwitchInput != -1) {
-		sprintf(cmd, "PR I%d", pController->homeSwitchInput);
-		status = pController->writeReadController(cmd, resp, sizeof(resp), &nread, Lexium_TIMEOUT);
-		if (status) goto bail;
-		val = atoi(resp);
-		setIntegerParam(pController->motorStatusHome_, val);
+	// update motor record position values, just update encoder's even if not using one
+	setDoubleParam(pController->motorEncoderPosition_, data.position);
+	setDoubleParam(pController->motorPosition_, data.position);
+
+	if (data.moving == 1) moving = true;  	// updating moving flag
+	if (!moving) endPredicted = false;
+	if (moveTimed && !moving) { // move() or home() has finished
+		moveTime.add(lexiumElapsed(&moveStartTime));
+		moveTimed = false;
+		moveDone = true;
 	}
 
-	// get positive limit switch value
-	if (pController->posLimitSwitchInput != -1) {
-		sprintf(cmd, "PR I%d", pController->posLimitSwitchInput);
-		status = pController->writeReadController(cmd, resp, sizeof(resp), &nread, Lexium_TIMEOUT);
-		if (status) goto bail;
-		val = atoi(resp);
-		setIntegerParam(pController->motorStatusHighLimit_, val);
+	// idle time for the background NVM save, from the poll data only
+	if (moving || data.position != lastPosition) idleStart = pollStart;
+	if (!nvmPositionValid) { // the drive is assumed to have saved the position it starts with
+		nvmPosition = data.position;
+		nvmPositionValid = true;
 	}
+	lastPosition = data.position;
 
-	// get negative limit switch value
-	if (pController->negLimitSwitchInput != -1) {
-		sprintf(cmd, "PR I%d", pController->negLimitSwitchInput);
-		status = pController->writeReadController(cmd, resp, sizeof(resp), &nread, Lexium_TIMEOUT);
-		if (status) goto bail;
-		val = atoi(resp);
-		setIntegerParam(pController->motorStatusLowLimit_, val);
+	// update motor record status done with moving status
+	setIntegerParam(pController->motorStatusDone_, !moving );
+
+	// switch values, only for inputs configured by IS
+	if (data.home != -1) setIntegerParam(pController->motorStatusHome_, data.home);
+	if (data.highLimit != -1) setIntegerParam(pController->motorStatusHighLimit_, data.highLimit);
+	if (data.lowLimit != -1) setIntegerParam(pController->motorStatusLowLimit_, data.lowLimit);
+
+	// capture, with the switch values last read
+	if (capture.armed) captureSample(data.position, moving);
+	if (captureThisMove && moveDone) stopCapture();
+
+	// health fields, slow tier
+	if (fields & POLL_HEALTH) {
+		setIntegerParam(pController->LexiumLockedRotor_, data.lockedRotor);
+		setIntegerParam(pController->LexiumErrorCode_, data.errorCode);
+		lastErrorCode = data.errorCode;
+		setIntegerParam(pController->LexiumStalled_, data.stalled);
+		setIntegerParam(pController->motorStatusSlip_, data.stalled ? 1 : 0);
+		lastHealthPoll = pollStart;
+		healthDue = false;
+
+		// VI/VM/A written without PR ER since the last ER read: kept unless the drive reports an error
+		if (unconfirmedMoveParameters) {
+			if (data.errorCode) invalidateMoveParameters(unconfirmedMoveParameters);
+			unconfirmedMoveParameters = 0;
+		}
+
+		// first ER after a background ER=0 and S: 73 means the drive refused to save while moving, try again after the next idle period
+		if (nvmSavePending) {
+			nvmSavePending = false;
+			if (data.errorCode == NVM_SAVE_MOVING_ERROR) {
+				asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: drive was moving, position not saved to NVM\n", pController->motorName, functionName);
+				idleStart = pollStart;
+			} else {
+				nvmPosition = nvmPendingPosition;
+				nvmSaves++;
+				setIntegerParam(pController->LexiumNVMSaves_, (int)nvmSaves);
+			}
+		}
 	}
 
 	// error polling
@@ -481,12 +934,535 @@ asynStatus LexiumMotorAxis::poll(bool *moving)
 
 	int mstat;
 	pController->getIntegerParam(pController->motorStatus_, &mstat);
-	asynPrint(pController->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: POS=%f, MSTAT=%d\n", pController->motorName, functionName, position, mstat);
+	asynPrint(pController->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: POS=%f, MSTAT=%d\n", pController->motorName, functionName, data.position, mstat);
+
+	pollTime.add(lexiumElapsed(&pollStart));
+	pollCpuTime += lexiumThreadCpuTime() - cpuStart;
 
+	lastMoving = moving;
+	lastPollStatus = status;
 	return status;
 
 }
 
+////////////////////////////////////////////////////////
+//! reconnect()
+//! Probe a drive whose link is down with PR VR, called by pollAxis() when the probe is due
+//! If it answers, the link is up again and the drive is configured as at startup, since it may
+//! have been power cycled; otherwise the next probe waits twice as long, up to LINK_PROBE_MAX
+//
+//! @param[in] now current time
+//! @return asynSuccess if the drive answered and was configured
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::reconnect(const epicsTimeStamp *now)
+{
+	asynStatus status;
+	LexiumCommand cmd(deviceName);
+	char resp[MAX_BUFF_LEN];
+	size_t nread;
+	static const char *functionName = "reconnect()";
+
+	link.probing = true;
+	if (pController->modbus) {
+		epicsUInt16 version;
+		status = pController->readRegisters(this, LEXIUM_MB_VR, 1, &version, LINK_PROBE_TIMEOUT);
+	} else {
+		cmd.appendString("PR VR");
+		status = pController->writeReadController(cmd, resp, sizeof(resp), &nread, LINK_PROBE_TIMEOUT);
+		if (status == asynSuccess && lexiumCheckReply(resp, nread, cmd.body()) != lexiumReplyOk) status = asynError;
+	}
+	link.probing = false;
+	if (status) {
+		if (!pController->isPollPreempted()) link.probeFailed(now);
+		return status;
+	}
+
+	link.reconnected();
+	setIntegerParam(pController->LexiumLinkUp_, 1);
+	setIntegerParam(pController->LexiumReconnects_, (int)link.reconnects);
+	asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: axis %d answering again, reconfiguring\n", pController->motorName, functionName, axisNo_);
+	status = configAxis();
+	if (status == asynSuccess) status = (asynStatus)readHomeAndLimitConfig();
+	return status;
+}
+
+////////////////////////////////////////////////////////
+//! predictMoveEnd()
+//! estimate when a move started now will be done from its trapezoidal profile:
+//! start at VI, accelerate at A up to VM, decelerate to stop on target
+//! (or a triangle if the move is too short to reach VM)
+//
+//! @param[in] distance     signed move distance in counts
+//! @param[in] minVelocity  VI
+//! @param[in] maxVelocity  VM
+//! @param[in] acceleration A, 0 if not set by this move
+////////////////////////////////////////////////////////
+void LexiumMotorAxis::predictMoveEnd(double distance, double minVelocity, double maxVelocity, double acceleration)
+{
+	double rampTime, rampDistance, peakVelocity, moveDuration;
+
+	if (acceleration == 0 && accelerationValid) acceleration = lastAcceleration;
+	if (minVelocity <= 0 && baseVelocityValid) minVelocity = lastBaseVelocity;
+	if (minVelocity < 0 || maxVelocity <= minVelocity || acceleration <= 0) {
+		endPredicted = false;  // poll at the moving poll period
+		return;
+	}
+	if (distance < 0) distance = -distance;
+
+	rampTime = (maxVelocity - minVelocity) / acceleration;
+	rampDistance = (maxVelocity * maxVelocity - minVelocity * minVelocity) / (2 * acceleration);
+	if (2 * rampDistance >= distance) {
+		peakVelocity = sqrt(minVelocity * minVelocity + acceleration * distance);
+		moveDuration = 2 * (peakVelocity - minVelocity) / acceleration;
+	} else {
+		moveDuration = 2 * rampTime + (distance - 2 * rampDistance) / maxVelocity;
+	}
+
+	epicsTimeGetCurrent(&predictedEnd);
+	epicsTimeAddSeconds(&predictedEnd, moveDuration);
+	endPredicted = true;
+}
+
+////////////////////////////////////////////////////////
+//! adaptivePollPeriod()
+//! poll period wanted by this axis while it moves, used when Lexium_ADAPTIVEPOLL is set:
+//! half the time left until the predicted end of the move, so polls get closer together
+//! towards the end, between the configured moving poll period and the maximum period
+//
+//! @param[in] fastPeriod configured moving poll period
+//! @param[in] maxPeriod  Lexium_MAXPOLLPERIOD
+//! @return poll period in seconds
+////////////////////////////////////////////////////////
+double LexiumMotorAxis::adaptivePollPeriod(double fastPeriod, double maxPeriod)
+{
+	double period;
+
+	// jog, home, or no usable profile
+	if (!endPredicted) return fastPeriod;
+
+	period = -lexiumElapsed(&predictedEnd) / 2;
+	if (period > maxPeriod) period = maxPeriod;
+	if (period < fastPeriod) period = fastPeriod;
+	return period;
+}
+
+////////////////////////////////////////////////////////
+//! pollFields()
+//! names of the optional fields to read in this poll and where to store them
+//
+//! @param[in]  data   poll data the values go to
+//! @param[in]  fields POLL_SWITCHES and/or POLL_HEALTH
+//! @param[out] names  PR item names, e.g. "I1", "LR"
+//! @param[out] values one pointer into data per name
+//! @return number of fields
+////////////////////////////////////////////////////////
+static int pollFields(LexiumPollData *data, int fields, const int inputs[3], char names[][4], int *values[])
+{
+	int *switchValues[3] = {&data->home, &data->highLimit, &data->lowLimit};
+	int n = 0;
+
+	if (fields & POLL_SWITCHES) {
+		for (int i=0; i<3; i++) {
+			if (inputs[i] == -1) continue;
+			sprintf(names[n], "I%d", inputs[i]);
+			values[n++] = switchValues[i];
+		}
+	}
+	if (fields & POLL_HEALTH) {
+		strcpy(names[n], "LR");
+		values[n++] = &data->lockedRotor;
+		strcpy(names[n], "ER");
+		values[n++] = &data->errorCode;
+		strcpy(names[n], "ST");
+		values[n++] = &data->stalled;
+	}
+	return n;
+}
+
+////////////////////////////////////////////////////////
+//! pollCombined()
+//! Read position, moving flag and the requested optional fields with one query
+//! PR P,",",MV,",",I<n>... prints all fields on one line separated by commas
+//
+//! @param[out] data       values read back from the drive
+//! @param[in]  fields     POLL_SWITCHES and/or POLL_HEALTH
+//! @param[out] replyError what was wrong with the reply, lexiumReplyOk if there was none or it was fine
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::pollCombined(LexiumPollData *data, int fields, LexiumReplyError *replyError)
+{
+	asynStatus status = asynError;
+	LexiumCommand cmd(deviceName);
+	char resp[MAX_BUFF_LEN];
+	size_t nread;
+	LexiumReplyError error;
+	long fieldValues[MAX_POLL_FIELDS + 2];
+	const int inputs[3] = {homeSwitchInput, posLimitSwitchInput, negLimitSwitchInput};
+	char names[MAX_POLL_FIELDS][4];
+	int *values[MAX_POLL_FIELDS];
+	int numFields;
+	static const char *functionName = "pollCombined()";
+
+	*replyError = lexiumReplyOk;
+	numFields = pollFields(data, fields, inputs, names, values);
+	cmd.appendString("PR P,\",\",MV");
+	for (int i=0; i<numFields; i++) {
+		cmd.appendString(",\",\",").appendString(names[i]);
+	}
+	status = pController->writeReadController(cmd, resp, sizeof(resp), &nread, Lexium_TIMEOUT);
+	if (status) return status;
+
+	// position, moving flag, then the optional fields in the order they were requested
+	error = lexiumParseFields(resp, nread, cmd.body(), fieldValues, numFields + 2);
+	if (error) {
+		asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s, reply '%s' to '%s'\n", pController->motorName, functionName, lexiumReplyErrorString(error), resp, cmd.c_str());
+		*replyError = error;
+		return asynError;
+	}
+	data->position = fieldValues[0];
+	data->moving = (int)fieldValues[1];
+	for (int i=0; i<numFields; i++) {
+		*values[i] = (int)fieldValues[i + 2];
+	}
+	return asynSuccess;
+}
+
+////////////////////////////////////////////////////////
+//! pollPerField()
+//! Read position, moving flag and the requested optional fields with one query each
+//
+//! @param[out] data   values read back from the drive
+//! @param[in]  fields POLL_SWITCHES and/or POLL_HEALTH
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::pollPerField(LexiumPollData *data, int fields)
+{
+	asynStatus status = asynError;
+	LexiumCommand cmd(deviceName);
+	long value;
+	const int inputs[3] = {homeSwitchInput, posLimitSwitchInput, negLimitSwitchInput};
+	char names[MAX_POLL_FIELDS][4];
+	int *values[MAX_POLL_FIELDS];
+	int numFields;
+
+	// get position
+	cmd.appendString("PR P");
+	status = queryValue(cmd, &data->position);
+	if (status) return status;
+
+	// get moving flag
+	cmd.restart().appendString("PR MV");
+	status = queryValue(cmd, &value);
+	if (status) return status;
+	data->moving = (int)value;
+
+	// switch inputs and health fields
+	numFields = pollFields(data, fields, inputs, names, values);
+	for (int i=0; i<numFields; i++) {
+		cmd.restart().appendString("PR ").appendString(names[i]);
+		status = queryValue(cmd, &value);
+		if (status) return status;
+		*values[i] = (int)value;
+	}
+
+	return status;
+}
+
+////////////////////////////////////////////////////////
+//! pollModbus()
+//! Read position, moving flag, switch inputs and LR, ER, ST with one Modbus request,
+//! the whole status block of LexiumModbus.h, no text to parse
+//
+//! @param[out] data values read back from the drive
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::pollModbus(LexiumPollData *data)
+{
+	asynStatus status;
+	epicsUInt16 regs[LEXIUM_MB_STATUS_LEN];
+	const int inputs[3] = {homeSwitchInput, posLimitSwitchInput, negLimitSwitchInput};
+	int *switchValues[3] = {&data->home, &data->highLimit, &data->lowLimit};
+
+	status = pController->readRegisters(this, LEXIUM_MB_P, LEXIUM_MB_STATUS_LEN, regs, Lexium_TIMEOUT);
+	if (status) return status;
+
+	data->position = lexiumModbusGet32(&regs[LEXIUM_MB_P - LEXIUM_MB_P]);
+	data->moving = regs[LEXIUM_MB_MV - LEXIUM_MB_P];
+	for (int i=0; i<3; i++) {
+		if (inputs[i] >= 1 && inputs[i] <= 16) *switchValues[i] = (regs[LEXIUM_MB_IN - LEXIUM_MB_P] >> (inputs[i] - 1)) & 1;
+	}
+	data->errorCode = regs[LEXIUM_MB_ER - LEXIUM_MB_P];
+	data->lockedRotor = regs[LEXIUM_MB_LR - LEXIUM_MB_P];
+	data->stalled = regs[LEXIUM_MB_ST - LEXIUM_MB_P];
+	return asynSuccess;
+}
+
+////////////////////////////////////////////////////////
+//! readRegister()
+//! read one value of the Modbus register map, see LexiumModbus.h
+//
+//! @param[in]  addr  register
+//! @param[in]  width 1 for a 16 bit value, 2 for a 32 bit value
+//! @param[out] value the value, only changed when asynSuccess is returned
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::readRegister(int addr, int width, long *value)
+{
+	asynStatus status;
+	epicsUInt16 regs[2];
+
+	status = pController->readRegisters(this, addr, width, regs, Lexium_TIMEOUT);
+	if (status == asynSuccess) *value = (width == 2) ? lexiumModbusGet32(regs) : regs[0];
+	return status;
+}
+
+////////////////////////////////////////////////////////
+//! writeRegister()
+//! write one value of the Modbus register map, see LexiumModbus.h
+//
+//! @param[in] addr  register
+//! @param[in] width 1 for a 16 bit value, 2 for a 32 bit value
+//! @param[in] value the value
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::writeRegister(int addr, int width, long value)
+{
+	epicsUInt16 regs[2];
+
+	if (width == 2) lexiumModbusPut32(regs, value);
+	else regs[0] = (epicsUInt16)value;
+	return pController->writeRegisters(this, addr, regs, width, Lexium_TIMEOUT);
+}
+
+////////////////////////////////////////////////////////
+//! queryValue()
+//! send a query and parse its reply as a single number, see LexiumReply.h
+//
+//! @param[in]  cmd   query, e.g. PR MV
+//! @param[out] value the number, only changed when asynSuccess is returned
+//! @return asynError if the drive did not answer or the reply is not just a number
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::queryValue(const LexiumCommand &cmd, long *value)
+{
+	asynStatus status;
+	char resp[MAX_BUFF_LEN];
+	size_t nread;
+	LexiumReplyError error;
+	static const char *functionName = "queryValue()";
+
+	status = pController->writeReadController(cmd, resp, sizeof(resp), &nread, Lexium_TIMEOUT);
+	if (status) return status;
+	error = lexiumParseReply(resp, nread, cmd.body(), value);
+	if (error) {
+		asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s, reply '%s' to '%s'\n", pController->motorName, functionName, lexiumReplyErrorString(error), resp, cmd.c_str());
+		return asynError;
+	}
+	return asynSuccess;
+}
+
+asynStatus LexiumMotorAxis::queryValue(const LexiumCommand &cmd, double *value)
+{
+	asynStatus status;
+	char resp[MAX_BUFF_LEN];
+	size_t nread;
+	LexiumReplyError error;
+	static const char *functionName = "queryValue()";
+
+	status = pController->writeReadController(cmd, resp, sizeof(resp), &nread, Lexium_TIMEOUT);
+	if (status) return status;
+	error = lexiumParseReply(resp, nread, cmd.body(), value);
+	if (error) {
+		asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s, reply '%s' to '%s'\n", pController->motorName, functionName, lexiumReplyErrorString(error), resp, cmd.c_str());
+		return asynError;
+	}
+	return asynSuccess;
+}
+
+////////////////////////////////////////////////////////
+//! queueVelocity()
+//! moveVelocity() with Lexium_STREAMVELOCITY set: keep only the newest jog velocity and return,
+//! LexiumMotorController::velocityStreamer() sends it as soon as it gets the controller lock
+//
+//! @param[in] minVelocity
+//! @param[in] maxVelocity
+//! @param[in] acceleration
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::queueVelocity(double minVelocity, double maxVelocity, double acceleration)
+{
+	if (streamPending) {
+		streamCoalesced++;
+		setIntegerParam(pController->LexiumStreamCoalesced_, (int)streamCoalesced);
+	}
+	streamMinVelocity = minVelocity;
+	streamMaxVelocity = maxVelocity;
+	streamAcceleration = acceleration;
+	epicsTimeGetCurrent(&streamRequestTime);
+	streamPending = true;
+	pollRequested = true;
+	endPredicted = false;  // motor record enforces soft limits on the readback while jogging, keep polling fast
+	pController->wakeStreamer();
+	return asynSuccess;
+}
+
+////////////////////////////////////////////////////////
+//! sendQueuedVelocity()
+//! write the jog velocity queued by queueVelocity(), VI/VM/A only where they changed, then SL, in one write
+//! Called by LexiumMotorController::velocityStreamer() with the controller locked
+////////////////////////////////////////////////////////
+void LexiumMotorAxis::sendQueuedVelocity()
+{
+	asynStatus status;
+	LexiumCommand cmd(deviceName);
+	double latency;
+	int appended;
+	static const char *functionName = "sendQueuedVelocity()";
+
+	streamPending = false;
+	status = setAxisMoveParameters(streamMinVelocity, streamMaxVelocity, streamAcceleration, &cmd, &appended, false);
+	if (status) goto bail;
+
+	// one write and no PR ER, the streamer doesn't wait for replies
+	if (pController->modbus) {
+		status = writeRegister(LEXIUM_MB_SL, 2, (long)streamMaxVelocity);
+	} else {
+		cmd.next(pController->outputEos).appendString("SL ").appendInteger((long)streamMaxVelocity);
+		status = pController->writeController(cmd, Lexium_TIMEOUT);
+	}
+	if (status) goto bail;
+	confirmMoveParameters(appended, streamMinVelocity, streamMaxVelocity, streamAcceleration, false);
+	latency = lexiumElapsed(&streamRequestTime);
+	streamTime.add(latency);
+	setDoubleParam(pController->LexiumStreamLatency_, latency);
+
+	bail:
+	if (status) {
+		char buff[LOCAL_LINE_LEN];
+		sprintf(buff, "%s:%s: ERROR jogging motor", pController->motorName, functionName);
+		handleAxisError(buff);
+	}
+
+	callParamCallbacks();
+}
+
+////////////////////////////////////////////////////////
+//! report()
+//! Override asynMotorAxis function, called by LexiumMotorController::report()
+//! level 1: link state, switch inputs, last error code and poll counters, level 2: poll, move and stop time distributions
+//
+//! @param[in] fp    output
+//! @param[in] level detail
+////////////////////////////////////////////////////////
+void LexiumMotorAxis::report(FILE *fp, int level)
+{
+	epicsTimeStamp now;
+	char replyAge[32] = "never";
+
+	if (level > 0) {
+		epicsTimeGetCurrent(&now);
+		if (link.replied) sprintf(replyAge, "%.3f s ago", epicsTimeDiffInSeconds(&now, &link.lastReply));
+		fprintf(fp, "  axis %d%s%s: link %s, last reply %s, reconnects %lu, ER %d, %s poll\n", axisNo_,
+		        deviceName[0] ? ", device " : "", deviceName, link.up ? "up" : "down", replyAge, link.reconnects,
+		        lastErrorCode, pController->modbus ? "Modbus register" : (combinedPollRejected ? "per field" : "combined"));
+		fprintf(fp, "    switch inputs: home %d, + limit %d, - limit %d (-1: none)\n",
+		        homeSwitchInput, posLimitSwitchInput, negLimitSwitchInput);
+		fprintf(fp, "    polls %lu, mean %.6f s, max %.6f s, cpu %.6f s per poll, skipped writes %lu\n", pollTime.count,
+		        pollTime.mean(), pollTime.max, pollTime.count ? pollCpuTime / pollTime.count : 0, skippedWrites);
+	}
+	if (level > 1) {
+		pollTime.report(fp, "    poll");
+		moveTime.report(fp, "    move to done");
+		stopTime.report(fp, "    stop to SL 0");
+		streamTime.report(fp, "    streamed jog to SL");
+	}
+	asynMotorAxis::report(fp, level);
+}
+
+////////////////////////////////////////////////////////
+//! resetStats()
+//! clear poll and move statistics
+////////////////////////////////////////////////////////
+void LexiumMotorAxis::resetStats()
+{
+	pollTime.reset();
+	moveTime.reset();
+	stopTime.reset();
+	streamTime.reset();
+	pollCpuTime = 0;
+	moveTimed = false;
+}
+
+////////////////////////////////////////////////////////
+//! armCapture()
+//! start capturing a sample of every poll, see LexiumCapture.h
+//
+//! @param[in] mode 0: keep the last CAPTURE_LEN samples, 1: stop when full, 2: capture the next move() or home()
+////////////////////////////////////////////////////////
+void LexiumMotorAxis::armCapture(int mode)
+{
+	captureThisMove = false;
+	captureNextMove = (mode == 2);
+	if (captureNextMove) capture.stop();  // nothing until the move starts
+	else capture.arm(mode == 1);
+	setIntegerParam(pController->LexiumCaptureArm_, 1);
+	setIntegerParam(pController->LexiumCaptureCount_, 0);
+}
+
+////////////////////////////////////////////////////////
+//! stopCapture()
+//! stop capturing and publish the samples
+////////////////////////////////////////////////////////
+void LexiumMotorAxis::stopCapture()
+{
+	captureNextMove = false;
+	captureThisMove = false;
+	capture.stop();
+	publishCapture();
+}
+
+////////////////////////////////////////////////////////
+//! startMoveCapture()
+//! move() or home() was sent with Lexium_CAPTUREMODE 2 armed, capture until it is done
+////////////////////////////////////////////////////////
+void LexiumMotorAxis::startMoveCapture()
+{
+	captureNextMove = false;
+	captureThisMove = true;
+	capture.arm(false);
+}
+
+////////////////////////////////////////////////////////
+//! captureSample()
+//! add the result of a poll to the capture buffer
+//
+//! @param[in] position position read from the drive
+//! @param[in] moving   moving flag
+////////////////////////////////////////////////////////
+void LexiumMotorAxis::captureSample(double position, bool moving)
+{
+	int home = 0, highLimit = 0, lowLimit = 0;
+
+	pController->getIntegerParam(axisNo_, pController->motorStatusHome_, &home);
+	pController->getIntegerParam(axisNo_, pController->motorStatusHighLimit_, &highLimit);
+	pController->getIntegerParam(axisNo_, pController->motorStatusLowLimit_, &lowLimit);
+	if (capture.add(position, moving ? 1 : 0, (home ? CAPTURE_HOME : 0) | (highLimit ? CAPTURE_HIGH_LIMIT : 0) | (lowLimit ? CAPTURE_LOW_LIMIT : 0))) {
+		publishCapture();  // one shot capture full
+	} else {
+		setIntegerParam(pController->LexiumCaptureCount_, (int)capture.count);
+	}
+}
+
+////////////////////////////////////////////////////////
+//! publishCapture()
+//! pass the samples of a stopped capture to the waveform records, oldest first
+////////////////////////////////////////////////////////
+void LexiumMotorAxis::publishCapture()
+{
+	size_t n = capture.count;
+
+	setIntegerParam(pController->LexiumCaptureArm_, 0);
+	setIntegerParam(pController->LexiumCaptureCount_, (int)n);
+	setDoubleParam(pController->LexiumCaptureStart_, capture.start.secPastEpoch + capture.start.nsec * 1e-9);
+	pController->doCallbacksFloat64Array(capture.timeArray(), n, pController->LexiumCaptureTime_, axisNo_);
+	pController->doCallbacksFloat64Array(capture.positionArray(), n, pController->LexiumCapturePosition_, axisNo_);
+	pController->doCallbacksInt32Array(capture.movingArray(), n, pController->LexiumCaptureMoving_, axisNo_);
+	pController->doCallbacksInt32Array(capture.switchArray(), n, pController->LexiumCaptureSwitches_, axisNo_);
+}
+
 ////////////////////////////////////////////////////////
 //! saveToNVM()
 //! Save user variables and flags to non-volatile RAM in case of power loss
@@ -495,14 +1471,19 @@ asynStatus LexiumMotorAxis::poll(bool *moving)
 asynStatus LexiumMotorAxis::saveToNVM()
 {
 	asynStatus status = asynError;
-	char cmd[MAX_CMD_LEN];
+	LexiumCommand cmd(deviceName);
 	static const char *functionName = "saveToNVM()";
 
 	// send save command
-	sprintf(cmd, "S");
-	status = pController->writeController(cmd, Lexium_TIMEOUT);
+	if (pController->modbus) {
+		status = writeRegister(LEXIUM_MB_S, 1, 1);
+	} else {
+		cmd.appendString("S");
+		status = pController->writeController(cmd, Lexium_TIMEOUT);
+	}
 	if (status) goto bail;
 	asynPrint(pController->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: Saved to NVM\n", pController->motorName, functionName);
+	nvmPosition = lastPosition;  // nothing left for the background save
 
 	bail:
 	if (status) {
@@ -515,6 +1496,234 @@ asynStatus LexiumMotorAxis::saveToNVM()
 	return status;
 }
 
+////////////////////////////////////////////////////////
+//! nvmSaveDue()
+//! Check if the background saver should save this axis's position now, must be called with the controller lock held
+//! Due when Lexium_NVMSAVEIDLE is set, the position changed since the last save
+//! and the last polls have seen the axis idle for Lexium_NVMSAVEIDLE seconds
+//
+//! @param[in] now current time
+////////////////////////////////////////////////////////
+bool LexiumMotorAxis::nvmSaveDue(const epicsTimeStamp *now)
+{
+	double idlePeriod = 0;
+
+	pController->getDoubleParam(axisNo_, pController->LexiumNVMSaveIdle_, &idlePeriod);
+	if (idlePeriod <= 0 || !nvmPositionValid || nvmSavePending) return false;
+	// ER=0 of the save would hide a refused VI/VM/A from the ER read that checks them
+	if (unconfirmedMoveParameters) return false;
+	// moving, or a motion command not polled yet
+	if (lastMoving || pollRequested || moveTimed || lastPollStatus != asynSuccess) return false;
+	if (lastPosition == nvmPosition) return false;
+	return epicsTimeDiffInSeconds(now, &idleStart) >= idlePeriod;
+}
+
+////////////////////////////////////////////////////////
+//! backgroundSaveToNVM()
+//! Save the position to NVM for LexiumNVMSaver, must be called with the controller lock held
+//! Only ER=0 and S are written here; the drive answers nothing while it stores, so the ER check
+//! is left to the next poll, which waits for its reply with the controller lock released.
+//! Over Modbus a refused S is answered with an exception, the save is done when the write succeeds
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::backgroundSaveToNVM()
+{
+	asynStatus status;
+	LexiumCommand cmd(deviceName);
+	static const char *functionName = "backgroundSaveToNVM()";
+
+	if (pController->modbus) {
+		status = writeRegister(LEXIUM_MB_S, 1, 1);
+	} else {
+		// ER keeps its last code, cleared in the same write so a 73 read back can only come from this S
+		cmd.appendString("ER=0");
+		cmd.next(pController->outputEos).appendString("S");
+		status = pController->writeController(cmd, Lexium_TIMEOUT);
+	}
+	if (status) {
+		asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: ERROR saving position to NVM\n", pController->motorName, functionName);
+		epicsTimeGetCurrent(&idleStart);  // try again after the next idle period
+		return status;
+	}
+	asynPrint(pController->pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: saving position %f to NVM\n", pController->motorName, functionName, lastPosition);
+
+	if (pController->modbus) {
+		nvmPosition = lastPosition;
+		nvmSaves++;
+		setIntegerParam(pController->LexiumNVMSaves_, (int)nvmSaves);
+		return asynSuccess;
+	}
+	nvmPendingPosition = lastPosition;
+	nvmSavePending = true;
+	healthDue = true;      // read ER in the next poll
+	pollRequested = true;  // next poll cycle, even if other axes on the link are moving
+	return asynSuccess;
+}
+
+////////////////////////////////////////////////////////
+//! loadMCode()
+//! Replace the program in the drive's program space:
+//! CP clears it, PG enters program mode at PROGRAM_ADDRESS, each line is sent as is, PG leaves program mode.
+//! Empty lines and comment lines starting with ' are not sent.
+//
+//! @param[in] program MCode lines separated by newlines, or @fileName to read them from a file
+//! @return asynError if a line is too long or the drive reports an error (PR ER) after the upload
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::loadMCode(const char *program)
+{
+	asynStatus status = asynError;
+	asynStatus pgStatus;
+	LexiumCommand cmd(deviceName);
+	char *text = NULL;
+	const char *p, *end;
+	size_t len;
+	int lineNo = 0;
+	FILE *fp;
+	static const char *functionName = "loadMCode()";
+
+	if (program[0] == '@') {
+		fp = fopen(program + 1, "r");
+		if (!fp) {
+			asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: ERROR can't open %s\n", pController->motorName, functionName, program + 1);
+			return asynError;
+		}
+		text = (char *)malloc(MAX_PROGRAM_LEN + 1);
+		len = fread(text, 1, MAX_PROGRAM_LEN + 1, fp);
+		fclose(fp);
+		if (len > MAX_PROGRAM_LEN) {
+			asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: ERROR %s is longer than %d bytes\n", pController->motorName, functionName, program + 1, MAX_PROGRAM_LEN);
+			free(text);
+			return asynError;
+		}
+		text[len] = '\0';
+		program = text;
+	}
+
+	// check line lengths before anything is sent so a bad program doesn't leave the drive half loaded
+	for (p = program; *p; p = *end ? end + 1 : end) {
+		end = p + strcspn(p, "\r\n");
+		lineNo++;
+		while (p < end && (*p == ' ' || *p == '\t')) p++;
+		if ((size_t)(end - p) >= MAX_CMD_LEN) {
+			asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: ERROR line %d longer than %d characters\n", pController->motorName, functionName, lineNo, MAX_CMD_LEN - 1);
+			goto done;
+		}
+	}
+
+	cmd.appendString("CP");
+	status = pController->writeController(cmd, Lexium_TIMEOUT);
+	if (status) goto bail;
+	cmd.restart().appendString("PG ").appendInteger(PROGRAM_ADDRESS);
+	status = pController->writeController(cmd, Lexium_TIMEOUT);
+	if (status) goto bail;
+
+	for (p = program; *p && status == asynSuccess; p = *end ? end + 1 : end) {
+		end = p + strcspn(p, "\r\n");
+		while (p < end && (*p == ' ' || *p == '\t')) p++;
+		len = end - p;
+		while (len > 0 && (p[len-1] == ' ' || p[len-1] == '\t')) len--;
+		if (len == 0 || *p == '\'') continue;
+		cmd.restart().appendString(p, len);
+		status = pController->writeController(cmd, Lexium_TIMEOUT);
+	}
+
+	// always leave program mode, even after a failed line
+	cmd.restart().appendString("PG");
+	pgStatus = pController->writeController(cmd, Lexium_TIMEOUT);
+	if (status == asynSuccess) status = pgStatus;
+	if (status) goto bail;
+
+	status = checkErrorCode("loading program");
+	if (status == asynSuccess) asynPrint(pController->pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: program loaded\n", pController->motorName, functionName);
+
+	bail:
+	if (status) {
+		char buff[LOCAL_LINE_LEN];
+		sprintf(buff, "%s:%s: ERROR loading program", pController->motorName, functionName);
+		handleAxisError(buff);
+	}
+
+	done:
+	if (text) free(text);
+	callParamCallbacks();
+	return status;
+}
+
+////////////////////////////////////////////////////////
+//! clearMCode()
+//! Clear the drive's program space (CP)
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::clearMCode()
+{
+	asynStatus status;
+	LexiumCommand cmd(deviceName);
+	static const char *functionName = "clearMCode()";
+
+	cmd.appendString("CP");
+	status = pController->writeController(cmd, Lexium_TIMEOUT);
+	if (status == asynSuccess) status = checkErrorCode("clearing program");
+	if (status) {
+		char buff[LOCAL_LINE_LEN];
+		sprintf(buff, "%s:%s: ERROR clearing program", pController->motorName, functionName);
+		handleAxisError(buff);
+	}
+	callParamCallbacks();
+	return status;
+}
+
+////////////////////////////////////////////////////////
+//! clearLockedRotor()
+//! Clear the locked rotor and error flags (CF), the next poll reads LR, ER, ST again
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::clearLockedRotor()
+{
+	asynStatus status;
+	LexiumCommand cmd(deviceName);
+	static const char *functionName = "clearLockedRotor()";
+
+	if (pController->modbus) {
+		status = writeRegister(LEXIUM_MB_CF, 1, 1);
+	} else {
+		cmd.appendString("CF");
+		status = pController->writeController(cmd, Lexium_TIMEOUT);
+	}
+	if (status) {
+		char buff[LOCAL_LINE_LEN];
+		sprintf(buff, "%s:%s: ERROR clearing locked rotor", pController->motorName, functionName);
+		handleAxisError(buff);
+	}
+	healthDue = true;
+	pollRequested = true;
+	callParamCallbacks();
+	return status;
+}
+
+////////////////////////////////////////////////////////
+//! checkErrorCode()
+//! Read the drive's error code after a command that gets no reply
+//
+//! @param[in] what description of the command for the error message
+//! @return asynError if PR ER could not be read or is not 0
+////////////////////////////////////////////////////////
+asynStatus LexiumMotorAxis::checkErrorCode(const char *what)
+{
+	asynStatus status;
+	long errCode;
+	LexiumCommand cmd(deviceName);
+	static const char *functionName = "checkErrorCode()";
+
+	cmd.appendString("PR ER");
+	status = queryValue(cmd, &errCode);
+	if (status) {
+		asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: no error code after %s\n", pController->motorName, functionName, what);
+		return status;
+	}
+	if (errCode) {
+		asynPrint(pController->pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: drive error %ld after %s\n", pController->motorName, functionName, errCode, what);
+		return asynError;
+	}
+	return asynSuccess;
+}
+
 ////////////////////////////////////////////////////////
 //! handleAxisError()
 //! Set motorStatusProblem_
@@ -524,20 +1733,33 @@ asynStatus LexiumMotorAxis::saveToNVM()
 ////////////////////////////////////////////////////////
 void LexiumMotorAxis::handleAxisError(char *errMsg)
 {
-	char cmd[MAX_CMD_LEN];
-	char resp[MAX_BUFF_LEN];
-	size_t nread=0;
+	LexiumCommand cmd(deviceName);
+	long value;
 	int errCode=0;
-	char errCodeString[MAX_BUFF_LEN];
+	char errCodeString[MAX_BUFF_LEN] = "Unknown error code";
 	static const char *functionName = "handleAxisError()";
 
 	// set motorStatusProblem_ bit
 	setIntegerParam(pController->motorStatusProblem_, 1);
 
-	// read error code
-	sprintf(cmd, "PR ER");
-	pController->writeReadController(cmd, resp, sizeof(resp), &nread, Lexium_TIMEOUT);
-	errCode = atoi(resp);
+	// after a comms or drive error the cached move parameters may not match the drive
+	invalidateMoveParameters();
+
+	// read error code, unless writeSequence() just did or the drive just timed out and would only time out again
+	cmd.appendString("PR ER");
+	if (errorCodeRead) {
+		errCode = lastErrorCode;
+		errorCodeRead = false;
+	} else if (!link.up || link.timeouts) {
+		errCode = -1;
+		strcpy(errCodeString, "Drive not answering");
+	} else if ((pController->modbus ? readRegister(LEXIUM_MB_ER, 1, &value) : queryValue(cmd, &value)) == asynSuccess) {
+		errCode = (int)value;
+		lastErrorCode = errCode;
+	} else {
+		errCode = -1;  // still report errMsg below
+		strcpy(errCodeString, "Error code not readable");
+	}
 
 	switch (errCode) {
 	case 0: strcpy(errCodeString, "No Error"); break;
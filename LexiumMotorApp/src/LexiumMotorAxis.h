@@ -8,20 +8,64 @@
 
 #include "asynMotorController.h"
 #include "asynMotorAxis.h"
+#include "LexiumStats.h"
+#include "LexiumCommand.h"
+#include "LexiumCapture.h"
+#include "LexiumLink.h"
+#include "LexiumReply.h"
 
 #define DRIVER_NAME "LexiumMotorDriver"
 
-#define NUM_AXES 1
+#define MAX_AXES 16   // party mode drives per controller
 #define DEFAULT_NUM_CARDS 32
 #define MAX_MESSAGES 100
 #define Lexium_TIMEOUT 2
 #define MAX_BUFF_LEN 80
-#define MAX_CMD_LEN MAX_BUFF_LEN-10  // leave room for line feeds surrounding command
+#define MAX_CMD_LEN (MAX_BUFF_LEN-10)  // leave room for line feeds surrounding command
 #define MAX_NAME_LEN 10
 #define LOCAL_LINE_LEN 256
+#define Lexium_LINE_TIMEOUT 0.1  // wait for each further line of a multi-line reply once the first has arrived
+#define MAX_REPLY_LINES 8        // hard cap on the lines read for one multi-line reply
+#define NUM_IS_LINES 5           // lines in the PR IS reply
+#define DEFAULT_MAX_POLL_PERIOD 0.5  // seconds, default for Lexium_MAXPOLLPERIOD
+#define PROGRAM_ADDRESS 1        // program space address Lexium_LOADMCODE uploads to
+#define MAX_PROGRAM_LEN 16384    // longest program Lexium_LOADMCODE accepts
+#define EVENT_TAG "@LEX"         // start of the lines printed by the event program
+#define DEFAULT_HEALTH_PERIOD 1.0  // seconds, default for Lexium_HEALTHPERIOD
+#define STOP_CHECK_PERIOD 0.01   // seconds a poll waits for its reply before checking for a stop
+#define NVM_SAVE_MOVING_ERROR 73  // ER after S while moving
+
+// optional field groups read by pollCombined() and pollPerField(), P and MV are always read
+#define POLL_SWITCHES 0x1  // home and limit switch inputs
+#define POLL_HEALTH   0x2  // LR, ER, ST
+#define MAX_POLL_FIELDS 6  // 3 switch inputs and 3 health fields
+
+// move parameters a set function added to a command sequence, see confirmMoveParameters()
+#define MOVE_VI 0x1
+#define MOVE_VM 0x2
+#define MOVE_A  0x4
+
+// command including party mode device name, without the output EOS
+typedef LexiumCommandBuffer<MAX_BUFF_LEN> LexiumCommand;
 
 class epicsShareClass LexiumMotorController;
 
+////////////////////////////////////
+// LexiumPollData
+// values read back from the drive in one poll cycle
+////////////////////////////////////
+struct LexiumPollData
+{
+	double position;   // PR P
+	int moving;        // PR MV
+	int home;          // PR I<homeSwitchInput>, -1 if no home switch configured
+	int highLimit;     // PR I<posLimitSwitchInput>, -1 if no + limit configured
+	int lowLimit;      // PR I<negLimitSwitchInput>, -1 if no - limit configured
+	int lockedRotor;   // PR LR, -1 if not read in this cycle
+	int errorCode;     // PR ER, -1 if not read in this cycle
+	int stalled;       // PR ST, -1 if not read in this cycle
+};
+
 ////////////////////////////////////
 // LexiumMotorAxis class
 // derived from asynMotorAxis class
@@ -32,38 +76,135 @@ public:
 	///////////////////////////////////
 	// Override asynMotorAxis functions
 	///////////////////////////////////
-	LexiumMotorAxis(LexiumMotorController *pC, int axis);
+	LexiumMotorAxis(LexiumMotorController *pC, int axis, const char *devName);
 	asynStatus move(double position, int relative, double min_velocity, double max_velocity, double acceleration);
 	asynStatus moveVelocity(double min_velocity, double max_velocity, double acceleration);
  	asynStatus home(double min_velocity, double max_velocity, double acceleration, int forwards);
   	asynStatus stop(double acceleration);
   	asynStatus poll(bool *moving);
   	asynStatus setPosition(double position);
+	void report(FILE *fp, int level);
 
 	////////////////////////////////////////////////////
 	// Lexium specific functions
 	////////////////////////////////////////////////////
   	asynStatus saveToNVM();
+	bool nvmSaveDue(const epicsTimeStamp *now);
+	asynStatus backgroundSaveToNVM();
+	asynStatus loadMCode(const char *program);
+	asynStatus clearMCode();
+	asynStatus clearLockedRotor();
 protected:
 
 
 private:
 	LexiumMotorController *pController;
+	char deviceName[MAX_NAME_LEN];          //! party mode device name (DN) prepended to every command, "" if not using party mode
+	int homeSwitchInput;                    //! inputs configured by IS, -1 if none
+	int posLimitSwitchInput;
+	int negLimitSwitchInput;
+	bool probed;                            //! configAxis() and readHomeAndLimitConfig() have run, see LexiumBackgroundStartup()
+	bool combinedPollRejected;              //! drive did not answer the combined PR query, use one query per field
+	bool combinedPollAccepted;              //! drive has answered the combined PR query since it was configured
+	LexiumLink link;                        //! connection state, see LexiumLink.h
+	bool slowReplyDue;                      //! S, CP or PG sent, the next reply may wait for the drive's flash
+
+	// scheduling by LexiumMotorController::poll()
+	bool pollRequested;                     //! motion command sent, poll in the next cycle even if idle
+	bool lastMoving;                        //! moving flag from the last pollAxis()
+	asynStatus lastPollStatus;              //! status of the last pollAxis()
+	int lastErrorCode;                      //! ER last read, by the slow poll tier or after an error, -1 if unknown
+	bool errorCodeRead;                     //! writeSequence() failed on the drive's ER, handleAxisError() uses lastErrorCode
+
+	// slow poll tier, see pollAxis()
+	bool healthDue;                         //! read the health fields in the next poll, whatever the period
+	epicsTimeStamp lastHealthPoll;          //! last time LR, ER, ST were read
+
+	// adaptive polling
+	double lastPosition;                    //! position from the last pollAxis()
+	bool endPredicted;                      //! predictedEnd is valid for the move in progress
+	epicsTimeStamp predictedEnd;            //! when the move started by move() should be done
+
+	// last VI/VM/A values written to the drive, so unchanged values are not sent again
+	bool baseVelocityValid;
+	bool maxVelocityValid;
+	bool accelerationValid;
+	long lastBaseVelocity;
+	long lastMaxVelocity;
+	long lastAcceleration;
+	int unconfirmedMoveParameters;          //! MOVE_VI/MOVE_VM/MOVE_A cached from a write without PR ER, checked by the next ER read
+	unsigned long skippedWrites;            //! number of VI/VM/A writes skipped because the drive already had the value
+
+	// poll and move statistics, see LexiumStats.h
+	LexiumHistogram pollTime;               //! duration of poll()
+	LexiumHistogram moveTime;               //! move() or home() until poll() sees the motor stopped
+	LexiumHistogram stopTime;               //! stop() until SL 0 is written
+	double pollCpuTime;                     //! CPU time spent in poll()
+	epicsTimeStamp moveStartTime;
+	bool moveTimed;                         //! move in progress, moveTime is recorded when it is done
+
+	// poll sample capture, see LexiumCapture.h
+	LexiumCapture capture;
+	bool captureNextMove;                   //! Lexium_CAPTUREMODE 2 armed, start capturing at the next move() or home()
+	bool captureThisMove;                   //! capturing the move in progress, stop when it is done
+
+	// background save of the position to NVM, see LexiumNVMSaver.h
+	epicsTimeStamp idleStart;               //! last poll that saw the axis moving or its position change
+	bool nvmPositionValid;                  //! nvmPosition is set, by the first good poll
+	double nvmPosition;                     //! position last saved to NVM, or read by the first poll
+	bool nvmSavePending;                    //! S sent, waiting for the poll that reads ER to confirm it
+	double nvmPendingPosition;              //! position the pending save stores
+	unsigned long nvmSaves;                 //! background saves confirmed
+
+	// streaming jog velocity, see LexiumMotorController::velocityStreamer()
+	bool streamPending;                     //! queued velocity not sent yet
+	double streamMinVelocity;               //! newest moveVelocity() arguments
+	double streamMaxVelocity;
+	double streamAcceleration;
+	epicsTimeStamp streamRequestTime;       //! newest moveVelocity() call
+	unsigned long streamCoalesced;          //! queued velocities replaced before being sent
+	LexiumHistogram streamTime;             //! moveVelocity() until SL is written
 
 	//int useEncoder;                         //! using encoder flag
-	// FIXME handle lost position in driver or ioc??
-//	epicsTime idleTimeStart;                //! timer used to track idle time for saving to NVM
-//	double prevPosition;                    //! previous position used to see if motor has moved and need to update position in NVM in case of power failure
-//	int prevMovingState;                    //! saves previous moving value
 
 	////////////////////////////////////////////////////
 	// Lexium specific functions
 	////////////////////////////////////////////////////
 	asynStatus configAxis();
-	asynStatus setAxisMoveParameters(double min_velocity, double max_velocity, double acceleration);
+	int readHomeAndLimitConfig();  // read home, positive limit, and neg limit switch configuration from controller (S1-S4 settings)
+	asynStatus pollAxis();
+	asynStatus reconnect(const epicsTimeStamp *now);
+	void predictMoveEnd(double distance, double minVelocity, double maxVelocity, double acceleration);
+	double adaptivePollPeriod(double fastPeriod, double maxPeriod);
+	asynStatus setAxisMoveParameters(double min_velocity, double max_velocity, double acceleration, LexiumCommand *seq, int *appended, bool checked = true);
+	asynStatus setBaseVelocity(double minVelocity, LexiumCommand *seq, int *appended);
+	asynStatus setMaxVelocity(double maxVelocity, LexiumCommand *seq, int *appended);
+	asynStatus setAcceleration(double acceleration, LexiumCommand *seq, int *appended);
+	asynStatus writeSequence(const LexiumCommand &seq, const char *what);
+	void confirmMoveParameters(int appended, double minVelocity, double maxVelocity, double acceleration, bool checked = true);
+	void invalidateMoveParameters(int params = MOVE_VI | MOVE_VM | MOVE_A);
 	void handleAxisError(char *errMsg);
+	asynStatus queueVelocity(double minVelocity, double maxVelocity, double acceleration);
+	void sendQueuedVelocity();
+	asynStatus checkErrorCode(const char *what);
+	asynStatus pollCombined(LexiumPollData *data, int fields, LexiumReplyError *replyError);
+	asynStatus pollPerField(LexiumPollData *data, int fields);
+	asynStatus pollModbus(LexiumPollData *data);
+	asynStatus configAxisModbus();
+	asynStatus readRegister(int addr, int width, long *value);
+	asynStatus writeRegister(int addr, int width, long value);
+	asynStatus queryValue(const LexiumCommand &cmd, long *value);
+	asynStatus queryValue(const LexiumCommand &cmd, double *value);
+	void resetStats();
+	void armCapture(int mode);
+	void stopCapture();
+	void captureSample(double position, bool moving);
+	void startMoveCapture();
+	void publishCapture();
 
 friend class LexiumMotorController;
+friend class LexiumBenchmark;
+friend class LexiumNVMSaver;
 };
 
 #endif // LexiumMotorAxis_H
@@ -8,8 +8,8 @@
 //!  ZY, zyin@bnl.gov
 //!
 //!  Assumptions :
-//!    Assume single controller-card-axis relationship; 1 controller = 1 axis.  
-//!    No address on mdriveplus, config "" for device name
+//!    Ethernet drives: 1 controller = 1 axis, config "" for device name.
+//!    Party mode (PY=1) multidrop links: 1 controller per link, one axis per device name.
 //
 //  Revision History
 //  ----------------
@@ -22,8 +22,10 @@
 #include <string.h>
 #include <exception>
 #include <epicsThread.h>
+#include <epicsAtomic.h>
 #include <iocsh.h>
 #include <asynOctetSyncIO.h>
+#include <asynCommonSyncIO.h>
 
 #include "asynMotorController.h"
 #include "asynMotorAxis.h"
@@ -31,147 +33,333 @@
 
 #include <epicsExport.h>
 #include "LexiumMotorController.h"
+#include "LexiumPollGroup.h"
+#include "LexiumNVMSaver.h"
+#include "LexiumModbus.h"
+
+// all controllers in the IOC, newest first
+LexiumMotorController *LexiumMotorController::pFirstController = NULL;
+
+// set by LexiumBackgroundStartup(), applies to controllers created afterwards
+static int lexiumBackgroundStartup = 0;
+
+// set by LexiumModbusTransport(), applies to controllers created afterwards
+static int lexiumModbusTransport = 0;
+
+// commands after which the drive writes its flash, and may answer the next query late
+static bool lexiumSlowCommand(const char *body)
+{
+	return !strcmp(body, "S") || !strncmp(body, "CP", 2) || !strncmp(body, "PG", 2);
+}
+
+// drive program loaded by Lexium_EVENTMODE, prints a line starting with EVENT_TAG each time a move ends:
+// "@LEX STALL" if the stall flag is set, "@LEX LIMIT" after a limit switch error (ER 83/84), "@LEX DONE" otherwise
+static const char *lexiumEventProgram =
+	"LB LE\n"
+	"BR LE, MV=0\n"
+	"LB LW\n"
+	"BR LW, MV=1\n"
+	"BR LS, ST=1\n"
+	"BR LL, ER=83\n"
+	"BR LL, ER=84\n"
+	"PR \"" EVENT_TAG " DONE\"\n"
+	"BR LE\n"
+	"LB LS\n"
+	"PR \"" EVENT_TAG " STALL\"\n"
+	"BR LE\n"
+	"LB LL\n"
+	"PR \"" EVENT_TAG " LIMIT\"\n"
+	"BR LE\n"
+	"E\n";
+
+////////////////////////////////////////////////////////
+//! lexiumParseDeviceNames()
+//! split the comma separated device name list given to LexiumCreateController()
+//
+//! @param[in]  devName list of party mode device names, "" for a single drive not in party mode
+//! @param[out] names   one device name per axis, may be NULL to only count them
+//! @return number of axes, at least 1 and at most MAX_AXES; -1 if a name is empty, has a blank inside
+//!         or MAX_NAME_LEN characters or more, or if there are more than MAX_AXES names
+////////////////////////////////////////////////////////
+static int lexiumParseDeviceNames(const char *devName, char names[][MAX_NAME_LEN])
+{
+	int numNames = 0;
+	size_t len;
+	const char *p = devName ? devName : "";
+
+	while (*p == ' ') p++;
+	if (*p == '\0') { // single drive, not in party mode
+		if (names) names[0][0] = '\0';
+		return 1;
+	}
+	for (;;) {
+		while (*p == ' ') p++;
+		len = strcspn(p, ", ");
+		if (len == 0 || len >= MAX_NAME_LEN || numNames >= MAX_AXES) return -1;
+		if (names) {
+			memcpy(names[numNames], p, len);
+			names[numNames][len] = '\0';
+		}
+		numNames++;
+		p += len;
+		while (*p == ' ') p++;
+		if (*p == '\0') return numNames;
+		if (*p++ != ',') return -1;  // blank inside a name
+	}
+}
+
+static void LexiumStartupProbeC(void *pPvt)
+{
+	LexiumMotorController *pController = (LexiumMotorController *)pPvt;
+	pController->startupProbe();
+}
+
+static void LexiumEventListenerC(void *pPvt)
+{
+	LexiumMotorController *pController = (LexiumMotorController *)pPvt;
+	pController->eventListener();
+}
+
+static void LexiumVelocityStreamerC(void *pPvt)
+{
+	LexiumMotorController *pController = (LexiumMotorController *)pPvt;
+	pController->velocityStreamer();
+}
 
 ////////////////////////////////////////////////////////
 //! @LexiumMotorController()
 //! Constructor
-//! Driver assumes only 1 axis configured per controller for now...
+//! One axis per device name, all sharing the IO port
 //!
 //! @param[in] motorPortName     Name assigned to the port created to communicate with the motor
 //! @param[in] IOPortName        Name assigned to the asyn IO port, name that was assigned in drvAsynIPPortConfigure()
 //! @param[in] devName           Name of device (DN) assigned to motor axis in MCode, the device name is prepended to the MCode command to support Party Mode (PY) multidrop communication setup
+//!                              comma separated list for several drives on one party mode link, e.g. "A,B,C" creates axes 0-2
 //!                              set to empty string "" if no device name needed/not using Party Mode
 //! @param[in] movingPollPeriod  Moving polling period in milliseconds
 //! @param[in] idlePollPeriod    Idle polling period in milliseconds
 ////////////////////////////////////////////////////////
 LexiumMotorController::LexiumMotorController(const char *motorPortName, const char *IOPortName, const char *devName, double movingPollPeriod, double idlePollPeriod)
-    : asynMotorController(motorPortName, NUM_AXES, NUM_Lexium_PARAMS,
-						  asynInt32Mask | asynFloat64Mask | asynUInt32DigitalMask,
-						  asynInt32Mask | asynFloat64Mask | asynUInt32DigitalMask,
+    : asynMotorController(motorPortName, lexiumParseDeviceNames(devName, NULL), NUM_Lexium_PARAMS,
+						  asynInt32Mask | asynFloat64Mask | asynUInt32DigitalMask | asynOctetMask | asynInt32ArrayMask | asynFloat64ArrayMask,
+						  asynInt32Mask | asynFloat64Mask | asynUInt32DigitalMask | asynOctetMask | asynInt32ArrayMask | asynFloat64ArrayMask,
 						  ASYN_CANBLOCK | ASYN_MULTIDEVICE,
 						  1, // autoconnect
 						  0, 0),  // Default priority and stack size
-    pAsynUserLexium(0)
+    pAsynUserLexium(0), pAsynUserCommand(0), pAsynUserCommon(0), modbus(lexiumModbusTransport != 0), modbusTid(0), nextIdleAxis(0), backgroundStartup(lexiumBackgroundStartup != 0), probeDone(false), pPollGroupEntry(NULL),
+    eventMode(false), eventListenerStarted(false), streamerStarted(false),
+    pollThread(NULL), pollUnlocked(false), pollPreempted(0), staleReply(false), pollIOWaiting(0),
+    ioTimeouts(0), ioErrors(0), ioBytesOut(0), ioBytesIn(0), pollOverruns(0), pollsAbandoned(0), pNextController(NULL)
 {
 	static const char *functionName = "LexiumMotorController()";
 	asynStatus status;
 	LexiumMotorAxis *pAxis;
+	char deviceNames[MAX_AXES][MAX_NAME_LEN];
 	// asynMotorController constructor calloc's memory for array of axis pointers
 	pAxes_ = (LexiumMotorAxis **)(asynMotorController::pAxes_);
 
 	// copy names
 	strcpy(motorName, motorPortName);
+	eventModeOn = epicsEventCreate(epicsEventEmpty);
+	streamWakeup = epicsEventCreate(epicsEventEmpty);
+	pollIOLock = epicsMutexMustCreate();
 
 	// setup communication
 	status = pasynOctetSyncIO->connect(IOPortName, 0, &pAsynUserLexium, NULL);
+	if (status == asynSuccess) status = pasynOctetSyncIO->connect(IOPortName, 0, &pAsynUserCommand, NULL);
 	if (status != asynSuccess) {
 		printf("\n\n%s:%s: ERROR connecting to Controller's IO port=%s\n\n", DRIVER_NAME, functionName, IOPortName);
 	}
+	if (pasynCommonSyncIO->connect(IOPortName, 0, &pAsynUserCommon, NULL) != asynSuccess) pAsynUserCommon = NULL;
 
 	// write version, cannot use asynPrint() in constructor since controller (motorPortName) hasn't been created yet
 //	printf("%s:%s: motorPortName=%s, IOPortName=%s, devName=%s \n", DRIVER_NAME, functionName, motorPortName, IOPortName, devName);
-	printf("==> motorPort = %s: ",  motorPortName);
+	if (!backgroundStartup) printf("==> motorPort = %s: ",  motorPortName);
 
 	// init
-  // ZY: for LEXIUM Mdrive, EM=2, OEOS = "\r", IEOS="\r\n". 
-    pasynOctetSyncIO->setInputEos(pAsynUserLexium, "\r\n", 2);
-	pasynOctetSyncIO->setOutputEos(pAsynUserLexium, "\r", 1); 
+	lexiumParseDeviceNames(devName, deviceNames);
+	if (deviceNames[0][0]) {
+		// in party-mode Line Feed must follow command string
+		outputEos = '\n';
+	} else {
+		outputEos = '\r';
+	}
+	// Modbus frames are binary and carry their own length, no EOS
+	if (!modbus) {
+		// ZY: for LEXIUM Mdrive, EM=2, OEOS = "\r", IEOS="\r\n".
+		// the EOS belong to the port, they apply to pAsynUserCommand too
+		pasynOctetSyncIO->setInputEos(pAsynUserLexium, "\r\n", 2);
+		pasynOctetSyncIO->setOutputEos(pAsynUserLexium, &outputEos, 1);
+	}
 
 	// Create controller-specific parameters
 	createParam(LexiumSaveToNVMControlString, asynParamInt32, &LexiumSaveToNVM_);
 	createParam(LexiumLoadMCodeControlString, asynParamOctet, &this->LexiumLoadMCode_);
 	createParam(LexiumClearMCodeControlString, asynParamOctet, &this->LexiumClearMCode_);
+	// per axis parameters, defaults are set by the LexiumMotorAxis constructor
+	createParam(LexiumCombinedPollControlString, asynParamInt32, &this->LexiumCombinedPoll_);
+	createParam(LexiumSkippedWritesControlString, asynParamInt32, &this->LexiumSkippedWrites_);
+	createParam(LexiumIORttMinControlString, asynParamFloat64, &this->LexiumIORttMin_);
+	createParam(LexiumIORttMeanControlString, asynParamFloat64, &this->LexiumIORttMean_);
+	createParam(LexiumIORttP99ControlString, asynParamFloat64, &this->LexiumIORttP99_);
+	createParam(LexiumIORttMaxControlString, asynParamFloat64, &this->LexiumIORttMax_);
+	createParam(LexiumIOCountControlString, asynParamInt32, &this->LexiumIOCount_);
+	createParam(LexiumIOTimeoutsControlString, asynParamInt32, &this->LexiumIOTimeouts_);
+	createParam(LexiumIOErrorsControlString, asynParamInt32, &this->LexiumIOErrors_);
+	createParam(LexiumAdaptivePollControlString, asynParamInt32, &this->LexiumAdaptivePoll_);
+	setIntegerParam(LexiumAdaptivePoll_, 0);
+	createParam(LexiumMaxPollPeriodControlString, asynParamFloat64, &this->LexiumMaxPollPeriod_);
+	setDoubleParam(LexiumMaxPollPeriod_, DEFAULT_MAX_POLL_PERIOD);
+	createParam(LexiumEventModeControlString, asynParamInt32, &this->LexiumEventMode_);
+	setIntegerParam(LexiumEventMode_, 0);
+	createParam(LexiumLockedRotorControlString, asynParamInt32, &this->LexiumLockedRotor_);
+	createParam(LexiumErrorCodeControlString, asynParamInt32, &this->LexiumErrorCode_);
+	createParam(LexiumStalledControlString, asynParamInt32, &this->LexiumStalled_);
+	createParam(LexiumClearLockControlString, asynParamInt32, &this->LexiumClearLock_);
+	createParam(LexiumHealthPeriodControlString, asynParamFloat64, &this->LexiumHealthPeriod_);
+	createParam(LexiumStopLatencyControlString, asynParamFloat64, &this->LexiumStopLatency_);
+	createParam(LexiumCaptureArmControlString, asynParamInt32, &this->LexiumCaptureArm_);
+	createParam(LexiumCaptureModeControlString, asynParamInt32, &this->LexiumCaptureMode_);
+	createParam(LexiumCaptureTriggerControlString, asynParamInt32, &this->LexiumCaptureTrigger_);
+	createParam(LexiumCaptureCountControlString, asynParamInt32, &this->LexiumCaptureCount_);
+	createParam(LexiumCaptureStartControlString, asynParamFloat64, &this->LexiumCaptureStart_);
+	createParam(LexiumCaptureTimeControlString, asynParamFloat64Array, &this->LexiumCaptureTime_);
+	createParam(LexiumCapturePositionControlString, asynParamFloat64Array, &this->LexiumCapturePosition_);
+	createParam(LexiumCaptureMovingControlString, asynParamInt32Array, &this->LexiumCaptureMoving_);
+	createParam(LexiumCaptureSwitchesControlString, asynParamInt32Array, &this->LexiumCaptureSwitches_);
+	createParam(LexiumNVMSaveIdleControlString, asynParamFloat64, &this->LexiumNVMSaveIdle_);
+	createParam(LexiumNVMSavesControlString, asynParamInt32, &this->LexiumNVMSaves_);
+	createParam(LexiumLinkTimeoutsControlString, asynParamInt32, &this->LexiumLinkTimeouts_);
+	createParam(LexiumLinkUpControlString, asynParamInt32, &this->LexiumLinkUp_);
+	createParam(LexiumReconnectsControlString, asynParamInt32, &this->LexiumReconnects_);
+	createParam(LexiumTimeoutFloorControlString, asynParamFloat64, &this->LexiumTimeoutFloor_);
+	setDoubleParam(LexiumTimeoutFloor_, DEFAULT_TIMEOUT_FLOOR);
+	createParam(LexiumTimeoutCeilingControlString, asynParamFloat64, &this->LexiumTimeoutCeiling_);
+	setDoubleParam(LexiumTimeoutCeiling_, Lexium_TIMEOUT);
+	createParam(LexiumStreamVelocityControlString, asynParamInt32, &this->LexiumStreamVelocity_);
+	createParam(LexiumStreamLatencyControlString, asynParamFloat64, &this->LexiumStreamLatency_);
+	createParam(LexiumStreamCoalescedControlString, asynParamInt32, &this->LexiumStreamCoalesced_);
+	createParam(LexiumRttQueryControlString, asynParamFloat64, &this->LexiumRttQuery_);
+	createParam(LexiumRttWriteControlString, asynParamFloat64, &this->LexiumRttWrite_);
+	createParam(LexiumRttSaveControlString, asynParamFloat64, &this->LexiumRttSave_);
+	createParam(LexiumTimeoutQueryControlString, asynParamFloat64, &this->LexiumTimeoutQuery_);
+	createParam(LexiumTimeoutWriteControlString, asynParamFloat64, &this->LexiumTimeoutWrite_);
+	createParam(LexiumTimeoutSaveControlString, asynParamFloat64, &this->LexiumTimeoutSave_);
+	epicsTimeGetCurrent(&ioWindowStart);
+	publishIOStats();
 
 	// Check the validity of the arguments and init controller object
-	initController(devName, movingPollPeriod, idlePollPeriod);
+	initController(movingPollPeriod, idlePollPeriod);
 
-	// Create axis
-	// Assuming single axis per controller the way drvAsynIPPortConfigure( "M06", "ts-b34-nw08:2101", 0, 0 0 ) is called in st.cmd script
-	pAxis = new LexiumMotorAxis(this, 0);
+	// Create axes, one per device name
+	// a single axis with no device name for ethernet drives, the way drvAsynIPPortConfigure( "M06", "ts-b34-nw08:2101", 0, 0 0 ) is called in st.cmd script
+	for (int i=0; i<numAxes_; i++) {
+		if (i > 0 && !backgroundStartup) printf("==> motorPort = %s: ",  motorPortName);
+		pAxis = new LexiumMotorAxis(this, i, deviceNames[i]);
+		if (!backgroundStartup) {
+			// read home and limit config from Response from "PR IS"
+			pAxis->readHomeAndLimitConfig();
+		}
+	}
 	pAxis = NULL;  // asynMotorController constructor tracking array of axis pointers
 
-	// read home and limit config from Response from "PR IS"
-	readHomeAndLimitConfig();
+	if (backgroundStartup) {
+		// configAxis() and readHomeAndLimitConfig() run in startupProbe(), poll() reports a comms error until it is done
+		printf("==> motorPort = %s: probing in background\n", motorPortName);
+		epicsThreadCreate("LexiumProbe", epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium),
+						  (EPICSTHREADFUNC)LexiumStartupProbeC, (void *)this);
+	} else {
+		probeDone = true;
+	}
+
+	pNextController = pFirstController;
+	pFirstController = this;
+	LexiumNVMSaver::start();
 
-	startPoller(movingPollPeriod, idlePollPeriod, 2);
+	// join the shared poll group if one was created, otherwise start our own poller thread
+	if (LexiumPollGroup::getGroup()) {
+		pPollGroupEntry = LexiumPollGroup::getGroup()->addController(this, 2);
+	} else {
+		startPoller(movingPollPeriod, idlePollPeriod, 2);
+	}
 }
 
 ////////////////////////////////////////
 //! initController()
-//! config controller variables - axis, etc.
-//! only support single axis per controller
+//! config controller variables
 //
-//! @param[in] devName Name of device (DN) used to identify axis within controller for Party Mode
 //! @param[in] movingPollPeriod  Moving polling period in milliseconds
 //! @param[in] idlePollPeriod    Idle polling period in milliseconds
 ////////////////////////////////////////
-void LexiumMotorController::initController(const char *devName, double movingPollPeriod, double idlePollPeriod)
+void LexiumMotorController::initController(double movingPollPeriod, double idlePollPeriod)
 {
-	strcpy(this->deviceName, devName);
-
 	// initialize asynMotorController variables
-	this->numAxes_ = NUM_AXES;  // only support single axis
 	this->movingPollPeriod_ = movingPollPeriod;
+	this->fastPollPeriod = movingPollPeriod;
 	this->idlePollPeriod_ = idlePollPeriod;
 
-	// initialize switch inputs
-	this->homeSwitchInput=-1;
-	this->posLimitSwitchInput=-1;
-	this->negLimitSwitchInput=-1;
-
 	// flush io buffer
 	pasynOctetSyncIO->flush(pAsynUserLexium);
 }
 
 ////////////////////////////////////////
-//! readHomeAndLimitConfig
-//! read home, positive limit, and neg limit switch configuration from MCode S1-S4 settings
-//! Limits must be set up beforehand with IS command: 
-// IS = <input#>, <type>, <active>
-//! I1-I4 are used to read the status of
-//  Use logic from existing drvMDrive.cc
+//! startupProbe()
+//! Background version of the constructor's drive setup, runs in its own thread
+//! so controllers created with LexiumBackgroundStartup(1) probe their drives in parallel
+//! instead of one after the other during st.cmd
 ////////////////////////////////////////
-int LexiumMotorController::readHomeAndLimitConfig()
+void LexiumMotorController::startupProbe()
 {
-	asynStatus status = asynError;
-	char cmd[MAX_CMD_LEN];
-	char resp[MAX_BUFF_LEN];
-	size_t nread;
-	static const char *functionName = "readHomeAndLimitConfig()";
-	int type;
-    int type_signal;
-    int bytesread = 0;
-    int i, bytespass=0;
-
-	// iterate through response of IS = and parse each configuration to see if home, pos, and neg limits are set
-		sprintf(cmd, "PR IS"); // query IS setting
-//		status = this->writeReadController2(cmd, resp, sizeof(resp), &nread, Lexium_TIMEOUT);
-//		Hardwired to use 0.1 sec as timeout below, IEOS of "" will wait until timeout
-		status = this->writeReadController2(cmd, resp, sizeof(resp), &nread, 0.1);
-//        printf("resp:\n %s, length = %d\n", resp, nread);
-	for (int j=0; j<=4; j++) {
-        sscanf(resp + bytespass, "IS = %d, %d, %d\r\n%n", &i, &type, &type_signal, &bytesread);
-		// asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: S%d: type=%d\n", DRIVER_NAME, functionName, i, type);
-  //      printf("j=%d; i=%d; type=%d; signal=%d; bytesread=%d; bytespass=%d\n", j, i, type, type_signal, bytesread, bytespass);
-		if (type != 0)
-			//printf("%s:%s: S%d: type=%d\n", DRIVER_NAME, functionName, i, type);
-		switch (type) {
-		case 0: break; // general purpose input
-		case 1: // home switch input
-			homeSwitchInput = i; break;
-		case 2: // positive limit switch input
-			posLimitSwitchInput = i; break;
-		case 3: // negative limit switch input
-			negLimitSwitchInput = i; break;
-		default:
-			printf("%s:%s: ERROR invalid data type for IS%d=%d\n", DRIVER_NAME, functionName, i, type);
+	static const char *functionName = "startupProbe()";
+
+	// the lock is taken per axis, so the poller reports the axes not probed yet and polls the others meanwhile
+	for (int i=0; i<numAxes_; i++) {
+		lock();
+		if (getAxis(i)->configAxis() == asynError) {
+			asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: controller config failed for motor port=%s\n", DRIVER_NAME, functionName, motorName);
 		}
-        bytespass += bytesread ;
+		printf("==> motorPort = %s: ", motorName);
+		getAxis(i)->readHomeAndLimitConfig();
+		getAxis(i)->probed = true;
+		unlock();
+
+		// first real poll of the axis straight away
+		wakeupPoller();
 	}
-	
-	printf("+LimitInput = %d,  -LimitInput = %d,   homeSwitch = %d\n", posLimitSwitchInput, negLimitSwitchInput,homeSwitchInput);
+	probeDone = true;
+}
 
-	return status;
+////////////////////////////////////////
+//! readInputConfig()
+//! read and parse the input setup reported by PR IS
+//
+//! @param[in]  devName   party mode device name of the drive, "" if not using party mode
+//! @param[out] config    one record per IS line
+//! @param[in]  maxInputs size of config
+//! @param[out] numInputs number of records returned
+//! @return asynError if the drive did not answer or a line could not be parsed
+////////////////////////////////////////
+asynStatus LexiumMotorController::readInputConfig(const char *devName, LexiumInputConfig *config, int maxInputs, int *numInputs)
+{
+	asynStatus status;
+	char lines[MAX_REPLY_LINES][MAX_BUFF_LEN];
+	int nlines;
+	static const char *functionName = "readInputConfig()";
+
+	*numInputs = 0;
+	if (maxInputs > MAX_REPLY_LINES) maxInputs = MAX_REPLY_LINES;
+	status = writeReadMultiLine(devName, "PR IS", "IS", lines, maxInputs < NUM_IS_LINES ? maxInputs : NUM_IS_LINES, &nlines, Lexium_TIMEOUT);
+	if (status) return status;
+
+	for (int j=0; j<nlines; j++) {
+		LexiumInputConfig *pConfig = &config[*numInputs];
+		if (sscanf(lines[j], "IS = %d, %d, %d", &pConfig->input, &pConfig->type, &pConfig->active) != 3) {
+			asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: bad reply line \"%s\"\n", DRIVER_NAME, functionName, lines[j]);
+			return asynError;
+		}
+		(*numInputs)++;
+	}
+	return asynSuccess;
 }
 
 ////////////////////////////////////////
@@ -206,6 +394,41 @@ LexiumMotorAxis* LexiumMotorController::getAxis(int axisNo)
 	return pAxes_[axisNo];
 }
 
+////////////////////////////////////////
+//! report()
+//! Override asynMotorController function, called by dbior
+//! level 1 adds the poll cycle and I/O counters, level 2 their distributions and the adaptive timeouts;
+//! the axes report after the controller, see LexiumMotorAxis::report()
+//
+//! @param[in] fp    output
+//! @param[in] level detail
+////////////////////////////////////////
+void LexiumMotorController::report(FILE *fp, int level)
+{
+	unsigned long transactions = readTime.count + writeTime.count;
+	static const char *classNames[NUM_COMMAND_CLASSES] = {"query", "write", "save"};
+
+	fprintf(fp, "Lexium controller %s%s%s%s%s\n", motorName, modbus ? ", Modbus/TCP" : "", pPollGroupEntry ? ", shared poller" : "",
+	        eventMode ? ", event mode" : "", probeDone ? "" : ", not probed yet");
+	if (level > 0) {
+		fprintf(fp, "  poll cycles %lu, overrun %lu, abandoned %lu, mean %.6f s, max %.6f s\n",
+		        cycleTime.count, pollOverruns, pollsAbandoned, cycleTime.mean(), cycleTime.max);
+		fprintf(fp, "  transactions %lu, %.2f per cycle, timeouts %lu, errors %lu, bytes out %lu, in %lu\n",
+		        transactions, cycleTime.count ? (double)transactions / cycleTime.count : 0, ioTimeouts, ioErrors, ioBytesOut, ioBytesIn);
+		if (faults.enabled()) faults.report(fp, "  faults");
+	}
+	if (level > 1) {
+		cycleTime.report(fp, "  poll cycle");
+		readTime.report(fp, "  query round trip");
+		writeTime.report(fp, "  write");
+		for (int i=0; i<NUM_COMMAND_CLASSES; i++) {
+			fprintf(fp, "  %s timeout %.3f s, srtt %.6f s, rttvar %.6f s, backoff %d\n", classNames[i],
+			        commandTimeout(i, Lexium_TIMEOUT), rtt[i].srtt, rtt[i].rttvar, rtt[i].backoff);
+		}
+	}
+	asynMotorController::report(fp, level);
+}
+
 ////////////////////////////////////////
 //! writeInt32()
 //! Override asynMotorController function to add hooks to Lexium records
@@ -239,6 +462,32 @@ asynStatus LexiumMotorController::writeInt32(asynUser *pasynUser, epicsInt32 val
 		} else {
 			asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: ERROR, value of 1 to save to NVM\n", DRIVER_NAME, functionName);
 		}
+	} else if (reason == LexiumCombinedPoll_) {
+		// re-enabling gives the combined query another chance after a firmware rejection
+		pAxis->combinedPollRejected = false;
+	} else if (reason == LexiumClearLock_) {
+		if (value == 1) {
+			status = pAxis->clearLockedRotor();
+			if (status == asynSuccess) wakeupPoller();
+		}
+		pAxis->setIntegerParam(reason, 0);
+	} else if (reason == LexiumEventMode_) {
+		status = setEventMode(value != 0);
+		if (status) pAxis->setIntegerParam(reason, eventMode ? 1 : 0);
+	} else if (reason == LexiumCaptureArm_) {
+		int mode = 0;
+		getIntegerParam(pAxis->axisNo_, LexiumCaptureMode_, &mode);
+		if (value) pAxis->armCapture(mode);
+		else pAxis->stopCapture();
+	} else if (reason == LexiumCaptureTrigger_) {
+		if (value == 1) pAxis->stopCapture();
+		pAxis->setIntegerParam(reason, 0);
+	} else if (reason == LexiumStreamVelocity_) {
+		if (value && !streamerStarted) {
+			epicsThreadCreate("LexiumStream", epicsThreadPriorityHigh, epicsThreadGetStackSize(epicsThreadStackSmall),
+							  (EPICSTHREADFUNC)LexiumVelocityStreamerC, (void *)this);
+			streamerStarted = true;
+		}
 	} else { // call base class method to continue handling
 			status = asynMotorController::writeInt32(pasynUser, value);
 	}
@@ -247,26 +496,617 @@ asynStatus LexiumMotorController::writeInt32(asynUser *pasynUser, epicsInt32 val
 	return (asynStatus)status;
 }
 
+////////////////////////////////////////
+//! readFloat64Array()
+//! Override asynMotorController function to read the capture buffer, oldest sample first,
+//! also while the capture is running
+//
+//! param[in] pasynUser pointer to asynUser object
+//! param[out] value     array to fill
+//! param[in] nElements size of value
+//! param[out] nIn      number of elements copied
+////////////////////////////////////////
+asynStatus LexiumMotorController::readFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements, size_t *nIn)
+{
+	int reason = pasynUser->reason;
+	LexiumMotorAxis *pAxis;
+
+	if (reason != LexiumCaptureTime_ && reason != LexiumCapturePosition_) {
+		return asynMotorController::readFloat64Array(pasynUser, value, nElements, nIn);
+	}
+	pAxis = getAxis(pasynUser);
+	if (!pAxis) return asynError;
+	*nIn = pAxis->capture.copy(reason == LexiumCaptureTime_ ? value : NULL, reason == LexiumCapturePosition_ ? value : NULL, NULL, NULL, nElements);
+	return asynSuccess;
+}
+
+////////////////////////////////////////
+//! readInt32Array()
+//! Override asynPortDriver function to read the capture buffer, see readFloat64Array()
+////////////////////////////////////////
+asynStatus LexiumMotorController::readInt32Array(asynUser *pasynUser, epicsInt32 *value, size_t nElements, size_t *nIn)
+{
+	int reason = pasynUser->reason;
+	LexiumMotorAxis *pAxis;
+
+	if (reason != LexiumCaptureMoving_ && reason != LexiumCaptureSwitches_) {
+		return asynMotorController::readInt32Array(pasynUser, value, nElements, nIn);
+	}
+	pAxis = getAxis(pasynUser);
+	if (!pAxis) return asynError;
+	*nIn = pAxis->capture.copy(NULL, NULL, reason == LexiumCaptureMoving_ ? value : NULL, reason == LexiumCaptureSwitches_ ? value : NULL, nElements);
+	return asynSuccess;
+}
+
+////////////////////////////////////////
+//! writeOctet()
+//! Override asynPortDriver function to load or clear the drive program
+//
+//! param[in] pasynUser pointer to asynUser object
+//! param[in] value     Lexium_LOADMCODE: program text or @fileName, Lexium_CLEARMCODE: ignored
+//! param[in] nChars    number of characters in value
+//! param[out] nActual  number of characters used
+////////////////////////////////////////
+asynStatus LexiumMotorController::writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual)
+{
+	int reason = pasynUser->reason;
+	asynStatus status = asynSuccess;
+	LexiumMotorAxis *pAxis;
+	char *text;
+	static const char *functionName = "writeOctet";
+
+	if (reason != LexiumLoadMCode_ && reason != LexiumClearMCode_) {
+		return asynMotorController::writeOctet(pasynUser, value, nChars, nActual);
+	}
+
+	pAxis = this->getAxis(pasynUser);
+	if (!pAxis) return asynError;
+	*nActual = nChars;
+
+	// value is not necessarily terminated
+	text = (char *)malloc(nChars + 1);
+	memcpy(text, value, nChars);
+	text[nChars] = '\0';
+	pAxis->setStringParam(reason, text);
+
+	if (eventMode) {
+		// the drive is running the event program
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: ERROR turn off Lexium_EVENTMODE before changing the program\n", DRIVER_NAME, functionName);
+		status = asynError;
+	} else if (modbus) {
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: ERROR programs can't be loaded with Modbus/TCP\n", DRIVER_NAME, functionName);
+		status = asynError;
+	} else if (reason == LexiumLoadMCode_) {
+		status = pAxis->loadMCode(text);
+	} else {
+		status = pAxis->clearMCode();
+	}
+	free(text);
+
+	callParamCallbacks(pAxis->axisNo_);
+	return status;
+}
+
+////////////////////////////////////////
+//! setEventMode()
+//! Start or stop the drive event program
+//! Starting loads lexiumEventProgram (replacing any program in the drive) and runs it with EX,
+//! eventListener() then wakes the poller as soon as the drive prints a motion event,
+//! stopping sends ESC, which ends the program.
+//! Not available in party mode, where unsolicited lines from several drives would collide on the link
+//
+//! @param[in] enable 1 to start, 0 to stop
+//! @return asynError in party mode, while an axis is moving, or if the drive reports an error
+////////////////////////////////////////
+asynStatus LexiumMotorController::setEventMode(int enable)
+{
+	asynStatus status;
+	LexiumMotorAxis *pAxis = getAxis(0);
+	static const char *functionName = "setEventMode()";
+
+	if ((enable != 0) == eventMode) return asynSuccess;
+	if (modbus) {
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: ERROR event mode is not available with Modbus/TCP\n", DRIVER_NAME, functionName);
+		return asynError;
+	}
+	if (pAxis->deviceName[0]) {
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: ERROR event mode is not available in party mode\n", DRIVER_NAME, functionName);
+		return asynError;
+	}
+	// the event program only starts from a stopped motor, and ESC would stop the motor
+	if (pAxis->lastMoving) {
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: ERROR can't change event mode while moving\n", DRIVER_NAME, functionName);
+		return asynError;
+	}
+
+	if (!enable) {
+		status = writeController(pAxis->deviceName, "\x1b", Lexium_TIMEOUT);
+		eventMode = false;
+		pasynOctetSyncIO->flush(pAsynUserLexium);
+		asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: event mode off\n", DRIVER_NAME, functionName);
+		return status;
+	}
+
+	status = pAxis->loadMCode(lexiumEventProgram);
+	if (status) return status;
+	status = writeController(pAxis->deviceName, "EX LE", Lexium_TIMEOUT);
+	if (status) return status;
+	eventMode = true;
+	status = pAxis->checkErrorCode("starting event program");
+	if (status) {
+		eventMode = false;
+		return status;
+	}
+
+	if (!eventListenerStarted) {
+		epicsThreadCreate("LexiumEvents", epicsThreadPriorityHigh, epicsThreadGetStackSize(epicsThreadStackSmall),
+						  (EPICSTHREADFUNC)LexiumEventListenerC, (void *)this);
+		eventListenerStarted = true;
+	}
+	epicsEventSignal(eventModeOn);
+	asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: event mode on\n", DRIVER_NAME, functionName);
+	return asynSuccess;
+}
+
+////////////////////////////////////////
+//! eventListener()
+//! Thread that reads event lines the drive prints while no command or poll is reading a reply
+//! (lines arriving during one are picked up by readReply() or readPollReply())
+//! Waits for a line on the poll lane with pollIOLock held and the controller lock released, like writeReadPoll(),
+//! in STOP_CHECK_PERIOD slices so a command or poll waiting in lockPollIO() gets the port between two lines;
+//! the controller lock is only taken to handle a line
+////////////////////////////////////////
+void LexiumMotorController::eventListener()
+{
+	char line[MAX_BUFF_LEN];
+	size_t nread, len;
+	int eomReason = 0;
+	bool isEvent;
+	static const char *functionName = "eventListener()";
+
+	for (;;) {
+		if (!eventMode) epicsEventWait(eventModeOn);
+		if (epicsAtomicGetIntT(&pollIOWaiting)) { // let the command or poll have the port first
+			epicsThreadSleep(STOP_CHECK_PERIOD);
+			continue;
+		}
+		epicsMutexLock(pollIOLock);
+		len = 0;
+		while (eventMode && len == 0 && !epicsAtomicGetIntT(&pollIOWaiting)) {
+			nread = 0;
+			eomReason = 0;
+			pasynOctetSyncIO->read(pAsynUserLexium, line, MAX_BUFF_LEN - 1, STOP_CHECK_PERIOD, &nread, &eomReason);
+			len = nread;
+		}
+		if (len > 0 && !(eomReason & ASYN_EOM_EOS)) {  // rest of the line is still on its way
+			nread = 0;
+			pasynOctetSyncIO->read(pAsynUserLexium, line + len, MAX_BUFF_LEN - 1 - len, Lexium_LINE_TIMEOUT, &nread, &eomReason);
+			len += nread;
+		}
+		line[len] = '\0';
+		isEvent = strncmp(line, EVENT_TAG, strlen(EVENT_TAG)) == 0;
+		if (len > 0 && !isEvent && staleReply) { // late reply to an abandoned poll query
+			staleReply = false;
+			len = 0;
+		}
+		epicsMutexUnlock(pollIOLock);
+		if (len == 0) continue;
+		if (!isEvent) {
+			asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: unexpected line \"%s\" dropped\n", DRIVER_NAME, functionName, line);
+			continue;
+		}
+		lock();
+		handleEvent(line);
+		unlock();
+	}
+}
+
+////////////////////////////////////////
+//! wakeStreamer()
+//! have velocityStreamer() send the jog velocities queued by LexiumMotorAxis::queueVelocity()
+////////////////////////////////////////
+void LexiumMotorController::wakeStreamer()
+{
+	epicsEventSignal(streamWakeup);
+}
+
+////////////////////////////////////////
+//! velocityStreamer()
+//! Thread that sends the newest queued jog velocity of each axis with Lexium_STREAMVELOCITY set
+//! Velocities queued while it waits for the lock or writes replace each other, so a feedback loop or
+//! joystick updating the jog speed faster than the link takes it never drives the motor from a stale value
+////////////////////////////////////////
+void LexiumMotorController::velocityStreamer()
+{
+	LexiumMotorAxis *pAxis;
+
+	for (;;) {
+		epicsEventWait(streamWakeup);
+		lock();
+		for (int i=0; i<numAxes_; i++) {
+			pAxis = getAxis(i);
+			if (pAxis && pAxis->streamPending) pAxis->sendQueuedVelocity();
+		}
+		unlock();
+	}
+}
+
+////////////////////////////////////////
+//! checkEvents()
+//! Read and handle every complete line waiting in the input buffer without blocking
+//! Only lines starting with EVENT_TAG are expected there, anything else is logged and dropped
+////////////////////////////////////////
+void LexiumMotorController::checkEvents()
+{
+	char line[MAX_BUFF_LEN];
+	size_t nread, len;
+	int eomReason;
+	static const char *functionName = "checkEvents()";
+
+	for (;;) {
+		nread = 0;
+		eomReason = 0;
+		pasynOctetSyncIO->read(pAsynUserLexium, line, MAX_BUFF_LEN - 1, 0, &nread, &eomReason);
+		if (nread == 0) break;
+		len = nread;
+		if (!(eomReason & ASYN_EOM_EOS)) {  // rest of the line is still on its way
+			nread = 0;
+			pasynOctetSyncIO->read(pAsynUserLexium, line + len, MAX_BUFF_LEN - 1 - len, Lexium_LINE_TIMEOUT, &nread, &eomReason);
+			len += nread;
+		}
+		line[len] = '\0';
+		if (strncmp(line, EVENT_TAG, strlen(EVENT_TAG)) == 0) {
+			handleEvent(line);
+		} else {
+			asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: unexpected line \"%s\" dropped\n", DRIVER_NAME, functionName, line);
+		}
+	}
+}
+
+////////////////////////////////////////
+//! handleEvent()
+//! Poll straight away after an event line from the drive
+//
+//! @param[in] line event line, EVENT_TAG followed by DONE, STALL or LIMIT
+////////////////////////////////////////
+void LexiumMotorController::handleEvent(const char *line)
+{
+	static const char *functionName = "handleEvent()";
+
+	asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: %s\n", DRIVER_NAME, functionName, line);
+	for (int i=0; i<numAxes_; i++) {
+		if (getAxis(i)) getAxis(i)->pollRequested = true;
+	}
+	wakeupPoller();
+}
+
+////////////////////////////////////////
+//! wakeupPoller()
+//! Override asynMotorController function to wake the shared poll group when this controller is in one
+////////////////////////////////////////
+asynStatus LexiumMotorController::wakeupPoller()
+{
+	if (pPollGroupEntry) {
+		LexiumPollGroup::getGroup()->wakeup(pPollGroupEntry);
+		return asynSuccess;
+	}
+	return asynMotorController::wakeupPoller();
+}
+
+////////////////////////////////////////
+//! poll()
+//! Override asynMotorController function, called by the poller before the axes are polled
+//! Reads the drives with LexiumMotorAxis::pollAxis(), LexiumMotorAxis::poll() then only reports the result
+//! Moving axes and axes that were just sent a motion command are read every cycle, idle axes in turn:
+//! all of them when nothing moves, otherwise one per cycle so they don't slow down the moving ones
+//! on a shared party mode link. The lock is given up between axes so motion commands go first,
+//! and while waiting for each reply, so a stop does not wait for the rest of the cycle: any command
+//! sent meanwhile abandons the cycle, see writeReadPoll().
+//! With Lexium_ADAPTIVEPOLL set, movingPollPeriod_ is then set for the next cycle from the predicted
+//! end of the moves in progress, never longer than Lexium_MAXPOLLPERIOD.
+//! In event mode the drive reports the end of a move, so moving axes are only polled every
+//! Lexium_MAXPOLLPERIOD for the position readback.
+//! Also publishes the I/O statistics every LEXIUM_IO_STATS_PERIOD seconds
+////////////////////////////////////////
+asynStatus LexiumMotorController::poll()
+{
+	LexiumMotorAxis *pAxis;
+	bool polled[MAX_AXES];
+	bool anyMoving = false;
+	int numPolled = 0;
+	int i;
+	int adaptive = 0;
+	double maxPeriod = DEFAULT_MAX_POLL_PERIOD;
+	double period;
+	double elapsed;
+	epicsTimeStamp cycleStart;
+
+	if (lexiumElapsed(&ioWindowStart) >= LEXIUM_IO_STATS_PERIOD) {
+		publishIOStats();
+		callParamCallbacks();
+	}
+
+	pollThread = epicsThreadGetIdSelf();
+	epicsAtomicSetIntT(&pollPreempted, 0);
+	epicsTimeGetCurrent(&cycleStart);
+
+	for (i=0; i<numAxes_; i++) polled[i] = false;
+	for (i=0; i<numAxes_ && !isPollPreempted(); i++) {
+		pAxis = getAxis(i);
+		if (!pAxis || !(pAxis->lastMoving || pAxis->pollRequested)) continue;
+		if (numPolled++) yieldLock();
+		pAxis->pollAxis();
+		polled[i] = true;
+		if (pAxis->lastMoving) anyMoving = true;
+	}
+
+	for (int n=0; n<numAxes_ && !isPollPreempted(); n++) {
+		i = nextIdleAxis;
+		nextIdleAxis = (nextIdleAxis + 1) % numAxes_;
+		pAxis = getAxis(i);
+		if (!pAxis || polled[i]) continue;
+		if (numPolled++) yieldLock();
+		pAxis->pollAxis();
+		if (anyMoving) break;
+	}
+
+	pollThread = NULL;
+	elapsed = lexiumElapsed(&cycleStart);
+	cycleTime.add(elapsed);
+	if (elapsed > (anyMoving ? movingPollPeriod_ : idlePollPeriod_)) pollOverruns++;
+	if (isPollPreempted()) pollsAbandoned++;
+
+	// period until the next cycle while something moves
+	getIntegerParam(LexiumAdaptivePoll_, &adaptive);
+	getDoubleParam(LexiumMaxPollPeriod_, &maxPeriod);
+	if (maxPeriod < fastPollPeriod) maxPeriod = fastPollPeriod;
+	period = fastPollPeriod;  // also used for the forced fast polls after a wakeup
+	for (i=0, anyMoving=false; i<numAxes_ && adaptive; i++) {
+		pAxis = getAxis(i);
+		if (!pAxis || !pAxis->lastMoving) continue;
+		double axisPeriod = pAxis->adaptivePollPeriod(fastPollPeriod, maxPeriod);
+		if (!anyMoving || axisPeriod < period) period = axisPeriod;
+		anyMoving = true;
+	}
+	if (eventMode) period = maxPeriod;
+	movingPollPeriod_ = period;
+	return asynSuccess;
+}
+
+////////////////////////////////////////
+//! yieldLock()
+//! release the controller lock for a moment inside a poll cycle,
+//! so a motion command waiting for it is sent before the next axis is read
+////////////////////////////////////////
+void LexiumMotorController::yieldLock()
+{
+	unlock();
+	epicsThreadSleep(0.0);
+	lock();
+}
+
+////////////////////////////////////////
+//! pollCycle()
+//! Poll the controller and all its axes once, one pass of asynMotorController::asynMotorPoller()
+//! Called by LexiumPollGroup worker threads
+//
+//! @param[in] forcedFast use the moving poll period whether or not an axis is moving
+//! @return time in seconds until the next poll, 0 to wait for wakeupPoller()
+////////////////////////////////////////
+double LexiumMotorController::pollCycle(bool forcedFast)
+{
+	bool anyMoving = false;
+	bool moving;
+	double period;
+	LexiumMotorAxis *pAxis;
+
+	lock();
+	poll();
+	for (int i=0; i<numAxes_; i++) {
+		pAxis = getAxis(i);
+		if (!pAxis) continue;
+		pAxis->poll(&moving);
+		if (moving) anyMoving = true;
+	}
+	period = (forcedFast || anyMoving) ? movingPollPeriod_ : idlePollPeriod_;
+	unlock();
+
+	return period;
+}
+
+////////////////////////////////////////
+//! recordIO()
+//! add one transaction to the I/O statistics
+//
+//! @param[in] hist     histogram for this kind of transaction
+//! @param[in] start    time the transaction was started
+//! @param[in] status   asyn status of the transaction
+//! @param[in] bytesOut characters written
+//! @param[in] bytesIn  characters read
+////////////////////////////////////////
+void LexiumMotorController::recordIO(LexiumHistogram *hist, const epicsTimeStamp *start, asynStatus status, size_t bytesOut, size_t bytesIn)
+{
+	double elapsed = lexiumElapsed(start);
+
+	hist->add(elapsed);
+	ioWindow.add(elapsed);
+	ioBytesOut += bytesOut;
+	ioBytesIn += bytesIn;
+	if (status == asynTimeout) ioTimeouts++;
+	else if (status) ioErrors++;
+}
+
+////////////////////////////////////////
+//! commandTimeout()
+//! adaptive timeout of a command class: smoothed round trip time plus four times its mean deviation,
+//! between Lexium_TIMEOUTFLOOR and Lexium_TIMEOUTCEILING, doubled by each timeout until the next reply
+//
+//! @param[in] cmdClass   LexiumCommandClass
+//! @param[in] maxTimeout timeout given by the caller, never exceeded
+//! @return timeout in seconds
+////////////////////////////////////////
+double LexiumMotorController::commandTimeout(int cmdClass, double maxTimeout)
+{
+	double floor = DEFAULT_TIMEOUT_FLOOR;
+	double ceiling = Lexium_TIMEOUT;
+	double timeout;
+
+	getDoubleParam(LexiumTimeoutFloor_, &floor);
+	getDoubleParam(LexiumTimeoutCeiling_, &ceiling);
+	timeout = rtt[cmdClass].timeout(floor, ceiling);
+	return timeout < maxTimeout ? timeout : maxTimeout;
+}
+
+////////////////////////////////////////
+//! recordRtt()
+//! update the round trip time estimate of a command class, see commandTimeout()
+//
+//! @param[in] cmdClass LexiumCommandClass
+//! @param[in] start    time the command was written
+//! @param[in] status   asyn status of the transaction
+////////////////////////////////////////
+void LexiumMotorController::recordRtt(int cmdClass, const epicsTimeStamp *start, asynStatus status)
+{
+	if (status == asynSuccess) rtt[cmdClass].add(lexiumElapsed(start));
+	else if (status == asynTimeout) rtt[cmdClass].timedOut();
+}
+
+////////////////////////////////////////
+//! commandAxis()
+//! find the axis a command is for from its device name prefix
+//
+//! @param[in] cmd command including device name
+//! @return the axis, NULL if no axis has that device name
+////////////////////////////////////////
+LexiumMotorAxis* LexiumMotorController::commandAxis(const LexiumCommand &cmd)
+{
+	LexiumMotorAxis *pAxis;
+	size_t prefixLen = cmd.body() - cmd.c_str();
+
+	for (int i=0; i<numAxes_; i++) {
+		pAxis = getAxis(i);
+		if (pAxis && strlen(pAxis->deviceName) == prefixLen && !strncmp(pAxis->deviceName, cmd.c_str(), prefixLen)) return pAxis;
+	}
+	return NULL;
+}
+
+////////////////////////////////////////
+//! linkResult()
+//! count the result of a transaction against the axis's link, see LexiumLink.h
+//
+//! @param[in] pAxis  axis the command was for, may be NULL
+//! @param[in] status asyn status of the transaction
+////////////////////////////////////////
+void LexiumMotorController::linkResult(LexiumMotorAxis *pAxis, asynStatus status)
+{
+	int maxTimeouts = DEFAULT_LINK_TIMEOUTS;
+	static const char *functionName = "linkResult()";
+
+	faults.transactionDone(status);
+	if (!pAxis) return;
+	if (status != asynSuccess) getIntegerParam(pAxis->axisNo_, LexiumLinkTimeouts_, &maxTimeouts);
+	if (!pAxis->link.addResult(status, maxTimeouts)) return;
+
+	asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: axis %d not answering after %d timeouts, link down\n", motorName, functionName, pAxis->axisNo_, maxTimeouts);
+	pAxis->setIntegerParam(LexiumLinkUp_, 0);
+	pAxis->setIntegerParam(motorStatusCommsError_, 1);
+	pAxis->setIntegerParam(motorStatusProblem_, 1);
+}
+
+////////////////////////////////////////
+//! publishIOStats()
+//! copy the I/O statistics of the last period to the Lexium_IO* parameters and start a new period
+////////////////////////////////////////
+void LexiumMotorController::publishIOStats()
+{
+	setDoubleParam(LexiumIORttMin_, ioWindow.min);
+	setDoubleParam(LexiumIORttMean_, ioWindow.mean());
+	setDoubleParam(LexiumIORttP99_, ioWindow.percentile(0.99));
+	setDoubleParam(LexiumIORttMax_, ioWindow.max);
+	setIntegerParam(LexiumIOCount_, (int)ioWindow.count);
+	setIntegerParam(LexiumIOTimeouts_, (int)ioTimeouts);
+	setIntegerParam(LexiumIOErrors_, (int)ioErrors);
+	setDoubleParam(LexiumRttQuery_, rtt[lexiumClassQuery].srtt);
+	setDoubleParam(LexiumRttWrite_, rtt[lexiumClassWrite].srtt);
+	setDoubleParam(LexiumRttSave_, rtt[lexiumClassSave].srtt);
+	setDoubleParam(LexiumTimeoutQuery_, commandTimeout(lexiumClassQuery, Lexium_TIMEOUT));
+	setDoubleParam(LexiumTimeoutWrite_, commandTimeout(lexiumClassWrite, Lexium_TIMEOUT));
+	setDoubleParam(LexiumTimeoutSave_, commandTimeout(lexiumClassSave, Lexium_TIMEOUT));
+	ioWindow.reset();
+	epicsTimeGetCurrent(&ioWindowStart);
+}
+
+////////////////////////////////////////
+//! resetStats()
+//! clear I/O statistics of the controller and poll/move statistics of its axes
+////////////////////////////////////////
+void LexiumMotorController::resetStats()
+{
+	readTime.reset();
+	writeTime.reset();
+	ioTimeouts = 0;
+	ioErrors = 0;
+	ioBytesOut = 0;
+	ioBytesIn = 0;
+	cycleTime.reset();
+	pollOverruns = 0;
+	pollsAbandoned = 0;
+	for (int i=0; i<numAxes_; i++) {
+		if (getAxis(i)) getAxis(i)->resetStats();
+	}
+}
+
 ////////////////////////////////////////
 //! writeController()
 //! reference ACRMotorDriver
 //
 //! Writes a string to the Lexium controller.
-//! Prepends deviceName to command string, if party mode not enabled, set device name to ""
+//! Prepends devName to command string, if party mode not enabled, set device name to ""
+//! @param[in] devName device name of the axis
 //! @param[in] output the string to be written.
 //! @param[in] timeout Timeout before returning an error.
 ////////////////////////////////////////
-asynStatus LexiumMotorController::writeController(const char *output, double timeout)
+asynStatus LexiumMotorController::writeController(const char *devName, const char *output, double timeout)
 {
-	size_t nwrite;
+	LexiumCommand cmd(devName);
+
+	cmd.appendString(output);
+	return writeController(cmd, timeout);
+}
+
+////////////////////////////////////////
+//! writeController()
+//! Writes a command built with LexiumCommand, device name included, to the Lexium controller.
+//! A command that overflowed its buffer is not sent.
+//! @param[in] cmd the command
+//! @param[in] timeout Timeout before returning an error.
+////////////////////////////////////////
+asynStatus LexiumMotorController::writeController(const LexiumCommand &cmd, double timeout)
+{
+	size_t nwrite = 0;
 	asynStatus status;
-	char outbuff[MAX_BUFF_LEN];
+	LexiumMotorAxis *pAxis;
+	epicsTimeStamp start;
 	static const char *functionName = "writeController()";
 
-	// in party-mode Line Feed must follow command string
-	sprintf(outbuff, "%s%s", deviceName, output);
-	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: deviceName=%s, command=%s\n", DRIVER_NAME, functionName, deviceName, outbuff);
-	status = pasynOctetSyncIO->write(pAsynUserLexium, outbuff, strlen(outbuff), timeout, &nwrite);
+	if (!cmd.ok()) {
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: ERROR command longer than %d characters: %s...\n", DRIVER_NAME, functionName, (int)cmd.capacity(), cmd.c_str());
+		return asynError;
+	}
+	pAxis = commandAxis(cmd);
+	if (pAxis && !pAxis->link.allowIO()) return asynDisconnected;
+	timeout = commandTimeout(lexiumClassWrite, timeout);
+
+	// in party-mode Line Feed must follow command string, set as output EOS in the constructor
+	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: command=%s\n", DRIVER_NAME, functionName, cmd.c_str());
+	epicsTimeGetCurrent(&start);
+	beginIO(false);  // no reply to wait for, goes out even while a poll waits for its reply
+	status = ioWrite(pAsynUserCommand, cmd.c_str(), cmd.length(), timeout, &nwrite, false);
+	recordIO(&writeTime, &start, status, nwrite, 0);
+	recordRtt(lexiumClassWrite, &start, status);
+	recorder.add(&start, cmd.c_str(), NULL, status);
+	if (status) linkResult(pAxis, status);  // a write that goes out doesn't mean the drive is there
+	else if (pAxis && lexiumSlowCommand(cmd.body())) pAxis->slowReplyDue = true;
 	if (status) { // update comm flag
 		setIntegerParam(this->motorStatusCommsError_, 1);
 	}
@@ -278,59 +1118,633 @@ asynStatus LexiumMotorController::writeController(const char *output, double tim
 //! reference ACRMotorDriver
 //
 //! Writes a string to the Lexium controller and reads a response.
-//! Prepends deviceName to command string, if party mode not enabled, set device name to ""
+//! Prepends devName to command string, if party mode not enabled, set device name to ""
+//! param[in] devName device name of the axis
 //! param[in] output Pointer to the output string.
 //! param[out] input Pointer to the input string location.
 //! param[in] maxChars Size of the input buffer.
 //! param[out] nread Number of characters read.
 //! param[out] timeout Timeout before returning an error.*/
 ////////////////////////////////////////
-asynStatus LexiumMotorController::writeReadController(const char *output, char *input, size_t maxChars, size_t *nread, double timeout)
+asynStatus LexiumMotorController::writeReadController(const char *devName, const char *output, char *input, size_t maxChars, size_t *nread, double timeout)
+{
+	LexiumCommand cmd(devName);
+
+	cmd.appendString(output);
+	return writeReadController(cmd, input, maxChars, nread, timeout);
+}
+
+////////////////////////////////////////
+//! writeReadController()
+//! Writes a command built with LexiumCommand, device name included, and reads a response.
+//! A command that overflowed its buffer is not sent.
+//! param[in] cmd the command
+//! param[out] input Pointer to the input string location.
+//! param[in] maxChars Size of the input buffer.
+//! param[out] nread Number of characters read.
+//! param[out] timeout Timeout before returning an error.*/
+////////////////////////////////////////
+asynStatus LexiumMotorController::writeReadController(const LexiumCommand &cmd, char *input, size_t maxChars, size_t *nread, double timeout)
 {
 	size_t nwrite;
 	asynStatus status;
+	LexiumMotorAxis *pAxis;
+	int cmdClass;
+	epicsTimeStamp start;
 	int eomReason;
-	char outbuff[MAX_BUFF_LEN];
 	static const char *functionName = "writeReadController()";
 
-	sprintf(outbuff, "%s%s", deviceName, output);
-	status = pasynOctetSyncIO->writeRead(pAsynUserLexium, outbuff, strlen(outbuff), input, maxChars, timeout, &nwrite, nread, &eomReason);
+	if (!cmd.ok()) {
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: ERROR command longer than %d characters: %s...\n", DRIVER_NAME, functionName, (int)cmd.capacity(), cmd.c_str());
+		*nread = 0;
+		if (maxChars) input[0] = '\0';
+		return asynError;
+	}
+	pAxis = commandAxis(cmd);
+	if (pAxis && !pAxis->link.allowIO()) {
+		*nread = 0;
+		if (maxChars) input[0] = '\0';
+		return asynDisconnected;
+	}
+	cmdClass = (pAxis && pAxis->slowReplyDue) ? lexiumClassSave : lexiumClassQuery;
+	timeout = commandTimeout(cmdClass, timeout);
+
+	if (pollThread && pollThread == epicsThreadGetIdSelf()) {
+		status = writeReadPoll(cmd, input, maxChars, nread, timeout, cmdClass);
+		if (isPollPreempted()) return status;
+		linkResult(pAxis, status);
+		if (pAxis && status == asynSuccess) pAxis->slowReplyDue = false;
+		return status;
+	}
+
+	*nread = 0;
+	beginIO(true);
+	epicsTimeGetCurrent(&start);  // after any wait for the poll's reply
+	if (eventMode) {
+		status = writeReadRaw(cmd, input, maxChars, nread, timeout);
+	} else {
+		status = ioWriteRead(pAsynUserCommand, cmd.c_str(), cmd.length(), input, maxChars, timeout, &nwrite, nread, &eomReason);
+	}
+	endIO(true);
+	recordIO(&readTime, &start, status, cmd.length(), *nread);
+	recordRtt(cmdClass, &start, status);
+	recorder.add(&start, cmd.c_str(), status ? NULL : input, status);
+	linkResult(pAxis, status);
+	if (pAxis && status == asynSuccess) pAxis->slowReplyDue = false;
 	if (status) { // update comm flag
 		setIntegerParam(this->motorStatusCommsError_, 1);
 	}
-	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: deviceName=%s, command=%s, response=%s\n", DRIVER_NAME, functionName, deviceName, outbuff, input);
+	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: command=%s, response=%s\n", DRIVER_NAME, functionName, cmd.c_str(), input);
 	return status;
 }
 
 ////////////////////////////////////////
-//! writeReadController2()
-//! Writes a string to the Lexium controller and reads a response.
-//! Differing from writeReadController() is IEOS is now set to ""(NULL)
-//! This is to get correct read from controller for "PR IS" command,
-//! which has multi-line IS = 1,0,1\r\nIS=2,2,1 ... 
-//! with IEOS set to \r\n, only the first line is read
+//! writeReadMultiLine()
+//! Send a command and read a reply made of several \r\n terminated lines, e.g. PR IS
+//! Reading stops as soon as maxLines lines starting with linePrefix have arrived, at the first
+//! line that doesn't start with it (prompt or error), or when no further line arrives within
+//! Lexium_LINE_TIMEOUT, so the call returns as soon as the drive has answered
+//
+//! @param[in]  devName    device name of the axis
+//! @param[in]  output     command string without device name
+//! @param[in]  linePrefix lines of the reply start with this
+//! @param[out] lines      reply lines without terminator
+//! @param[in]  maxLines   expected number of lines, at most MAX_REPLY_LINES
+//! @param[out] nlines     number of lines read
+//! @param[in]  timeout    timeout for the first line
+//! @return asynSuccess if at least one line was read
+////////////////////////////////////////
+asynStatus LexiumMotorController::writeReadMultiLine(const char *devName, const char *output, const char *linePrefix, char lines[][MAX_BUFF_LEN], int maxLines, int *nlines, double timeout)
+{
+	size_t nwrite, nread;
+	asynStatus status;
+	epicsTimeStamp start;
+	int eomReason;
+	LexiumCommand cmd(devName);
+	LexiumMotorAxis *pAxis;
+	size_t bytesIn = 0;
+	size_t prefixLen = strlen(linePrefix);
+	static const char *functionName = "writeReadMultiLine()";
+
+	*nlines = 0;
+	if (maxLines > MAX_REPLY_LINES) maxLines = MAX_REPLY_LINES;
+	if (!cmd.appendString(output).ok()) return asynError;
+	pAxis = commandAxis(cmd);
+	if (pAxis && !pAxis->link.allowIO()) return asynDisconnected;
+	timeout = commandTimeout(lexiumClassQuery, timeout);  // first line only, further lines come at the drive's pace
+	beginIO(true);
+	epicsTimeGetCurrent(&start);
+	if (eventMode) {
+		status = writeReadRaw(cmd, lines[0], MAX_BUFF_LEN - 1, &nread, timeout);
+	} else {
+		status = ioWriteRead(pAsynUserCommand, cmd.c_str(), cmd.length(), lines[0], MAX_BUFF_LEN - 1, timeout, &nwrite, &nread, &eomReason);
+	}
+	while (status == asynSuccess) {
+		bytesIn += nread;
+		lines[*nlines][nread] = 0;
+		asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: command=%s, line %d=%s\n", DRIVER_NAME, functionName, cmd.c_str(), *nlines, lines[*nlines]);
+		if (strncmp(lines[*nlines], linePrefix, prefixLen)) break;  // prompt or error, not part of the reply
+		if (++(*nlines) >= maxLines) break;
+		status = eventMode ? readReply(lines[*nlines], MAX_BUFF_LEN - 1, &nread, Lexium_LINE_TIMEOUT)
+		                   : ioRead(pAsynUserCommand, lines[*nlines], MAX_BUFF_LEN - 1, Lexium_LINE_TIMEOUT, &nread, &eomReason);
+	}
+	endIO(true);
+	linkResult(pAxis, *nlines > 0 ? asynSuccess : status);
+	if (*nlines == 0) recordRtt(lexiumClassQuery, &start, status);
+	// a timeout after the first line just means the drive had fewer lines to send
+	if (*nlines > 0 && status == asynTimeout) status = asynSuccess;
+	else if (*nlines == 0 && status == asynSuccess) status = asynError;
+	recordIO(&readTime, &start, status, cmd.length(), bytesIn);
+	recorder.add(&start, cmd.c_str(), *nlines ? lines[0] : NULL, status);
+	if (status) { // update comm flag
+		setIntegerParam(this->motorStatusCommsError_, 1);
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: command=%s, no reply\n", DRIVER_NAME, functionName, cmd.c_str());
+	}
+	return status;
+}
+
 ////////////////////////////////////////
-asynStatus LexiumMotorController::writeReadController2(const char *output, char *input, size_t maxChars, size_t *nread, double timeout)
+//! writeReadRaw()
+//! writeRead() for event mode: event lines waiting in the input buffer are handled
+//! instead of being flushed, and event lines arriving before the reply are skipped
+//
+//! param[in] cmd command including device name
+//! param[out] input reply
+//! param[in] maxChars size of input
+//! param[out] nread number of characters read
+//! param[in] timeout timeout for the write and for the reply
+////////////////////////////////////////
+asynStatus LexiumMotorController::writeReadRaw(const LexiumCommand &cmd, char *input, size_t maxChars, size_t *nread, double timeout)
 {
 	size_t nwrite;
 	asynStatus status;
+
+	checkEvents();
+	status = ioWrite(pAsynUserCommand, cmd.c_str(), cmd.length(), timeout, &nwrite, true);
+	if (status) return status;
+	return readReply(input, maxChars, nread, timeout);
+}
+
+////////////////////////////////////////
+//! readReply()
+//! read one reply line, handling any event lines that come first
+//
+//! param[out] input reply
+//! param[in] maxChars size of input
+//! param[out] nread number of characters read
+//! param[in] timeout timeout for each line
+////////////////////////////////////////
+asynStatus LexiumMotorController::readReply(char *input, size_t maxChars, size_t *nread, double timeout)
+{
+	asynStatus status;
 	int eomReason;
-	char outbuff[MAX_BUFF_LEN];
-	static const char *functionName = "writeReadController2()";
-     
-    pasynOctetSyncIO->setInputEos(pAsynUserLexium, "", 0);
-	
-    sprintf(outbuff, "%s%s", deviceName, output);
-	status = pasynOctetSyncIO->writeRead(pAsynUserLexium, outbuff, strlen(outbuff), input, maxChars, timeout, &nwrite, nread, &eomReason);
+
+	for (;;) {
+		status = ioRead(pAsynUserCommand, input, maxChars, timeout, nread, &eomReason);
+		if (status) return status;
+		if (strncmp(input, EVENT_TAG, strlen(EVENT_TAG))) return asynSuccess;
+		handleEvent(input);
+	}
+}
+
+////////////////////////////////////////
+//! writeReadPoll()
+//! writeReadController() for the poll thread: the controller lock is released while the reply is
+//! awaited, so stop() and other commands don't queue behind a slow or unanswered query.
+//! A command sent meanwhile sets pollPreempted; the wait is then abandoned within STOP_CHECK_PERIOD
+//! and the rest of the poll cycle is skipped, since its results may predate the command.
+//! The reply of the abandoned query is dropped before the next read.
+//
+//! param[in] cmd command including device name
+//! param[out] input reply
+//! param[in] maxChars size of input
+//! param[out] nread number of characters read
+//! param[in] timeout timeout for the write and for the reply
+////////////////////////////////////////
+asynStatus LexiumMotorController::writeReadPoll(const LexiumCommand &cmd, char *input, size_t maxChars, size_t *nread, double timeout, int cmdClass)
+{
+	size_t nwrite = 0;
+	asynStatus status;
+	epicsTimeStamp start;
+	char eventLine[MAX_BUFF_LEN];
+	static const char *functionName = "writeReadPoll()";
+
+	*nread = 0;
+	if (maxChars) input[0] = '\0';
+	if (isPollPreempted()) return asynError;  // rest of the cycle is skipped
+
+	lockPollIO();
+	if (staleReply) drainStaleReply();
+	if (eventMode) checkEvents();
+	else pasynOctetSyncIO->flush(pAsynUserLexium);
+	epicsTimeGetCurrent(&start);
+	eventLine[0] = '\0';
+	pollUnlocked = true;
+	unlock();
+
+	status = ioWrite(pAsynUserLexium, cmd.c_str(), cmd.length(), timeout, &nwrite, true);
+	if (status == asynSuccess) status = readPollReply(input, maxChars, nread, timeout, eventLine);
+
+	epicsMutexUnlock(pollIOLock);
+	lock();
+	pollUnlocked = false;
+
+	recorder.add(&start, cmd.c_str(), status ? NULL : input, isPollPreempted() ? asynError : status);
+	if (eventLine[0]) handleEvent(eventLine);
+	if (isPollPreempted()) {
+		asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: command=%s abandoned for a command from another thread\n", DRIVER_NAME, functionName, cmd.c_str());
+		return asynError;
+	}
+	recordIO(&readTime, &start, status, nwrite, *nread);
+	recordRtt(cmdClass, &start, status);
 	if (status) { // update comm flag
 		setIntegerParam(this->motorStatusCommsError_, 1);
 	}
-	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: deviceName=%s, command=%s, response=%s\n", DRIVER_NAME, functionName, deviceName, outbuff, input);
-   
-  // revert back IEOS to \r\n:
-    pasynOctetSyncIO->setInputEos(pAsynUserLexium, "\r\n", 2);
-	
-    return status;
+	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: command=%s, response=%s\n", DRIVER_NAME, functionName, cmd.c_str(), input);
+	return status;
+}
+
+////////////////////////////////////////
+//! readPollReply()
+//! read one reply line in STOP_CHECK_PERIOD slices, checking pollPreempted between them
+//! Called without the controller lock, so an event line is only copied to eventLine
+//
+//! param[out] input reply
+//! param[in] maxChars size of input
+//! param[out] nread number of characters read
+//! param[in] timeout timeout for the reply
+//! param[out] eventLine last event line read before the reply, left alone if none
+////////////////////////////////////////
+asynStatus LexiumMotorController::readPollReply(char *input, size_t maxChars, size_t *nread, double timeout, char *eventLine)
+{
+	asynStatus status = asynTimeout;
+	epicsTimeStamp start;
+	size_t len = 0, n;
+	int eomReason;
+	double remaining;
+
+	if (maxChars < 2) return asynError;
+	epicsTimeGetCurrent(&start);
+	while (!isPollPreempted()) {
+		remaining = timeout - lexiumElapsed(&start);
+		if (remaining <= 0) {
+			status = asynTimeout;
+			break;
+		}
+		n = 0;
+		eomReason = 0;
+		status = ioRead(pAsynUserLexium, input + len, maxChars - 1 - len, remaining < STOP_CHECK_PERIOD ? remaining : STOP_CHECK_PERIOD, &n, &eomReason);
+		len += n;
+		input[len] = '\0';
+		if (status == asynTimeout) continue;  // nothing yet, or the rest of the line is still on its way
+		if (status) break;
+		if (!(eomReason & ASYN_EOM_EOS) && len < maxChars - 1) continue;
+		if (eventMode && strncmp(input, EVENT_TAG, strlen(EVENT_TAG)) == 0) {
+			strncpy(eventLine, input, MAX_BUFF_LEN - 1);
+			eventLine[MAX_BUFF_LEN - 1] = '\0';
+			len = 0;
+			continue;
+		}
+		*nread = len;
+		return asynSuccess;
+	}
+	// the reply, or the rest of it, may still come
+	if (isPollPreempted()) {
+		staleReply = true;
+		staleReplyDeadline = start;
+		epicsTimeAddSeconds(&staleReplyDeadline, timeout);
+	}
+	*nread = len;
+	return status ? status : asynError;
+}
+
+////////////////////////////////////////
+//! beginIO()
+//! start a transaction from any thread but the poll lane: a poll waiting for its reply is abandoned,
+//! and a transaction that reads a reply first waits until it has been, so it can't take the poll's reply
+//
+//! @param[in] reading the transaction reads a reply
+////////////////////////////////////////
+void LexiumMotorController::beginIO(bool reading)
+{
+	if (pollUnlocked) epicsAtomicSetIntT(&pollPreempted, 1);
+	if (!reading) return;
+	lockPollIO();
+	if (staleReply) drainStaleReply();
+}
+
+////////////////////////////////////////
+//! lockPollIO()
+//! take pollIOLock to read a reply, eventListener() gives it up as soon as it is between two event lines
+////////////////////////////////////////
+void LexiumMotorController::lockPollIO()
+{
+	epicsAtomicIncrIntT(&pollIOWaiting);
+	epicsMutexLock(pollIOLock);
+	epicsAtomicDecrIntT(&pollIOWaiting);
+}
+
+////////////////////////////////////////
+//! endIO()
+//! end of a transaction started with beginIO()
+//
+//! @param[in] reading as passed to beginIO()
+////////////////////////////////////////
+void LexiumMotorController::endIO(bool reading)
+{
+	if (reading) epicsMutexUnlock(pollIOLock);
+}
+
+////////////////////////////////////////
+//! drainStaleReply()
+//! drop the late reply to an abandoned poll query, waiting for it until the query itself would have timed out,
+//! so a slow reply (e.g. after S) can't be taken for the answer to the next query
+//! Called with pollIOLock held
+////////////////////////////////////////
+void LexiumMotorController::drainStaleReply()
+{
+	char line[MAX_BUFF_LEN];
+	size_t nread;
+	int eomReason;
+	double remaining;
+
+	staleReply = false;
+	for (;;) {
+		remaining = -lexiumElapsed(&staleReplyDeadline);
+		nread = 0;
+		pasynOctetSyncIO->read(pAsynUserLexium, line, MAX_BUFF_LEN - 1, remaining > 0 ? remaining : 0, &nread, &eomReason);
+		line[nread] = '\0';
+		if (!(eventMode && nread && strncmp(line, EVENT_TAG, strlen(EVENT_TAG)) == 0)) break;
+		handleEvent(line);  // the reply is still to come
+	}
+}
+
+////////////////////////////////////////
+//! ioWrite()
+//! write a command to the IO port through the fault injector, see LexiumInjectFault()
+//
+//! @param[in]  pasynUser pAsynUserLexium for the poll lane, pAsynUserCommand otherwise
+//! @param[in]  output  command
+//! @param[in]  len     command length
+//! @param[in]  timeout timeout for the write
+//! @param[out] nwrite  number of characters written
+//! @param[in]  reply   a reply is read with ioRead() next, the reply faults apply to it
+////////////////////////////////////////
+asynStatus LexiumMotorController::ioWrite(asynUser *pasynUser, const char *output, size_t len, double timeout, size_t *nwrite, bool reply)
+{
+	int hit;
+
+	if (!faults.enabled()) return pasynOctetSyncIO->write(pasynUser, output, len, timeout, nwrite);
+
+	hit = faults.draw(output, len, reply);
+	if (hit) asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s: injecting fault 0x%x\n", motorName, hit);
+	if ((hit & FAULT_BIT(lexiumFaultClose)) && pAsynUserCommon) pasynCommonSyncIO->disconnectDevice(pAsynUserCommon);
+	if (!reply && (hit & FAULT_BIT(lexiumFaultLatency))) epicsThreadSleep(faults.latency);
+	return pasynOctetSyncIO->write(pasynUser, output, len, timeout, nwrite);
+}
+
+////////////////////////////////////////
+//! ioRead()
+//! read from the IO port through the fault injector: the reply is held back, dropped or
+//! corrupted as drawn by the last ioWrite() with reply
+//
+//! @param[in]  pasynUser pAsynUserLexium for the poll lane, pAsynUserCommand otherwise
+//! @param[out] input     reply
+//! @param[in]  maxChars  size of input
+//! @param[in]  timeout   timeout for this read
+//! @param[out] nread     number of characters read
+//! @param[out] eomReason as returned by the IO port
+////////////////////////////////////////
+asynStatus LexiumMotorController::ioRead(asynUser *pasynUser, char *input, size_t maxChars, double timeout, size_t *nread, int *eomReason)
+{
+	asynStatus status;
+	epicsTimeStamp start, now;
+	double wait;
+	int active;
+
+	if (!faults.enabled() || !(active = faults.pending())) return pasynOctetSyncIO->read(pasynUser, input, maxChars, timeout, nread, eomReason);
+
+	*nread = 0;
+	if (active & FAULT_BIT(lexiumFaultLatency)) { // still on its way, the caller may read again
+		epicsTimeGetCurrent(&now);
+		wait = epicsTimeDiffInSeconds(&faults.latencyEnd, &now);
+		if (wait > timeout) {
+			epicsThreadSleep(timeout);
+			return asynTimeout;
+		}
+		if (wait > 0) {
+			epicsThreadSleep(wait);
+			timeout -= wait;
+		}
+		faults.applied(FAULT_BIT(lexiumFaultLatency));
+	}
+
+	epicsTimeGetCurrent(&start);
+	status = pasynOctetSyncIO->read(pasynUser, input, maxChars, timeout, nread, eomReason);
+	if (active & FAULT_BIT(lexiumFaultDrop)) { // lost, silence until the reader gives up
+		if (status != asynSuccess && status != asynTimeout) return status;
+		wait = timeout - lexiumElapsed(&start);
+		if (wait > 0) epicsThreadSleep(wait);
+		*nread = 0;
+		if (maxChars) input[0] = '\0';
+		return asynTimeout;
+	}
+	if (status != asynSuccess) return status;
+
+	if (active & FAULT_BIT(lexiumFaultTruncate)) {
+		*nread /= 2;
+	} else if (active & FAULT_BIT(lexiumFaultEcho)) {
+		*nread = faults.echoLen < maxChars ? faults.echoLen : maxChars;
+		memcpy(input, faults.echo, *nread);
+	} else if (active & FAULT_BIT(lexiumFaultPrompt)) {
+		*nread = maxChars ? 1 : 0;
+		if (maxChars) input[0] = '?';
+	}
+	if (*nread < maxChars) input[*nread] = '\0';
+	faults.applied(active);  // reply delivered
+	return status;
+}
+
+////////////////////////////////////////
+//! ioWriteRead()
+//! pasynOctetSyncIO->writeRead() through the fault injector
+////////////////////////////////////////
+asynStatus LexiumMotorController::ioWriteRead(asynUser *pasynUser, const char *output, size_t len, char *input, size_t maxChars, double timeout, size_t *nwrite, size_t *nread, int *eomReason)
+{
+	asynStatus status;
+
+	if (!faults.enabled()) return pasynOctetSyncIO->writeRead(pasynUser, output, len, input, maxChars, timeout, nwrite, nread, eomReason);
+
+	*nread = 0;
+	pasynOctetSyncIO->flush(pasynUser);
+	status = ioWrite(pasynUser, output, len, timeout, nwrite, true);
+	if (status == asynSuccess) status = ioRead(pasynUser, input, maxChars, timeout, nread, eomReason);
+	return status;
+}
+
+////////////////////////////////////////
+//! readRegisters()
+//! read holding registers of a drive on the Modbus/TCP transport
+//
+//! @param[in]  pAxis   axis the registers belong to
+//! @param[in]  addr    first register, see LexiumModbus.h
+//! @param[in]  count   number of registers, at most LEXIUM_MB_MAX_REGS
+//! @param[out] values  register values
+//! @param[in]  timeout longest wait for the response
+////////////////////////////////////////
+asynStatus LexiumMotorController::readRegisters(LexiumMotorAxis *pAxis, int addr, int count, epicsUInt16 *values, double timeout)
+{
+	unsigned char request[LEXIUM_MB_MAX_FRAME];
+	size_t len;
+
+	len = lexiumModbusReadRequest(request, ++modbusTid, addr, count);
+	return modbusTransaction(pAxis, request, len, values, timeout, lexiumClassQuery);
+}
+
+////////////////////////////////////////
+//! writeRegisters()
+//! write holding registers of a drive on the Modbus/TCP transport; the drive acknowledges the write
+//! or answers with an exception, so no PR ER is needed to find out whether it was accepted
+//
+//! @param[in] pAxis   axis the registers belong to
+//! @param[in] addr    first register, see LexiumModbus.h
+//! @param[in] values  register values
+//! @param[in] count   number of registers, at most LEXIUM_MB_MAX_REGS
+//! @param[in] timeout longest wait for the response
+////////////////////////////////////////
+asynStatus LexiumMotorController::writeRegisters(LexiumMotorAxis *pAxis, int addr, const epicsUInt16 *values, int count, double timeout)
+{
+	unsigned char request[LEXIUM_MB_MAX_FRAME];
+	size_t len;
+	// the drive acknowledges S once it has written its flash
+	int cmdClass = (addr == LEXIUM_MB_S) ? lexiumClassSave : lexiumClassQuery;
+
+	len = lexiumModbusWriteRequest(request, ++modbusTid, addr, values, count);
+	return modbusTransaction(pAxis, request, len, NULL, timeout, cmdClass);
+}
+
+////////////////////////////////////////
+//! modbusTransaction()
+//! send a Modbus request and wait for its response, the counterpart of writeReadController()
+//! with the same statistics, adaptive timeout, link state and flight recorder entries.
+//! The poll thread waits with the controller lock released like writeReadPoll(), and gives up
+//! when another thread sends a command; a response to an abandoned request is recognised by its
+//! transaction id and dropped.
+//
+//! @param[in]  pAxis      axis the request is for
+//! @param[in]  request    request frame
+//! @param[in]  requestLen length of request
+//! @param[out] values     registers read, NULL for a write
+//! @param[in]  timeout    longest wait for the response
+//! @param[in]  cmdClass   LexiumCommandClass, for the adaptive timeout
+//! @return asynError also if the drive answered with an exception
+////////////////////////////////////////
+asynStatus LexiumMotorController::modbusTransaction(LexiumMotorAxis *pAxis, const unsigned char *request, size_t requestLen, epicsUInt16 *values, double timeout, int cmdClass)
+{
+	unsigned char response[LEXIUM_MB_MAX_FRAME];
+	size_t nwrite = 0, nread = 0;
+	asynStatus status;
+	LexiumModbusError error = lexiumModbusOk;
+	int exceptionCode = 0;
+	epicsTimeStamp start;
+	char requestText[RECORDER_TEXT_LEN], responseText[RECORDER_TEXT_LEN];
+	bool pollLane = pollThread && pollThread == epicsThreadGetIdSelf();
+	static const char *functionName = "modbusTransaction()";
+
+	if (pAxis && !pAxis->link.allowIO()) return asynDisconnected;
+	if (pollLane && isPollPreempted()) return asynError;  // rest of the cycle is skipped
+	timeout = commandTimeout(cmdClass, timeout);
+
+	if (pollLane) {
+		epicsMutexLock(pollIOLock);
+		pollUnlocked = true;
+		unlock();
+	} else {
+		beginIO(true);
+	}
+	epicsTimeGetCurrent(&start);
+	status = ioWrite(pollLane ? pAsynUserLexium : pAsynUserCommand, (const char *)request, requestLen, timeout, &nwrite, true);
+	if (status == asynSuccess) status = readModbusResponse(request, response, &nread, timeout, pollLane);
+	if (pollLane) {
+		epicsMutexUnlock(pollIOLock);
+		lock();
+		pollUnlocked = false;
+	} else {
+		endIO(true);
+	}
+
+	lexiumModbusDescribe(request, requestLen, requestText, sizeof(requestText));
+	lexiumModbusDescribe(response, nread, responseText, sizeof(responseText));
+	recorder.add(&start, requestText, status ? NULL : responseText, (pollLane && isPollPreempted()) ? asynError : status);
+	if (pollLane && isPollPreempted()) {
+		asynPrint(pasynUserSelf, ASYN_TRACE_FLOW, "%s:%s: request %s abandoned for a command from another thread\n", DRIVER_NAME, functionName, requestText);
+		return asynError;
+	}
+	recordIO(&readTime, &start, status, nwrite, nread);
+	recordRtt(cmdClass, &start, status);
+	linkResult(pAxis, status);  // an exception is still an answer
+	if (status) { // update comm flag
+		setIntegerParam(this->motorStatusCommsError_, 1);
+		return status;
+	}
+
+	error = lexiumModbusCheckResponse(request, response, nread, values, &exceptionCode);
+	if (error == lexiumModbusException) {
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: exception %d to %s\n", motorName, functionName, exceptionCode, requestText);
+		return asynError;
+	} else if (error) {
+		asynPrint(pasynUserSelf, ASYN_TRACE_ERROR, "%s:%s: %s, %s to %s\n", motorName, functionName, lexiumModbusErrorString(error), responseText, requestText);
+		return asynError;
+	}
+	asynPrint(pasynUserSelf, ASYN_TRACEIO_DRIVER, "%s:%s: request=%s, response=%s\n", DRIVER_NAME, functionName, requestText, responseText);
+	return asynSuccess;
+}
+
+////////////////////////////////////////
+//! readModbusResponse()
+//! read the response to request, dropping responses to earlier requests
+//! The poll thread reads in STOP_CHECK_PERIOD slices and gives up as soon as pollPreempted is set
+//
+//! @param[in]  request  request frame, for its transaction id
+//! @param[out] response response frame, LEXIUM_MB_MAX_FRAME bytes
+//! @param[out] nread    response length
+//! @param[in]  timeout  longest wait for the response
+//! @param[in]  pollLane called by the poll thread without the controller lock
+////////////////////////////////////////
+asynStatus LexiumMotorController::readModbusResponse(const unsigned char *request, unsigned char *response, size_t *nread, double timeout, bool pollLane)
+{
+	asynStatus status;
+	epicsTimeStamp start;
+	size_t len = 0, want, n;
+	int eomReason;
+	double remaining;
+
+	*nread = 0;
+	epicsTimeGetCurrent(&start);
+	for (;;) {
+		if (pollLane && isPollPreempted()) return asynError;
+		remaining = timeout - lexiumElapsed(&start);
+		if (remaining <= 0) return asynTimeout;
+		if (pollLane && remaining > STOP_CHECK_PERIOD) remaining = STOP_CHECK_PERIOD;
+
+		want = lexiumModbusFrameLength(response, len);
+		if (want == 0) { // not a Modbus/TCP header, start again with what comes next
+			pasynOctetSyncIO->flush(pAsynUserLexium);
+			return asynError;
+		}
+		n = 0;
+		status = ioRead(pollLane ? pAsynUserLexium : pAsynUserCommand, (char *)response + len, want - len, remaining, &n, &eomReason);
+		len += n;
+		if (status == asynTimeout) continue;  // nothing yet, or the rest of the frame is still on its way
+		if (status) return status;
+		if (len < want || lexiumModbusFrameLength(response, len) > len) continue;
+
+		if (lexiumModbusTid(response) == lexiumModbusTid(request)) {
+			*nread = len;
+			return asynSuccess;
+		}
+		len = 0;  // late response to an abandoned request
+	}
 }
 
 ////////////////////////////////////////////////////////
@@ -349,6 +1763,7 @@ asynStatus LexiumMotorController::writeReadController2(const char *output, char
 //! @param[in] motorPortName     User-specific name of motor port
 //! @param[in] IOPortName        User-specific name of port that was configured by drvAsynIPPortConfigure()
 //! @param[in] deviceName        Name of device, used to address motor by MCODE in party mode
+//                              Comma separated list to control several drives on one party mode link, one axis each
 //                              If not using party mode, config LexiumCreateController() with empty string "" for deviceName
 //! @param[in] movingPollPeriod  time in ms between polls when any axis is moving
 //! @param[in] idlePollPeriod    time in ms between polls when no axis is moving
@@ -356,11 +1771,53 @@ asynStatus LexiumMotorController::writeReadController2(const char *output, char
 extern "C" int LexiumCreateController(const char *motorPortName, const char *IOPortName, char *devName, double movingPollPeriod, double idlePollPeriod)
 {
 	LexiumMotorController *pImsController;
+	static const char *functionName = "LexiumCreateController()";
+
+	if (lexiumModbusTransport && devName && devName[0]) {
+		printf("%s:%s: ERROR party mode is not available with Modbus/TCP, use \"\" as device name\n", DRIVER_NAME, functionName);
+		return(asynError);
+	}
+	if (lexiumParseDeviceNames(devName, NULL) < 0) {
+		printf("%s:%s: ERROR bad device name list \"%s\", use up to %d names of 1 to %d characters separated by commas\n",
+		       DRIVER_NAME, functionName, devName, MAX_AXES, MAX_NAME_LEN - 1);
+		return(asynError);
+	}
 	pImsController = new LexiumMotorController(motorPortName, IOPortName, devName, movingPollPeriod/1000., idlePollPeriod/1000.);
 	pImsController = NULL; 
 	return(asynSuccess);
 }
 
+////////////////////////////////////////////////////////
+//! LexiumBackgroundStartup()
+//! IOCSH function
+//! When enabled, controllers created afterwards return from LexiumCreateController() straight away
+//! and check the drive (PR VR, PR EE, PR IS) in a background thread.
+//! Axes report CommsError/Problem until their probe has finished.
+//
+//! @param[in] enable 1 to probe drives in the background, 0 to probe in LexiumCreateController() (default)
+////////////////////////////////////////////////////////
+extern "C" int LexiumBackgroundStartup(int enable)
+{
+	lexiumBackgroundStartup = enable;
+	return(asynSuccess);
+}
+
+////////////////////////////////////////////////////////
+//! LexiumModbusTransport()
+//! IOCSH function
+//! When enabled, controllers created afterwards talk Modbus/TCP to their drive instead of MCode:
+//! the IO port must be connected to the drive's Modbus port, e.g.
+//! drvAsynIPPortConfigure("IP1", "192.168.33.1:502", 0, 0, 0), and the device name must be "".
+//! Programs and event mode are not available on this transport.
+//
+//! @param[in] enable 1 for Modbus/TCP, 0 for MCode (default)
+////////////////////////////////////////////////////////
+extern "C" int LexiumModbusTransport(int enable)
+{
+	lexiumModbusTransport = enable;
+	return(asynSuccess);
+}
+
 ////////////////////////////////////////////////////////
 // Lexium IOCSH Registration
 // Copied from ACRMotorDriver.cpp
@@ -368,6 +1825,7 @@ extern "C" int LexiumCreateController(const char *motorPortName, const char *IOP
 // Motor port name    : user-specified name of port
 // IO port name       : user-specific name of port that was initialized with drvAsynIPPortConfigure()
 // Device name        : name of device, used to address motor by MCODE in party mode
+//                    : comma separated list for several drives on one party mode link, e.g. "A,B,C" for axes 0-2
 //                    : if not using party mode, config LexiumCreateController() with empty string "" for deviceName
 // Moving poll period : time in ms between polls when any axis is moving
 // Idle poll period   : time in ms between polls when no axis is moving
@@ -388,9 +1846,27 @@ static void LexiumCreateControllerCallFunc(const iocshArgBuf *args)
 	LexiumCreateController(args[0].sval, args[1].sval, args[2].sval, args[3].dval, args[4].dval);
 }
 
+static const iocshArg LexiumBackgroundStartupArg0 = {"Enable (0/1)", iocshArgInt};
+static const iocshArg * const LexiumBackgroundStartupArgs[] = {&LexiumBackgroundStartupArg0};
+static const iocshFuncDef LexiumBackgroundStartupDef = {"LexiumBackgroundStartup", 1, LexiumBackgroundStartupArgs};
+static void LexiumBackgroundStartupCallFunc(const iocshArgBuf *args)
+{
+	LexiumBackgroundStartup(args[0].ival);
+}
+
+static const iocshArg LexiumModbusTransportArg0 = {"Enable (0/1)", iocshArgInt};
+static const iocshArg * const LexiumModbusTransportArgs[] = {&LexiumModbusTransportArg0};
+static const iocshFuncDef LexiumModbusTransportDef = {"LexiumModbusTransport", 1, LexiumModbusTransportArgs};
+static void LexiumModbusTransportCallFunc(const iocshArgBuf *args)
+{
+	LexiumModbusTransport(args[0].ival);
+}
+
 static void LexiumMotorRegister(void)
 {
 	iocshRegister(&LexiumCreateControllerDef, LexiumCreateControllerCallFunc);
+	iocshRegister(&LexiumBackgroundStartupDef, LexiumBackgroundStartupCallFunc);
+	iocshRegister(&LexiumModbusTransportDef, LexiumModbusTransportCallFunc);
 }
 
 extern "C" {
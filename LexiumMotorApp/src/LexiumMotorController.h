@@ -5,9 +5,41 @@
 #ifndef LexiumMotorController_H
 #define LexiumMotorController_H
 
+#include <epicsEvent.h>
+#include <epicsMutex.h>
+#include <epicsThread.h>
+#include <epicsAtomic.h>
+
 #include "asynMotorController.h"
 #include "asynMotorAxis.h"
 #include "LexiumMotorAxis.h"
+#include "LexiumStats.h"
+#include "LexiumFlightRecorder.h"
+#include "LexiumFaultInjector.h"
+
+struct LexiumPollGroupEntry;
+
+#define DEFAULT_TIMEOUT_FLOOR 0.05  // seconds, default for Lexium_TIMEOUTFLOOR
+
+// command classes with their own adaptive timeout, see commandTimeout()
+enum LexiumCommandClass
+{
+	lexiumClassQuery = 0,   // PR ... and other commands with a reply
+	lexiumClassWrite,       // commands without a reply, e.g. MA, SL, VM=
+	lexiumClassSave,        // first reply after S, CP or PG, the drive may still be writing its flash
+	NUM_COMMAND_CLASSES
+};
+
+////////////////////////////////////
+// LexiumInputConfig
+// one "IS = input, type, active" line of the PR IS reply
+////////////////////////////////////
+struct LexiumInputConfig
+{
+	int input;    // input number
+	int type;     // 0 general purpose, 1 home, 2 + limit, 3 - limit, ...
+	int active;   // active level
+};
 
 ////////////////////////////////////
 //  LexiumMotorController class
@@ -22,16 +54,27 @@ public:
 	LexiumMotorController(const char *motorPortName, const char *IOPortName, const char *deviceName, double movingPollPeriod, double idlePollPeriod);
 	LexiumMotorAxis* getAxis(asynUser *pasynUser);
 	LexiumMotorAxis* getAxis(int axisNo);
-	//void report(FILE *fp, int level);
+	void report(FILE *fp, int level);
 	asynStatus writeInt32(asynUser *pasynUser, epicsInt32 value);
+	asynStatus writeOctet(asynUser *pasynUser, const char *value, size_t nChars, size_t *nActual);
+	asynStatus readFloat64Array(asynUser *pasynUser, epicsFloat64 *value, size_t nElements, size_t *nIn);
+	asynStatus readInt32Array(asynUser *pasynUser, epicsInt32 *value, size_t nElements, size_t *nIn);
+	asynStatus wakeupPoller();
+	asynStatus poll();
 
 	/////////////////////////////////////////
 	// Lexium specific functions
 	/////////////////////////////////////////
-	asynStatus writeReadController(const char *output, char *input, size_t maxChars, size_t *nread, double timeout);
-	asynStatus writeController(const char *output, double timeout);
-	// add this to read PR IS  - for lexium
-    asynStatus writeReadController2(const char *output, char *input, size_t maxChars, size_t *nread, double timeout);
+	asynStatus writeReadController(const char *devName, const char *output, char *input, size_t maxChars, size_t *nread, double timeout);
+	asynStatus writeController(const char *devName, const char *output, double timeout);
+	asynStatus writeReadController(const LexiumCommand &cmd, char *input, size_t maxChars, size_t *nread, double timeout);
+	asynStatus writeController(const LexiumCommand &cmd, double timeout);
+	asynStatus writeReadMultiLine(const char *devName, const char *output, const char *linePrefix, char lines[][MAX_BUFF_LEN], int maxLines, int *nlines, double timeout);
+	double pollCycle(bool forcedFast);
+	void startupProbe();
+	void eventListener();
+	void velocityStreamer();
+	void wakeStreamer();
 
 	
 
@@ -43,30 +86,186 @@ protected:
 	///////////////////////////////////////////
 
 	//! extra parameters that the Lexium controller supports
-	int LexiumLoadMCode_;    //! Load MCode string, NOT SUPPORTED YET
-	int LexiumClearMCode_;   //! Clear program buffer, NOT SUPPORTED YET
+	int LexiumLoadMCode_;    //! Load MCode program, lines separated by newlines, or @fileName
+	int LexiumClearMCode_;   //! Clear program buffer
 	int LexiumSaveToNVM_;    //! Store current user variables and flags to nonvolatile ram
+	int LexiumCombinedPoll_; //! Read all poll fields with a single PR statement, 1=enabled (default), 0=one query per field
 #define FIRST_Lexium_PARAM LexiumLoadMCode_
-#define LAST_Lexium_PARAM LexiumSaveToNVM_
+	int LexiumSkippedWrites_; //! Number of VI/VM/A writes skipped because the drive already had the value (read only)
+	int LexiumIORttMin_;      //! Shortest drive transaction in the last statistics period, seconds (read only)
+	int LexiumIORttMean_;     //! Mean drive transaction time in the last statistics period, seconds (read only)
+	int LexiumIORttP99_;      //! 99th percentile drive transaction time in the last statistics period, seconds (read only)
+	int LexiumIORttMax_;      //! Longest drive transaction in the last statistics period, seconds (read only)
+	int LexiumIOCount_;       //! Number of drive transactions in the last statistics period (read only)
+	int LexiumIOTimeouts_;    //! Number of drive transactions that timed out (read only)
+	int LexiumIOErrors_;      //! Number of drive transactions that failed other than by timeout (read only)
+	int LexiumAdaptivePoll_;  //! 1=stretch the moving poll period during moves according to the predicted end of the move, 0=fixed (default)
+	int LexiumMaxPollPeriod_; //! Longest poll period used by adaptive polling while an axis moves, seconds
+	int LexiumEventMode_;     //! 1=run a drive program that reports motion done, limit and stall, 0=poll only (default)
+	int LexiumLockedRotor_;   //! Locked rotor flag LR (read only)
+	int LexiumErrorCode_;     //! Error code ER (read only)
+	int LexiumStalled_;       //! Stall flag ST (read only)
+	int LexiumClearLock_;     //! Write 1 to clear the locked rotor and error flags (CF)
+	int LexiumHealthPeriod_;  //! Seconds between reads of LR, ER, ST, and of the switch inputs while the axis is idle
+	int LexiumStopLatency_;   //! Time from stop() to SL 0 written for the last stop, seconds (read only)
+	int LexiumCaptureArm_;    //! 1=start capturing poll samples, 0=stop and publish them
+	int LexiumCaptureMode_;   //! 0=ring buffer (default), 1=stop when full, 2=capture the next move() or home()
+	int LexiumCaptureTrigger_;  //! Write 1 to stop capturing and publish the samples
+	int LexiumCaptureCount_;  //! Samples in the capture buffer (read only)
+	int LexiumCaptureStart_;  //! Time capturing started, seconds past the EPICS epoch (read only)
+	int LexiumCaptureTime_;   //! Sample times relative to LexiumCaptureStart_, seconds (Float64 array, read only)
+	int LexiumCapturePosition_;  //! Sample positions (Float64 array, read only)
+	int LexiumCaptureMoving_; //! Sample moving flags (Int32 array, read only)
+	int LexiumCaptureSwitches_;  //! Sample switch bits, 1=home, 2=high limit, 4=low limit (Int32 array, read only)
+	int LexiumNVMSaveIdle_;   //! Save the position to NVM after the axis has been idle this long, seconds, 0=never (default)
+	int LexiumNVMSaves_;      //! Number of background saves to NVM (read only)
+	int LexiumLinkTimeouts_;  //! Timeouts in a row that mark the drive's link down, 0=never
+	int LexiumLinkUp_;        //! 1=drive answering, 0=link down, commands fail straight away (read only)
+	int LexiumReconnects_;    //! Number of times the link came back up (read only)
+	int LexiumTimeoutFloor_;  //! Shortest adaptive timeout, seconds
+	int LexiumTimeoutCeiling_;  //! Longest adaptive timeout, also used until the first reply, seconds
+	int LexiumRttQuery_;      //! Smoothed round trip time of queries, seconds (read only)
+	int LexiumRttWrite_;      //! Smoothed time to send a command without reply, seconds (read only)
+	int LexiumRttSave_;       //! Smoothed round trip time of the first query after a save, seconds (read only)
+	int LexiumTimeoutQuery_;  //! Timeout currently used for queries, seconds (read only)
+	int LexiumTimeoutWrite_;  //! Timeout currently used for commands without reply, seconds (read only)
+	int LexiumTimeoutSave_;   //! Timeout currently used for the first query after a save, seconds (read only)
+	int LexiumStreamVelocity_;  //! 1=moveVelocity() only queues the jog velocity, the newest one is sent, 0=send every call (default)
+	int LexiumStreamLatency_; //! Time from moveVelocity() to SL written for the last streamed velocity, seconds (read only)
+	int LexiumStreamCoalesced_;  //! Number of streamed velocities replaced by a newer one before being sent (read only)
+#define LAST_Lexium_PARAM LexiumStreamCoalesced_
 #define NUM_Lexium_PARAMS (&LAST_Lexium_PARAM - &FIRST_Lexium_PARAM + 1)
 
 private:
 // drvInfo strings for extra parameters that the Lexium controller supports
-#define LexiumLoadMCodeControlString	"Lexium_LOADMCODE"    // NOT SUPPORTED YET
-#define LexiumClearMCodeControlString	"Lexium_CLEARMCODE"   // NOT SUPPORTED YET
+#define LexiumLoadMCodeControlString	"Lexium_LOADMCODE"
+#define LexiumClearMCodeControlString	"Lexium_CLEARMCODE"
 #define LexiumSaveToNVMControlString	"Lexium_SAVETONVM"
+#define LexiumCombinedPollControlString	"Lexium_COMBINEDPOLL"
+#define LexiumSkippedWritesControlString	"Lexium_SKIPPEDWRITES"
+#define LexiumIORttMinControlString	"Lexium_IORTTMIN"
+#define LexiumIORttMeanControlString	"Lexium_IORTTMEAN"
+#define LexiumIORttP99ControlString	"Lexium_IORTTP99"
+#define LexiumIORttMaxControlString	"Lexium_IORTTMAX"
+#define LexiumIOCountControlString	"Lexium_IOCOUNT"
+#define LexiumIOTimeoutsControlString	"Lexium_IOTIMEOUTS"
+#define LexiumIOErrorsControlString	"Lexium_IOERRORS"
+#define LexiumAdaptivePollControlString	"Lexium_ADAPTIVEPOLL"
+#define LexiumMaxPollPeriodControlString	"Lexium_MAXPOLLPERIOD"
+#define LexiumEventModeControlString	"Lexium_EVENTMODE"
+#define LexiumLockedRotorControlString	"Lexium_LOCKEDROTOR"
+#define LexiumErrorCodeControlString	"Lexium_ERRORCODE"
+#define LexiumStalledControlString	"Lexium_STALLED"
+#define LexiumClearLockControlString	"Lexium_CLEARLOCK"
+#define LexiumHealthPeriodControlString	"Lexium_HEALTHPERIOD"
+#define LexiumStopLatencyControlString	"Lexium_STOPLATENCY"
+#define LexiumCaptureArmControlString	"Lexium_CAPTUREARM"
+#define LexiumCaptureModeControlString	"Lexium_CAPTUREMODE"
+#define LexiumCaptureTriggerControlString	"Lexium_CAPTURETRIGGER"
+#define LexiumCaptureCountControlString	"Lexium_CAPTURECOUNT"
+#define LexiumCaptureStartControlString	"Lexium_CAPTURESTART"
+#define LexiumCaptureTimeControlString	"Lexium_CAPTURETIME"
+#define LexiumCapturePositionControlString	"Lexium_CAPTUREPOSITION"
+#define LexiumCaptureMovingControlString	"Lexium_CAPTUREMOVING"
+#define LexiumCaptureSwitchesControlString	"Lexium_CAPTURESWITCHES"
+#define LexiumNVMSaveIdleControlString	"Lexium_NVMSAVEIDLE"
+#define LexiumNVMSavesControlString	"Lexium_NVMSAVES"
+#define LexiumLinkTimeoutsControlString	"Lexium_LINKTIMEOUTS"
+#define LexiumLinkUpControlString	"Lexium_LINKUP"
+#define LexiumReconnectsControlString	"Lexium_RECONNECTS"
+#define LexiumTimeoutFloorControlString	"Lexium_TIMEOUTFLOOR"
+#define LexiumTimeoutCeilingControlString	"Lexium_TIMEOUTCEILING"
+#define LexiumRttQueryControlString	"Lexium_RTTQUERY"
+#define LexiumRttWriteControlString	"Lexium_RTTWRITE"
+#define LexiumRttSaveControlString	"Lexium_RTTSAVE"
+#define LexiumTimeoutQueryControlString	"Lexium_TIMEOUTQUERY"
+#define LexiumTimeoutWriteControlString	"Lexium_TIMEOUTWRITE"
+#define LexiumTimeoutSaveControlString	"Lexium_TIMEOUTSAVE"
+#define LexiumStreamVelocityControlString	"Lexium_STREAMVELOCITY"
+#define LexiumStreamLatencyControlString	"Lexium_STREAMLATENCY"
+#define LexiumStreamCoalescedControlString	"Lexium_STREAMCOALESCED"
 
-	asynUser *pAsynUserLexium;
+	asynUser *pAsynUserLexium;  // poll lane, see writeReadPoll()
+	asynUser *pAsynUserCommand; // commands from the other threads, a write may go out while the poll thread reads
+	asynUser *pAsynUserCommon;  // connects and disconnects the IO port, for the close fault
 	char motorName[MAX_NAME_LEN];
-	char deviceName[MAX_NAME_LEN];
-	int homeSwitchInput;
-	int posLimitSwitchInput;
-	int negLimitSwitchInput;
+	char outputEos;             // ends each command, separates the commands of a sequence, see LexiumCommand::next()
+	bool modbus;                // Modbus/TCP transport instead of MCode, see LexiumModbus.h
+	epicsUInt16 modbusTid;      // transaction id of the last Modbus request
+	int nextIdleAxis;           // round robin position of the idle axis polls
+	double fastPollPeriod;      // configured moving poll period, movingPollPeriod_ is adjusted by adaptive polling
+	bool backgroundStartup;     // drive setup runs in startupProbe() instead of the constructor
+	bool probeDone;             // configAxis() and readHomeAndLimitConfig() have run on all axes
+	LexiumPollGroupEntry *pPollGroupEntry;  // NULL when using the asynMotorController poller thread
+	bool eventMode;             // drive event program running, replies may be preceded by event lines
+	bool eventListenerStarted;
+	epicsEventId eventModeOn;   // wakes eventListener() when event mode is enabled
+	bool streamerStarted;
+	epicsEventId streamWakeup;  // wakes velocityStreamer() when a jog velocity is queued
+
+	// poll lane, see writeReadPoll()
+	epicsThreadId pollThread;   // thread running poll(), NULL outside poll()
+	epicsMutexId pollIOLock;    // held by the poll thread while it waits for a reply with the controller lock released
+	bool pollUnlocked;          // poll thread is waiting for a reply with the controller lock released
+	int pollPreempted;          // a stop or other command went out during this poll cycle, abandon it, epicsAtomic
+	bool staleReply;            // reply to an abandoned poll query may still arrive, drain before the next read
+	epicsTimeStamp staleReplyDeadline;  // when the abandoned query would have timed out, see drainStaleReply()
+	int pollIOWaiting;          // threads waiting in lockPollIO(), epicsAtomic, eventListener() lets them go first
+
+	// I/O statistics, see LexiumStats.h
+	LexiumHistogram readTime;      // writeReadController() round trips
+	LexiumHistogram writeTime;     // writeController() writes
+	unsigned long ioTimeouts;
+	unsigned long ioErrors;        // errors other than timeouts
+	unsigned long ioBytesOut;      // command and reply characters, without terminators
+	unsigned long ioBytesIn;
+	LexiumHistogram cycleTime;     // poll() cycles
+	unsigned long pollOverruns;    // poll() cycles longer than the poll period in effect
+	unsigned long pollsAbandoned;  // poll() cycles cut short by a command from another thread
+	LexiumHistogram ioWindow;      // all transactions since the parameters were last published
+	epicsTimeStamp ioWindowStart;
+	LexiumRttEstimator rtt[NUM_COMMAND_CLASSES];  // adaptive timeouts, see commandTimeout()
+	LexiumFlightRecorder recorder; // last transactions, for LexiumDumpIO()
+	LexiumFaultInjector faults;    // set with LexiumInjectFault(), applied by ioWrite() and ioRead()
+
+	static LexiumMotorController *pFirstController;  // list of all Lexium controllers in the IOC
+	LexiumMotorController *pNextController;
 
-	void initController(const char *devName, double movingPollPeriod, double idlePollPeriod);
-	int readHomeAndLimitConfig();  // read home, positive limit, and neg limit switch configuration from controller (S1-S4 settings)
+	void initController(double movingPollPeriod, double idlePollPeriod);
+	asynStatus readInputConfig(const char *devName, LexiumInputConfig *config, int maxInputs, int *numInputs);
+	void yieldLock();
+	asynStatus writeReadPoll(const LexiumCommand &cmd, char *input, size_t maxChars, size_t *nread, double timeout, int cmdClass);
+	asynStatus readPollReply(char *input, size_t maxChars, size_t *nread, double timeout, char *eventLine);
+	void beginIO(bool reading);
+	void endIO(bool reading);
+	void lockPollIO();
+	bool isPollPreempted() { return epicsAtomicGetIntT(&pollPreempted) != 0; }
+	void drainStaleReply();
+	asynStatus ioWrite(asynUser *pasynUser, const char *output, size_t len, double timeout, size_t *nwrite, bool reply);
+	asynStatus ioRead(asynUser *pasynUser, char *input, size_t maxChars, double timeout, size_t *nread, int *eomReason);
+	asynStatus ioWriteRead(asynUser *pasynUser, const char *output, size_t len, char *input, size_t maxChars, double timeout, size_t *nwrite, size_t *nread, int *eomReason);
+	asynStatus writeReadRaw(const LexiumCommand &cmd, char *input, size_t maxChars, size_t *nread, double timeout);
+	asynStatus readReply(char *input, size_t maxChars, size_t *nread, double timeout);
+	void checkEvents();
+	void handleEvent(const char *line);
+	asynStatus setEventMode(int enable);
+	asynStatus readRegisters(LexiumMotorAxis *pAxis, int addr, int count, epicsUInt16 *values, double timeout);
+	asynStatus writeRegisters(LexiumMotorAxis *pAxis, int addr, const epicsUInt16 *values, int count, double timeout);
+	asynStatus modbusTransaction(LexiumMotorAxis *pAxis, const unsigned char *request, size_t requestLen, epicsUInt16 *values, double timeout, int cmdClass);
+	asynStatus readModbusResponse(const unsigned char *request, unsigned char *response, size_t *nread, double timeout, bool pollLane);
+	void recordIO(LexiumHistogram *hist, const epicsTimeStamp *start, asynStatus status, size_t bytesOut, size_t bytesIn);
+	LexiumMotorAxis* commandAxis(const LexiumCommand &cmd);
+	double commandTimeout(int cmdClass, double maxTimeout);
+	void recordRtt(int cmdClass, const epicsTimeStamp *start, asynStatus status);
+	void linkResult(LexiumMotorAxis *pAxis, asynStatus status);
+	void resetStats();
+	void publishIOStats();
 
 	friend class LexiumMotorAxis;
+	friend class LexiumBenchmark;
+	friend class LexiumNVMSaver;
+	friend class LexiumFlightRecorder;
+	friend class LexiumFaultInjector;
 };
 //! iocsh function to create controller object
 //! NOTE: drvAsynIPPortConfigure() must be called first
@@ -0,0 +1,172 @@
+//! @File : LexiumNVMSaver.cpp
+//!         Background save of axis positions to the drives' NVM.
+//!
+//!         A drive that loses power comes back with the position last stored by S. Axes with
+//!         Lexium_NVMSAVEIDLE set are saved once they have been idle that long with a position
+//!         different from the one last saved. Idle time comes from the poll data, so no query is
+//!         added for it. The drive stops answering while it stores, so saves of all the drives
+//!         in the IOC are spread out: one axis at a time, round robin, at most one save every
+//!         LexiumNVMSaveInterval() seconds.
+//
+//  Revision History
+//  ----------------
+//  Initial version
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <epicsThread.h>
+#include <iocsh.h>
+
+#include "asynMotorController.h"
+#include "asynMotorAxis.h"
+
+#include <epicsExport.h>
+#include "LexiumMotorController.h"
+#include "LexiumNVMSaver.h"
+
+static LexiumNVMSaver *pLexiumNVMSaver = NULL;
+
+double LexiumNVMSaver::interval = DEFAULT_NVM_SAVE_INTERVAL;
+
+static void LexiumNVMSaverThreadC(void *pPvt)
+{
+	LexiumNVMSaver *pSaver = (LexiumNVMSaver *)pPvt;
+	pSaver->saverThread();
+}
+
+////////////////////////////////////////////////////////
+//! LexiumNVMSaver()
+//! Constructor, starts the saver thread
+////////////////////////////////////////////////////////
+LexiumNVMSaver::LexiumNVMSaver()
+  : pLastController(NULL), lastAxis(0), saved(false)
+{
+	epicsThreadCreate("LexiumNVMSave", epicsThreadPriorityLow, epicsThreadGetStackSize(epicsThreadStackMedium),
+					  (EPICSTHREADFUNC)LexiumNVMSaverThreadC, (void *)this);
+}
+
+////////////////////////////////////////////////////////
+//! start()
+//! Create the IOC's saver on the first call, called by each LexiumMotorController constructor
+////////////////////////////////////////////////////////
+void LexiumNVMSaver::start()
+{
+	if (!pLexiumNVMSaver) pLexiumNVMSaver = new LexiumNVMSaver();
+}
+
+////////////////////////////////////////////////////////
+//! nextAxis()
+//! Step to the next axis of all Lexium controllers, wrapping around at the end of the list
+//
+//! @param[in,out] ppC  controller, NULL to start at the first one
+//! @param[in,out] axis axis number in *ppC
+////////////////////////////////////////////////////////
+void LexiumNVMSaver::nextAxis(LexiumMotorController **ppC, int *axis)
+{
+	if (*ppC && ++(*axis) < (*ppC)->numAxes_) return;
+	*ppC = (*ppC && (*ppC)->pNextController) ? (*ppC)->pNextController : LexiumMotorController::pFirstController;
+	*axis = 0;
+}
+
+////////////////////////////////////////////////////////
+//! saveNext()
+//! Save the first axis that is due, starting after the one saved last
+//
+//! @param[in] now current time
+//! @return true if an axis was saved
+////////////////////////////////////////////////////////
+bool LexiumNVMSaver::saveNext(const epicsTimeStamp *now)
+{
+	LexiumMotorController *pC = pLastController;
+	LexiumMotorController *pCount;
+	LexiumMotorAxis *pAxis;
+	int axis = lastAxis;
+	int numAxes = 0;
+	bool due;
+
+	for (pCount = LexiumMotorController::pFirstController; pCount; pCount = pCount->pNextController) {
+		numAxes += pCount->numAxes_;
+	}
+
+	for (int i=0; i<numAxes; i++) {
+		nextAxis(&pC, &axis);
+		pC->lock();
+		pAxis = pC->getAxis(axis);
+		due = pAxis && pAxis->nvmSaveDue(now);
+		if (due) pAxis->backgroundSaveToNVM();
+		pC->unlock();
+		if (due) {
+			pLastController = pC;
+			lastAxis = axis;
+			return true;
+		}
+	}
+	return false;
+}
+
+////////////////////////////////////////////////////////
+//! saverThread()
+//! Saver thread loop, looks for an axis to save every NVM_SAVE_CHECK_PERIOD
+//! once LexiumNVMSaveInterval() has passed since the last save
+////////////////////////////////////////////////////////
+void LexiumNVMSaver::saverThread()
+{
+	epicsTimeStamp now;
+
+	while (1) {
+		epicsThreadSleep(NVM_SAVE_CHECK_PERIOD);
+		epicsTimeGetCurrent(&now);
+		if (saved && epicsTimeDiffInSeconds(&now, &lastSave) < interval) continue;
+		if (saveNext(&now)) {
+			lastSave = now;
+			saved = true;
+		}
+	}
+}
+
+////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////
+// Start code for iocsh Registration :
+// Available Functions :
+//   LexiumNVMSaveInterval()
+////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////
+//! LexiumNVMSaveInterval()
+//! IOCSH function
+//! Sets the shortest time between two background saves to NVM, over all Lexium drives in the IOC
+//
+//! @param[in] seconds time between saves, DEFAULT_NVM_SAVE_INTERVAL if not called
+////////////////////////////////////////////////////////
+extern "C" int LexiumNVMSaveInterval(double seconds)
+{
+	static const char *functionName = "LexiumNVMSaveInterval()";
+
+	if (seconds < 0) {
+		printf("%s:%s: ERROR interval must not be negative\n", DRIVER_NAME, functionName);
+		return(asynError);
+	}
+	LexiumNVMSaver::interval = seconds;
+	return(asynSuccess);
+}
+
+////////////////////////////////////////////////////////
+// Seconds  : shortest time between two background saves to NVM
+////////////////////////////////////////////////////////
+static const iocshArg LexiumNVMSaveIntervalArg0 = {"Seconds", iocshArgDouble};
+static const iocshArg * const LexiumNVMSaveIntervalArgs[] = {&LexiumNVMSaveIntervalArg0};
+static const iocshFuncDef LexiumNVMSaveIntervalDef = {"LexiumNVMSaveInterval", 1, LexiumNVMSaveIntervalArgs};
+static void LexiumNVMSaveIntervalCallFunc(const iocshArgBuf *args)
+{
+	LexiumNVMSaveInterval(args[0].dval);
+}
+
+static void LexiumNVMSaverRegister(void)
+{
+	iocshRegister(&LexiumNVMSaveIntervalDef, LexiumNVMSaveIntervalCallFunc);
+}
+
+extern "C" {
+	epicsExportRegistrar(LexiumNVMSaverRegister);
+}
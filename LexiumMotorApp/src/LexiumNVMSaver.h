@@ -0,0 +1,39 @@
+//  Description : Background save of positions to NVM for Lexium controllers.
+//                One thread per IOC looks for axes that have been idle for their
+//                Lexium_NVMSAVEIDLE time since their position changed, and sends
+//                them S one at a time, at most one every LexiumNVMSaveInterval() seconds.
+
+#ifndef LexiumNVMSaver_H
+#define LexiumNVMSaver_H
+
+#include <epicsTime.h>
+
+#define NVM_SAVE_CHECK_PERIOD 1.0        // seconds between looks for an axis to save
+#define DEFAULT_NVM_SAVE_INTERVAL 5.0    // seconds, shortest time between two saves in the IOC
+
+class epicsShareClass LexiumMotorController;
+
+////////////////////////////////////
+// LexiumNVMSaver class
+// one per IOC, started by the first LexiumCreateController()
+////////////////////////////////////
+class LexiumNVMSaver
+{
+public:
+	LexiumNVMSaver();
+	void saverThread();
+
+	static void start();
+	static double interval;      // LexiumNVMSaveInterval()
+
+private:
+	LexiumMotorController *pLastController;  // last axis saved, the next look starts after it
+	int lastAxis;
+	bool saved;                  // lastSave is valid
+	epicsTimeStamp lastSave;
+
+	bool saveNext(const epicsTimeStamp *now);
+	void nextAxis(LexiumMotorController **ppC, int *axis);
+};
+
+#endif // LexiumNVMSaver_H
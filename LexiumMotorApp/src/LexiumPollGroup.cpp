@@ -0,0 +1,233 @@
+//! @File : LexiumPollGroup.cpp
+//!         Shared poller for LexiumMotorController objects.
+//!
+//!         By default every LexiumMotorController starts its own asynMotorController poller thread.
+//!         IOCs with many single-axis drives can instead call LexiumCreatePollGroup() before the
+//!         first LexiumCreateController(); all controllers created afterwards are then polled by
+//!         a fixed pool of worker threads. Each controller keeps its own moving/idle poll periods,
+//!         and controllers on different IO ports are polled concurrently by different workers.
+//
+//  Revision History
+//  ----------------
+//  Initial version
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <epicsThread.h>
+#include <iocsh.h>
+
+#include "asynMotorController.h"
+#include "asynMotorAxis.h"
+
+#include <epicsExport.h>
+#include "LexiumMotorController.h"
+#include "LexiumPollGroup.h"
+
+static LexiumPollGroup *pLexiumPollGroup = NULL;
+
+static void LexiumPollGroupThreadC(void *pPvt)
+{
+	LexiumPollGroup *pGroup = (LexiumPollGroup *)pPvt;
+	pGroup->workerThread();
+}
+
+////////////////////////////////////////////////////////
+//! LexiumPollGroup()
+//! Constructor, starts the worker threads
+//
+//! @param[in] numThreads number of worker threads shared by all controllers in the group
+////////////////////////////////////////////////////////
+LexiumPollGroup::LexiumPollGroup(int numThreads)
+  : numThreads(numThreads), pEntries(NULL)
+{
+	char threadName[20];
+
+	groupLock = epicsMutexMustCreate();
+	workEvent = epicsEventMustCreate(epicsEventEmpty);
+
+	for (int i=0; i<numThreads; i++) {
+		sprintf(threadName, "LexiumPoll%d", i);
+		epicsThreadCreate(threadName, epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackMedium),
+						  (EPICSTHREADFUNC)LexiumPollGroupThreadC, (void *)this);
+	}
+}
+
+////////////////////////////////////////////////////////
+//! getGroup()
+//! @return the IOC's poll group, NULL if LexiumCreatePollGroup() was not called
+////////////////////////////////////////////////////////
+LexiumPollGroup* LexiumPollGroup::getGroup()
+{
+	return pLexiumPollGroup;
+}
+
+////////////////////////////////////////////////////////
+//! addController()
+//! Register a controller with the group, it is polled straight away
+//
+//! @param[in] pC              controller to poll
+//! @param[in] forcedFastPolls number of polls at the moving poll period after each wakeupPoller()
+//! @return scheduling entry, passed back to wakeup()
+////////////////////////////////////////////////////////
+LexiumPollGroupEntry* LexiumPollGroup::addController(LexiumMotorController *pC, int forcedFastPolls)
+{
+	LexiumPollGroupEntry *pEntry = new LexiumPollGroupEntry;
+
+	pEntry->pController = pC;
+	epicsTimeGetCurrent(&pEntry->due);
+	pEntry->waitForWakeup = false;
+	pEntry->wakeRequested = true;  // force one poll at startup
+	pEntry->busy = false;
+	pEntry->forcedFastPollsLeft = 0;
+	pEntry->forcedFastPolls = forcedFastPolls;
+
+	epicsMutexLock(groupLock);
+	pEntry->pNext = pEntries;
+	pEntries = pEntry;
+	epicsMutexUnlock(groupLock);
+
+	epicsEventSignal(workEvent);
+	return pEntry;
+}
+
+////////////////////////////////////////////////////////
+//! wakeup()
+//! Poll the controller as soon as a worker is free, equivalent of asynMotorController::wakeupPoller()
+//
+//! @param[in] pEntry scheduling entry returned by addController()
+////////////////////////////////////////////////////////
+void LexiumPollGroup::wakeup(LexiumPollGroupEntry *pEntry)
+{
+	epicsMutexLock(groupLock);
+	pEntry->wakeRequested = true;
+	pEntry->forcedFastPollsLeft = pEntry->forcedFastPolls;
+	epicsMutexUnlock(groupLock);
+
+	epicsEventSignal(workEvent);
+}
+
+////////////////////////////////////////////////////////
+//! nextDue()
+//! Find the controller to poll next, must be called with groupLock held
+//! Controllers woken by wakeupPoller() go first, then the most overdue one
+//
+//! @param[out] waitTime time until the next controller is due, -1 if none is scheduled
+//! @return entry to poll now, NULL if none is due
+////////////////////////////////////////////////////////
+LexiumPollGroupEntry* LexiumPollGroup::nextDue(double *waitTime)
+{
+	LexiumPollGroupEntry *pEntry, *pDue = NULL;
+	epicsTimeStamp now;
+	double diff, minDiff = 0;
+
+	*waitTime = -1;
+	epicsTimeGetCurrent(&now);
+	for (pEntry = pEntries; pEntry; pEntry = pEntry->pNext) {
+		if (pEntry->busy) continue;
+		if (pEntry->wakeRequested) return pEntry;
+		if (pEntry->waitForWakeup) continue;
+		diff = epicsTimeDiffInSeconds(&pEntry->due, &now);
+		if (diff <= 0) {
+			if (!pDue || diff < minDiff) {
+				pDue = pEntry;
+				minDiff = diff;
+			}
+		} else if (*waitTime < 0 || diff < *waitTime) {
+			*waitTime = diff;
+		}
+	}
+	return pDue;
+}
+
+////////////////////////////////////////////////////////
+//! workerThread()
+//! Worker thread loop, polls whichever controller is due next
+//! A controller is only ever polled by one worker at a time
+////////////////////////////////////////////////////////
+void LexiumPollGroup::workerThread()
+{
+	LexiumPollGroupEntry *pEntry;
+	double waitTime, period;
+	bool fast;
+
+	epicsMutexLock(groupLock);
+	while (1) {
+		pEntry = nextDue(&waitTime);
+		if (!pEntry) {
+			epicsMutexUnlock(groupLock);
+			if (waitTime < 0) epicsEventWait(workEvent);
+			else epicsEventWaitWithTimeout(workEvent, waitTime);
+			epicsMutexLock(groupLock);
+			continue;
+		}
+
+		pEntry->busy = true;
+		pEntry->wakeRequested = false;
+		fast = (pEntry->forcedFastPollsLeft > 0);
+		if (fast) pEntry->forcedFastPollsLeft--;
+		epicsMutexUnlock(groupLock);
+
+		// let an idle worker pick up the next controller while this one is busy on the wire
+		epicsEventSignal(workEvent);
+		period = pEntry->pController->pollCycle(fast);
+
+		epicsMutexLock(groupLock);
+		pEntry->busy = false;
+		pEntry->waitForWakeup = (period == 0);
+		epicsTimeGetCurrent(&pEntry->due);
+		epicsTimeAddSeconds(&pEntry->due, period);
+	}
+}
+
+////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////
+// Start code for iocsh Registration :
+// Available Functions :
+//   LexiumCreatePollGroup()
+////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////
+//! LexiumCreatePollGroup()
+//! IOCSH function
+//! Creates the shared poll group, must be called before LexiumCreateController()
+//! Controllers created afterwards are polled by the group instead of their own poller thread
+//
+//! @param[in] numThreads number of worker threads, at most MAX_POLL_GROUP_THREADS
+////////////////////////////////////////////////////////
+extern "C" int LexiumCreatePollGroup(int numThreads)
+{
+	static const char *functionName = "LexiumCreatePollGroup()";
+
+	if (pLexiumPollGroup) {
+		printf("%s:%s: ERROR poll group already created\n", DRIVER_NAME, functionName);
+		return(asynError);
+	}
+	if ((numThreads < 1) || (numThreads > MAX_POLL_GROUP_THREADS)) {
+		printf("%s:%s: ERROR number of threads must be 1-%d\n", DRIVER_NAME, functionName, MAX_POLL_GROUP_THREADS);
+		return(asynError);
+	}
+	pLexiumPollGroup = new LexiumPollGroup(numThreads);
+	return(asynSuccess);
+}
+
+////////////////////////////////////////////////////////
+// Number of threads  : worker threads shared by all Lexium controllers
+////////////////////////////////////////////////////////
+static const iocshArg LexiumCreatePollGroupArg0 = {"Number of threads", iocshArgInt};
+static const iocshArg * const LexiumCreatePollGroupArgs[] = {&LexiumCreatePollGroupArg0};
+static const iocshFuncDef LexiumCreatePollGroupDef = {"LexiumCreatePollGroup", 1, LexiumCreatePollGroupArgs};
+static void LexiumCreatePollGroupCallFunc(const iocshArgBuf *args)
+{
+	LexiumCreatePollGroup(args[0].ival);
+}
+
+static void LexiumPollGroupRegister(void)
+{
+	iocshRegister(&LexiumCreatePollGroupDef, LexiumCreatePollGroupCallFunc);
+}
+
+extern "C" {
+	epicsExportRegistrar(LexiumPollGroupRegister);
+}
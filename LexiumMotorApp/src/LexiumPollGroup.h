@@ -0,0 +1,56 @@
+//  Description : Shared poller for Lexium controllers.
+//                A small fixed pool of worker threads polls every registered
+//                LexiumMotorController instead of one asynMotorController
+//                poller thread per controller.
+
+#ifndef LexiumPollGroup_H
+#define LexiumPollGroup_H
+
+#include <epicsTime.h>
+#include <epicsMutex.h>
+#include <epicsEvent.h>
+
+#define MAX_POLL_GROUP_THREADS 16
+
+class epicsShareClass LexiumMotorController;
+
+////////////////////////////////////
+// LexiumPollGroupEntry
+// scheduling state of one controller in the poll group
+////////////////////////////////////
+struct LexiumPollGroupEntry
+{
+	LexiumMotorController *pController;
+	epicsTimeStamp due;          // time of next poll
+	bool waitForWakeup;          // poll period is 0, only poll on wakeup
+	bool wakeRequested;          // wakeupPoller() called, poll as soon as a worker is free
+	bool busy;                   // a worker is polling this controller
+	int forcedFastPollsLeft;     // moving poll period is used for this many polls after a wakeup
+	int forcedFastPolls;         // value forcedFastPollsLeft is reset to on wakeup
+	LexiumPollGroupEntry *pNext;
+};
+
+////////////////////////////////////
+// LexiumPollGroup class
+// one per IOC, created by LexiumCreatePollGroup() before LexiumCreateController()
+////////////////////////////////////
+class LexiumPollGroup
+{
+public:
+	LexiumPollGroup(int numThreads);
+	LexiumPollGroupEntry* addController(LexiumMotorController *pC, int forcedFastPolls);
+	void wakeup(LexiumPollGroupEntry *pEntry);
+	void workerThread();
+
+	static LexiumPollGroup* getGroup();
+
+private:
+	epicsMutexId groupLock;
+	epicsEventId workEvent;
+	int numThreads;
+	LexiumPollGroupEntry *pEntries;
+
+	LexiumPollGroupEntry* nextDue(double *waitTime);
+};
+
+#endif // LexiumPollGroup_H
@@ -0,0 +1,216 @@
+//! @File : LexiumReply.cpp
+//!         Reply parsing used by LexiumMotorAxis.
+//!         Replies are checked as a whole before any value is used, so a drive that answers with
+//!         an error prompt or an echo (wrong EM setting) or not at all never reads as position 0
+//!         or "not moving".
+//
+//  Revision History
+//  ----------------
+//  Initial version
+
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+
+#include "LexiumReply.h"
+
+static inline bool isBlank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static inline bool isDigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+////////////////////////////////////////
+//! lexiumFromChars()
+//! convert a decimal integer
+//
+//! @param[in]  first start of the number
+//! @param[in]  last  end of the buffer
+//! @param[out] value the number, unchanged on error
+//! @return ptr after the last digit, or first and lexiumReplyInvalid/lexiumReplyOverflow
+////////////////////////////////////////
+LexiumParseResult lexiumFromChars(const char *first, const char *last, long *value)
+{
+	LexiumParseResult result = {first, lexiumReplyInvalid};
+	const char *p = first;
+	bool negative = false;
+	unsigned long u = 0;
+	unsigned long limit;
+
+	if (p < last && *p == '-') {
+		negative = true;
+		p++;
+	}
+	if (p == last || !isDigit(*p)) return result;
+
+	limit = negative ? 0UL - (unsigned long)LONG_MIN : (unsigned long)LONG_MAX;
+	for (; p < last && isDigit(*p); p++) {
+		unsigned digit = *p - '0';
+		if (u > (limit - digit) / 10) {
+			while (p < last && isDigit(*p)) p++;
+			result.ptr = p;
+			result.error = lexiumReplyOverflow;
+			return result;
+		}
+		u = u * 10 + digit;
+	}
+
+	*value = negative ? (long)(0UL - u) : (long)u;
+	result.ptr = p;
+	result.error = lexiumReplyOk;
+	return result;
+}
+
+////////////////////////////////////////
+//! lexiumFromChars()
+//! convert a decimal number with optional fraction
+//
+//! @param[in]  first start of the number
+//! @param[in]  last  end of the buffer
+//! @param[out] value the number, unchanged on error
+//! @return ptr after the last digit, or first and lexiumReplyInvalid
+////////////////////////////////////////
+LexiumParseResult lexiumFromChars(const char *first, const char *last, double *value)
+{
+	LexiumParseResult result = {first, lexiumReplyInvalid};
+	const char *p = first;
+	bool negative = false;
+	bool anyDigits = false;
+	double v = 0, scale = 1;
+
+	if (p < last && *p == '-') {
+		negative = true;
+		p++;
+	}
+	for (; p < last && isDigit(*p); p++) {
+		v = v * 10 + (*p - '0');
+		anyDigits = true;
+	}
+	if (p < last && *p == '.') {
+		p++;
+		for (; p < last && isDigit(*p); p++) {
+			scale /= 10;
+			v += (*p - '0') * scale;
+			anyDigits = true;
+		}
+	}
+	if (!anyDigits) return result;
+
+	*value = negative ? -v : v;
+	result.ptr = p;
+	result.error = lexiumReplyOk;
+	return result;
+}
+
+////////////////////////////////////////
+//! lexiumCheckReply()
+//! reject replies that can't hold a value
+//
+//! @param[in] reply   received line without terminator
+//! @param[in] len     its length
+//! @param[in] command command that was sent without device name, NULL to skip the echo check
+//! @return lexiumReplyOk, lexiumReplyEmpty, lexiumReplyPrompt or lexiumReplyEcho
+////////////////////////////////////////
+LexiumReplyError lexiumCheckReply(const char *reply, size_t len, const char *command)
+{
+	const char *p = reply, *last = reply + len;
+	size_t cmdLen = command ? strlen(command) : 0;
+
+	while (p < last && isBlank(*p)) p++;
+	if (p == last) return lexiumReplyEmpty;
+	if (*p == '?' || *p == '>') return lexiumReplyPrompt;
+	// commands start with a letter, so a numeric reply never matches;
+	// in party mode the echo starts with the one character device name
+	if (cmdLen && (size_t)(last - p) >= cmdLen && !memcmp(p, command, cmdLen)) return lexiumReplyEcho;
+	if (cmdLen && (size_t)(last - p) > cmdLen && !memcmp(p + 1, command, cmdLen)) return lexiumReplyEcho;
+	return lexiumReplyOk;
+}
+
+template <class T>
+static LexiumReplyError parseReply(const char *reply, size_t len, const char *command, T *value)
+{
+	const char *p = reply, *last = reply + len;
+	LexiumReplyError error;
+	LexiumParseResult result;
+	T v;
+
+	error = lexiumCheckReply(reply, len, command);
+	if (error) return error;
+	while (p < last && isBlank(*p)) p++;
+	result = lexiumFromChars(p, last, &v);
+	if (result.error) return result.error;
+	for (p = result.ptr; p < last && isBlank(*p); p++) {}
+	if (p != last) return lexiumReplyInvalid;
+	*value = v;
+	return lexiumReplyOk;
+}
+
+////////////////////////////////////////
+//! lexiumParseReply()
+//! value of a reply that is a single number, e.g. to PR MV
+//
+//! @param[in]  reply   received line without terminator
+//! @param[in]  len     its length
+//! @param[in]  command command that was sent without device name, NULL to skip the echo check
+//! @param[out] value   the number, unchanged on error
+////////////////////////////////////////
+LexiumReplyError lexiumParseReply(const char *reply, size_t len, const char *command, long *value)
+{
+	return parseReply(reply, len, command, value);
+}
+
+LexiumReplyError lexiumParseReply(const char *reply, size_t len, const char *command, double *value)
+{
+	return parseReply(reply, len, command, value);
+}
+
+////////////////////////////////////////
+//! lexiumParseFields()
+//! values of a reply made of several numbers separated by commas, e.g. to the combined poll query
+//! PR P,",",MV,",",I1; every field must be a number and nothing may follow the last one
+//
+//! @param[in]  reply   received line without terminator
+//! @param[in]  len     its length
+//! @param[in]  command command that was sent without device name, NULL to skip the echo check
+//! @param[out] values  count numbers, the fields before a bad one are set on error
+//! @param[in]  count   number of fields expected
+////////////////////////////////////////
+LexiumReplyError lexiumParseFields(const char *reply, size_t len, const char *command, long *values, int count)
+{
+	const char *p = reply, *last = reply + len;
+	LexiumReplyError error;
+	LexiumParseResult result;
+
+	// whole reply first, so an echo or prompt is not taken for values
+	error = lexiumCheckReply(reply, len, command);
+	if (error) return error;
+	while (p < last && isBlank(*p)) p++;
+	while (last > p && isBlank(last[-1])) last--;
+	for (int i=0; i<count; i++) {
+		if (i > 0) {
+			if (p == last || *p != ',') return lexiumReplyInvalid;
+			p++;
+		}
+		result = lexiumFromChars(p, last, &values[i]);
+		if (result.error) return result.error;
+		p = result.ptr;
+	}
+	return p == last ? lexiumReplyOk : lexiumReplyInvalid;
+}
+
+const char *lexiumReplyErrorString(LexiumReplyError error)
+{
+	switch (error) {
+	case lexiumReplyOk: return "ok";
+	case lexiumReplyEmpty: return "empty reply";
+	case lexiumReplyPrompt: return "error prompt";
+	case lexiumReplyEcho: return "command echoed";
+	case lexiumReplyInvalid: return "not a number";
+	case lexiumReplyOverflow: return "number out of range";
+	}
+	return "unknown";
+}
@@ -0,0 +1,44 @@
+//  Description : Validating parser for MCode replies.
+//                Works in place on the receive buffer like std::from_chars: numbers are converted
+//                without locale or copies, the whole token must be a number, and empty replies,
+//                echoed commands and ? error prompts are reported instead of reading as 0.
+
+#ifndef LexiumReply_H
+#define LexiumReply_H
+
+#include <stddef.h>
+
+enum LexiumReplyError
+{
+	lexiumReplyOk = 0,
+	lexiumReplyEmpty,       // nothing but blanks
+	lexiumReplyPrompt,      // ? error prompt or > command prompt, drive not in EM=2
+	lexiumReplyEcho,        // the command came back, drive echoing (EM=0)
+	lexiumReplyInvalid,     // not a number, or characters left after it
+	lexiumReplyOverflow     // number out of range
+};
+
+struct LexiumParseResult
+{
+	const char *ptr;        // first character after the number, first on error
+	LexiumReplyError error;
+};
+
+// one number at first, no leading blanks or '+', like std::from_chars
+LexiumParseResult lexiumFromChars(const char *first, const char *last, long *value);
+// [-]digits[.digits], no exponent
+LexiumParseResult lexiumFromChars(const char *first, const char *last, double *value);
+
+// empty, prompt or echo of command (without device name, may be NULL)
+LexiumReplyError lexiumCheckReply(const char *reply, size_t len, const char *command);
+
+// a reply made of exactly one number, blanks around it allowed
+LexiumReplyError lexiumParseReply(const char *reply, size_t len, const char *command, long *value);
+LexiumReplyError lexiumParseReply(const char *reply, size_t len, const char *command, double *value);
+
+// a reply made of count numbers separated by commas, e.g. to PR P,",",MV, blanks only around the whole line
+LexiumReplyError lexiumParseFields(const char *reply, size_t len, const char *command, long *values, int count);
+
+const char *lexiumReplyErrorString(LexiumReplyError error);
+
+#endif // LexiumReply_H
@@ -0,0 +1,172 @@
+//! @File : LexiumStats.cpp
+//!         Timing statistics used by LexiumMotorController and LexiumMotorAxis.
+//!         Values are kept in log-spaced buckets so percentiles can be estimated
+//!         without storing samples; add() is a handful of arithmetic operations.
+//
+//  Revision History
+//  ----------------
+//  Initial version
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "LexiumStats.h"
+
+LexiumHistogram::LexiumHistogram()
+{
+	reset();
+}
+
+void LexiumHistogram::reset()
+{
+	count = 0;
+	sum = 0;
+	min = 0;
+	max = 0;
+	memset(buckets, 0, sizeof(buckets));
+}
+
+////////////////////////////////////////
+//! add()
+//! record one value
+//
+//! @param[in] value time in seconds
+////////////////////////////////////////
+void LexiumHistogram::add(double value)
+{
+	int i = 0;
+
+	if (value > LEXIUM_HIST_MIN) {
+		i = (int)(LEXIUM_HIST_STEPS_PER_OCTAVE * log2(value / LEXIUM_HIST_MIN));
+		if (i >= LEXIUM_HIST_BUCKETS) i = LEXIUM_HIST_BUCKETS - 1;
+	}
+	buckets[i]++;
+
+	if (count == 0 || value < min) min = value;
+	if (count == 0 || value > max) max = value;
+	sum += value;
+	count++;
+}
+
+double LexiumHistogram::mean() const
+{
+	return count ? sum / count : 0;
+}
+
+////////////////////////////////////////
+//! percentile()
+//! estimate a percentile from the buckets, accurate to about 20%
+//
+//! @param[in] fraction e.g. 0.99 for the 99th percentile
+//! @return upper edge of the bucket holding the percentile, clipped to min/max
+////////////////////////////////////////
+double LexiumHistogram::percentile(double fraction) const
+{
+	unsigned long target, seen = 0;
+	double value;
+
+	if (count == 0) return 0;
+	target = (unsigned long)ceil(fraction * count);
+	if (target < 1) target = 1;
+	for (int i=0; i<LEXIUM_HIST_BUCKETS; i++) {
+		seen += buckets[i];
+		if (seen >= target) {
+			value = LEXIUM_HIST_MIN * pow(2.0, (double)(i + 1) / LEXIUM_HIST_STEPS_PER_OCTAVE);
+			if (value > max) value = max;
+			if (value < min) value = min;
+			return value;
+		}
+	}
+	return max;
+}
+
+////////////////////////////////////////
+//! report()
+//! print count and distribution on one line, for the report() functions
+//
+//! @param[in] fp   output
+//! @param[in] name what the values are, starts the line
+////////////////////////////////////////
+void LexiumHistogram::report(FILE *fp, const char *name) const
+{
+	fprintf(fp, "%s: n %lu, min %.6f, mean %.6f, p50 %.6f, p90 %.6f, p99 %.6f, max %.6f s\n", name, count,
+	        min, mean(), percentile(0.5), percentile(0.9), percentile(0.99), max);
+}
+
+LexiumRttEstimator::LexiumRttEstimator()
+{
+	reset();
+}
+
+void LexiumRttEstimator::reset()
+{
+	samples = 0;
+	srtt = 0;
+	rttvar = 0;
+	backoff = 1;
+}
+
+////////////////////////////////////////
+//! add()
+//! record the round trip time of a transaction that got its reply
+//
+//! @param[in] rtt time in seconds
+////////////////////////////////////////
+void LexiumRttEstimator::add(double rtt)
+{
+	if (samples++ == 0) {
+		srtt = rtt;
+		rttvar = rtt / 2;
+	} else {
+		rttvar += (fabs(srtt - rtt) - rttvar) / 4;
+		srtt += (rtt - srtt) / 8;
+	}
+	backoff = 1;
+}
+
+////////////////////////////////////////
+//! timedOut()
+//! a transaction got no reply, its round trip time is unknown; wait twice as long next time
+////////////////////////////////////////
+void LexiumRttEstimator::timedOut()
+{
+	if (backoff < 64) backoff *= 2;
+}
+
+////////////////////////////////////////
+//! timeout()
+//! @param[in] floor   shortest timeout
+//! @param[in] ceiling longest timeout, also used until the first reply
+//! @return srtt + 4 rttvar, times the backoff, between floor and ceiling
+////////////////////////////////////////
+double LexiumRttEstimator::timeout(double floor, double ceiling) const
+{
+	double t;
+
+	if (samples == 0) return ceiling;
+	t = srtt + 4 * rttvar;
+	if (t < floor) t = floor;
+	t *= backoff;
+	return t < ceiling ? t : ceiling;
+}
+
+double lexiumElapsed(const epicsTimeStamp *ts)
+{
+	epicsTimeStamp now;
+
+	epicsTimeGetCurrent(&now);
+	return epicsTimeDiffInSeconds(&now, ts);
+}
+
+double lexiumThreadCpuTime()
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+	return 0;
+}
@@ -0,0 +1,61 @@
+//  Description : Low overhead timing statistics for the Lexium driver.
+//                Log-spaced histograms of I/O round trip, poll and move times,
+//                cheap enough to stay enabled in the poll path.
+
+#ifndef LexiumStats_H
+#define LexiumStats_H
+
+#include <stdio.h>
+#include <epicsTime.h>
+
+#define LEXIUM_HIST_BUCKETS 96            // covers 1us to ~16s
+#define LEXIUM_HIST_MIN 1e-6              // lower edge of first bucket, seconds
+#define LEXIUM_HIST_STEPS_PER_OCTAVE 4    // bucket width is a factor of 2^(1/4)
+#define LEXIUM_IO_STATS_PERIOD 10.0       // seconds between updates of the Lexium_IO* parameters
+
+////////////////////////////////////
+// LexiumHistogram class
+// count/min/mean/max plus log-spaced buckets for percentiles, values in seconds
+////////////////////////////////////
+class LexiumHistogram
+{
+public:
+	LexiumHistogram();
+	void reset();
+	void add(double value);
+	double mean() const;
+	double percentile(double fraction) const;
+	void report(FILE *fp, const char *name) const;
+
+	unsigned long count;
+	double sum;
+	double min;
+	double max;
+	unsigned long buckets[LEXIUM_HIST_BUCKETS];
+};
+
+////////////////////////////////////
+// LexiumRttEstimator class
+// smoothed round trip time and its variation, TCP retransmission timeout style (RFC 6298)
+////////////////////////////////////
+class LexiumRttEstimator
+{
+public:
+	LexiumRttEstimator();
+	void reset();
+	void add(double rtt);
+	void timedOut();
+	double timeout(double floor, double ceiling) const;
+
+	unsigned long samples;
+	double srtt;       // smoothed round trip time, seconds
+	double rttvar;     // smoothed mean deviation, seconds
+	int backoff;       // timeout multiplier, doubled by each timeout until the next reply
+};
+
+// seconds since ts
+double lexiumElapsed(const epicsTimeStamp *ts);
+// CPU time used by the calling thread in seconds, 0 where not available
+double lexiumThreadCpuTime();
+
+#endif // LexiumStats_H
@@ -0,0 +1,166 @@
+//! @File : lexiumReplyTest.cpp
+//!         Unit tests of the MCode reply parser, see LexiumReply.h.
+//!         Run with make runtests, or make tapfiles for the TAP output.
+//
+//  Revision History
+//  ----------------
+//  Initial version
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+
+#include <epicsUnitTest.h>
+#include <testMain.h>
+
+#include "LexiumReply.h"
+
+static LexiumReplyError parseLong(const char *reply, const char *command, long *value)
+{
+	return lexiumParseReply(reply, strlen(reply), command, value);
+}
+
+static LexiumReplyError parseDouble(const char *reply, const char *command, double *value)
+{
+	return lexiumParseReply(reply, strlen(reply), command, value);
+}
+
+static void testError(const char *reply, const char *command, LexiumReplyError expected)
+{
+	long value = 42;
+	LexiumReplyError error = parseLong(reply, command, &value);
+
+	testOk(error == expected && value == 42, "'%s' to '%s': %s", reply, command ? command : "", lexiumReplyErrorString(error));
+}
+
+static void testValue(const char *reply, long expected)
+{
+	long value = 0;
+	LexiumReplyError error = parseLong(reply, "PR P", &value);
+
+	testOk(error == lexiumReplyOk && value == expected, "'%s' reads %ld: %s %ld", reply, expected, lexiumReplyErrorString(error), value);
+}
+
+static LexiumReplyError parseFields(const char *reply, const char *command, long *values, int count)
+{
+	return lexiumParseFields(reply, strlen(reply), command, values, count);
+}
+
+static void testEmptyAndPrompts()
+{
+	long value = 42;
+
+	testDiag("empty replies and prompts");
+	testError("", "PR P", lexiumReplyEmpty);
+	testError("   ", "PR P", lexiumReplyEmpty);
+	testError(" \t ", "PR P", lexiumReplyEmpty);
+	testOk(parseLong("\r\n", "PR P", &value) == lexiumReplyEmpty && value == 42, "line end only: empty reply");
+	testError("?", "PR P", lexiumReplyPrompt);
+	testError("? 20", "PR P", lexiumReplyPrompt);
+	testError(" ?", "PR P", lexiumReplyPrompt);
+	testError(">", "PR P", lexiumReplyPrompt);
+	testError("> ", NULL, lexiumReplyPrompt);
+}
+
+static void testEchoes()
+{
+	testDiag("echoed commands");
+	testError("PR P", "PR P", lexiumReplyEcho);
+	testError("PR P 100", "PR P", lexiumReplyEcho);
+	testError("APR P", "PR P", lexiumReplyEcho);
+	testError(" BPR MV", "PR MV", lexiumReplyEcho);
+	testError("PR P", NULL, lexiumReplyInvalid);
+	testValue("100", 100);
+}
+
+static void testInvalid()
+{
+	testDiag("numbers with something left over");
+	testError("12x", "PR P", lexiumReplyInvalid);
+	testError("1 2", "PR P", lexiumReplyInvalid);
+	testError("x12", "PR P", lexiumReplyInvalid);
+	testError("-", "PR P", lexiumReplyInvalid);
+	testError("- 1", "PR P", lexiumReplyInvalid);
+	testError("+1", "PR P", lexiumReplyInvalid);
+	testError("--1", "PR P", lexiumReplyInvalid);
+	testValue("  -25  ", -25);
+	testValue("0", 0);
+}
+
+static void testOverflow()
+{
+	char buff[32];
+	long value = 0;
+	LexiumParseResult result;
+
+	testDiag("range of long");
+	sprintf(buff, "%ld", LONG_MAX);
+	testValue(buff, LONG_MAX);
+	buff[strlen(buff) - 1]++;  // LONG_MAX ends in 7, LONG_MAX+1
+	testError(buff, "PR P", lexiumReplyOverflow);
+	sprintf(buff, "%ld", LONG_MIN);
+	testValue(buff, LONG_MIN);
+	buff[strlen(buff) - 1]++;  // LONG_MIN ends in 8, LONG_MIN-1
+	testError(buff, "PR P", lexiumReplyOverflow);
+	testError("123456789012345678901234567890", "PR P", lexiumReplyOverflow);
+
+	// the overflowing number is skipped, the next field can still be found
+	strcpy(buff, "99999999999999999999,1");
+	result = lexiumFromChars(buff, buff + strlen(buff), &value);
+	testOk(result.error == lexiumReplyOverflow && *result.ptr == ',', "overflow ends at the comma");
+}
+
+static void testDecimals()
+{
+	double d = 0;
+	long value = 0;
+	const char *reply = "1.5";
+	LexiumParseResult result;
+
+	testDiag("decimals");
+	testError("1.5", "PR P", lexiumReplyInvalid);
+	testError("1.", "PR P", lexiumReplyInvalid);
+	result = lexiumFromChars(reply, reply + strlen(reply), &value);
+	testOk(result.error == lexiumReplyOk && value == 1 && *result.ptr == '.', "long conversion of 1.5 stops at the point");
+
+	testOk(parseDouble("1.5", "PR VR", &d) == lexiumReplyOk && d == 1.5, "1.5 as double");
+	testOk(parseDouble("-0.25", "PR VR", &d) == lexiumReplyOk && d == -0.25, "-0.25 as double");
+	testOk(parseDouble(".5", "PR VR", &d) == lexiumReplyOk && d == 0.5, ".5 as double");
+	testOk(parseDouble("3.", "PR VR", &d) == lexiumReplyOk && d == 3, "3. as double");
+	d = 42;
+	testOk(parseDouble(".", "PR VR", &d) == lexiumReplyInvalid && d == 42, ". is not a number");
+	testOk(parseDouble("1.5.2", "PR VR", &d) == lexiumReplyInvalid && d == 42, "1.5.2 is not a number");
+	testOk(parseDouble("1e3", "PR VR", &d) == lexiumReplyInvalid && d == 42, "no exponent");
+}
+
+static void testCombined()
+{
+	long v[5] = {0, 0, 0, 0, 0};
+	const char *command = "PR P,\",\",MV,\",\",I1";
+
+	testDiag("combined replies");
+	testOk(parseFields(" -1200,1,0 \r", command, v, 3) == lexiumReplyOk && v[0] == -1200 && v[1] == 1 && v[2] == 0, "three fields, blanks around");
+	testOk(parseFields("5,0,1,0,73", command, v, 5) == lexiumReplyOk && v[0] == 5 && v[4] == 73, "five fields");
+	testOk(parseFields("5,0", command, v, 3) == lexiumReplyInvalid, "field missing");
+	testOk(parseFields("5,0,1,0", command, v, 3) == lexiumReplyInvalid, "field left over");
+	testOk(parseFields("5,,1", command, v, 3) == lexiumReplyInvalid, "empty field");
+	testOk(parseFields("5,0,1,", command, v, 3) == lexiumReplyInvalid, "trailing comma");
+	testOk(parseFields("5, 0,1", command, v, 3) == lexiumReplyInvalid, "blank after a comma");
+	testOk(parseFields("5,x,1", command, v, 3) == lexiumReplyInvalid, "field not a number");
+	testOk(parseFields("5,0,99999999999999999999", command, v, 3) == lexiumReplyOverflow, "field out of range");
+	testOk(parseFields("?", command, v, 3) == lexiumReplyPrompt, "prompt");
+	testOk(parseFields("APR P,\",\",MV,\",\",I1", command, v, 3) == lexiumReplyEcho, "echo in party mode");
+	testOk(parseFields("", command, v, 3) == lexiumReplyEmpty, "empty");
+}
+
+MAIN(lexiumReplyTest)
+{
+	testPlan(52);
+	testEmptyAndPrompts();
+	testEchoes();
+	testInvalid();
+	testOverflow();
+	testDecimals();
+	testCombined();
+	return testDone();
+}
@@ -0,0 +1,825 @@
+//! @File : lexiumSim.cpp
+//!         Simulator for Lexium MDrive Ethernet units, to run the LexiumMotor driver without hardware.
+//!
+//!         Each simulated drive listens on its own TCP port (basePort, basePort+1, ...) and answers the
+//!         MCode subset used by the driver, with the same framing as a drive set to EM=2:
+//!         commands end with CR, replies end with CR LF, writes are not acknowledged.
+//!         Supported: PR P/MV/VR/EE/VI/VM/A/ER/LR/ST/C1/C2/IS/I<n> (several items per PR allowed),
+//!         MA, MR, SL, HM, P=, C1=, C2=, VI=, VM=, A=, EE=, ER=, S, CF, CP, PG, EX, ESC
+//!
+//!         Programs uploaded with PG are stored but not interpreted. While one runs (EX) the simulator only
+//!         emulates its PR "<text> DONE", "<text> STALL" and "<text> LIMIT" lines: at the end of every move
+//!         it prints the LIMIT line after a limit switch error and the DONE line otherwise, like the event
+//!         program the driver loads for Lexium_EVENTMODE.
+//!
+//!         Motion follows a trapezoidal profile (start at VI, ramp at A up to VM, ramp down to stop on target).
+//!         Input 1 is a home switch, input 2 the + limit and input 3 the - limit, as reported by PR IS.
+//!
+//!         With -y each port is a party mode (PY=1) multidrop link shared by several drives: every command
+//!         starts with the one character device name (DN) of the drive it is for.
+//!
+//!         With -m the ports speak Modbus/TCP instead of MCode, Read Holding Registers and Write Multiple
+//!         Registers on the register map of LexiumModbus.h. Writes run the matching MCode command; one that
+//!         sets ER is answered with exception 4 and leaves ER set, as for LexiumModbusTransport(1).
+//!
+//!  Usage : lexiumSim [-p basePort] [-n numDrives] [-l limit] [-c] [-y names] [-s delay] [-m]
+//!    -p  TCP port of the first drive (default 5030)
+//!    -n  number of drives, or of party mode links with -y (default 4)
+//!    -l  limit switches at +/- this position in counts (default 1000000)
+//!    -c  reject PR with more than one item with a ? prompt, like firmware without combined print support
+//!    -y  party mode, one drive per character of names on each port, e.g. -y ABC
+//!    -s  send every reply this many ms late, like a slow link (default 0)
+//!    -m  Modbus/TCP instead of MCode, not with -y
+//
+//  Revision History
+//  ----------------
+//  Initial version
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <errno.h>
+
+#include <epicsThread.h>
+#include <epicsMutex.h>
+#include <epicsTime.h>
+#include <epicsStdio.h>
+#include <epicsGetopt.h>
+#include <osiSock.h>
+
+#include "LexiumModbus.h"
+
+#define SIM_DEFAULT_PORT 5030
+#define SIM_DEFAULT_DRIVES 4
+#define SIM_DEFAULT_LIMIT 1000000
+#define SIM_NUM_INPUTS 4
+#define SIM_HOME_WIDTH 200      // home switch is active within +/- this many counts of home position
+#define SIM_STEP 0.001          // motion integration step in seconds
+#define SIM_LINE_LEN 256
+#define SIM_VERSION "3.009"
+#define SIM_PROGRAM_LEN 16384   // program space
+#define SIM_EVENT_CHECK 0.005   // seconds between checks for the end of a move while a program runs
+
+enum SimMode { simIdle, simMove, simJog, simHomeSeek, simHomeCreep };
+
+////////////////////////////////////
+// SimDrive
+// state of one simulated drive, shared by all clients connected to it
+////////////////////////////////////
+struct SimDrive
+{
+	int index;
+	int port;
+	char name;              // DN in party mode, 0 otherwise
+	SimDrive *pNextParty;   // next drive on the same party mode link
+	epicsMutexId lock;
+	epicsTimeStamp lastUpdate;
+
+	SimMode mode;
+	double position;        // P, counts
+	double velocity;        // current signed velocity, counts/s
+	double target;          // MA/MR target
+	double jogVelocity;     // SL setpoint
+	int homeDirection;      // +1/-1 while seeking the home switch
+
+	long vi, vm, accel;     // VI, VM, A
+	long c1, c2;            // C1, C2 counters
+	int ee;                 // encoder enable
+	int errorCode;          // ER
+	int lockedRotor;        // LR
+	int inputType[SIM_NUM_INPUTS+1];  // IS type of inputs 1-4
+	double plusLimit, minusLimit, homePosition;
+
+	char program[SIM_PROGRAM_LEN];  // lines stored by PG, separated by newlines
+	size_t programLen;
+	int programMode;        // between PG <address> and PG
+	int programRunning;     // started by EX, stopped by ESC or CP
+	int eventMoving;        // MV when the running program last looked at it
+	char event[SIM_LINE_LEN];  // unsolicited line waiting to be sent
+};
+
+struct SimClient
+{
+	SimDrive *pDrive;
+	SOCKET sock;
+};
+
+static int rejectCombinedPrint = 0;
+static double replyDelay = 0;    // seconds, -s
+static int modbusMode = 0;       // -m
+
+////////////////////////////////////////////////////////
+// motion model
+////////////////////////////////////////////////////////
+
+static void simStop(SimDrive *d)
+{
+	d->mode = simIdle;
+	d->velocity = 0;
+}
+
+static int simInputActive(SimDrive *d, int input)
+{
+	switch (d->inputType[input]) {
+	case 1: return fabs(d->position - d->homePosition) <= SIM_HOME_WIDTH;
+	case 2: return d->position >= d->plusLimit;
+	case 3: return d->position <= d->minusLimit;
+	default: return 0;
+	}
+}
+
+static int simHomeInput(SimDrive *d)
+{
+	for (int i=1; i<=SIM_NUM_INPUTS; i++) {
+		if (d->inputType[i] == 1) return i;
+	}
+	return 0;
+}
+
+static void simStep(SimDrive *d, double h)
+{
+	double accel = d->accel > 0 ? d->accel : 1;
+	double vi = fabs((double)d->vi);
+	double vm = d->vm != 0 ? fabs((double)d->vm) : 1;
+	double remaining, speed, stopDistance, step, dv;
+	int dir;
+
+	switch (d->mode) {
+	case simIdle:
+		return;
+
+	case simMove:
+		remaining = d->target - d->position;
+		dir = remaining >= 0 ? 1 : -1;
+		speed = fabs(d->velocity);
+		if (speed < vi) speed = vi;  // moves start at base velocity
+		stopDistance = (speed*speed - vi*vi) / (2*accel);
+		if (fabs(remaining) <= stopDistance) {
+			speed -= accel*h;
+			if (speed < vi) speed = vi;
+		} else if (speed < vm) {
+			speed += accel*h;
+			if (speed > vm) speed = vm;
+		}
+		if (speed <= 0) speed = accel*h;  // VI=0, keep creeping
+		step = speed*h;
+		if (step >= fabs(remaining)) {
+			d->position = d->target;
+			simStop(d);
+			return;
+		}
+		d->position += dir*step;
+		d->velocity = dir*speed;
+		break;
+
+	case simJog:
+		dv = d->jogVelocity - d->velocity;
+		if (fabs(dv) <= accel*h) d->velocity = d->jogVelocity;
+		else d->velocity += (dv > 0 ? 1 : -1) * accel*h;
+		if (d->jogVelocity == 0 && fabs(d->velocity) <= vi) {  // below base velocity the drive stops at once
+			simStop(d);
+			return;
+		}
+		d->position += d->velocity*h;
+		break;
+
+	case simHomeSeek:  // slew at VM until the switch is found
+		d->velocity = d->homeDirection*vm;
+		d->position += d->velocity*h;
+		if (simInputActive(d, simHomeInput(d))) d->mode = simHomeCreep;
+		break;
+
+	case simHomeCreep:  // creep back at VI until the switch is released
+		d->velocity = -d->homeDirection*(vi > 0 ? vi : 1000);
+		d->position += d->velocity*h;
+		if (!simInputActive(d, simHomeInput(d))) simStop(d);
+		break;
+	}
+
+	// limit switches stop motion towards them
+	if (d->velocity > 0 && d->position >= d->plusLimit) {
+		d->position = d->plusLimit;
+		simStop(d);
+		d->errorCode = 83;
+	} else if (d->velocity < 0 && d->position <= d->minusLimit) {
+		d->position = d->minusLimit;
+		simStop(d);
+		d->errorCode = 84;
+	}
+}
+
+// bring the drive state up to the current time, must be called with the drive locked
+static void simUpdate(SimDrive *d)
+{
+	epicsTimeStamp now;
+	double dt, h;
+
+	epicsTimeGetCurrent(&now);
+	dt = epicsTimeDiffInSeconds(&now, &d->lastUpdate);
+	d->lastUpdate = now;
+	while (dt > 0 && d->mode != simIdle) {
+		h = dt < SIM_STEP ? dt : SIM_STEP;
+		simStep(d, h);
+		dt -= h;
+	}
+}
+
+////////////////////////////////////////////////////////
+// MCode command handling
+////////////////////////////////////////////////////////
+
+// value of one PR item, returns 0 if the variable is unknown
+static int simPrintItem(SimDrive *d, const char *name, char *out, size_t outSize)
+{
+	if (!strcmp(name, "P")) epicsSnprintf(out, outSize, "%ld", (long)floor(d->position + 0.5));
+	else if (!strcmp(name, "MV")) epicsSnprintf(out, outSize, "%d", d->mode != simIdle);
+	else if (!strcmp(name, "VR")) epicsSnprintf(out, outSize, "%s", SIM_VERSION);
+	else if (!strcmp(name, "EE")) epicsSnprintf(out, outSize, "%d", d->ee);
+	else if (!strcmp(name, "VI")) epicsSnprintf(out, outSize, "%ld", d->vi);
+	else if (!strcmp(name, "VM")) epicsSnprintf(out, outSize, "%ld", d->vm);
+	else if (!strcmp(name, "A")) epicsSnprintf(out, outSize, "%ld", d->accel);
+	else if (!strcmp(name, "ER")) epicsSnprintf(out, outSize, "%d", d->errorCode);
+	else if (!strcmp(name, "LR")) epicsSnprintf(out, outSize, "%d", d->lockedRotor);
+	else if (!strcmp(name, "ST")) epicsSnprintf(out, outSize, "%d", 0);  // never stalls
+	else if (!strcmp(name, "C1")) epicsSnprintf(out, outSize, "%ld", d->c1);
+	else if (!strcmp(name, "C2")) epicsSnprintf(out, outSize, "%ld", d->c2);
+	else if (name[0] == 'I' && name[1] >= '1' && name[1] <= '0'+SIM_NUM_INPUTS && name[2] == '\0')
+		epicsSnprintf(out, outSize, "%d", simInputActive(d, name[1]-'0'));
+	else return 0;
+	return 1;
+}
+
+// PR <item>[,<item>...], items are variables or "quoted text"
+// returns 0 and sets ER if nothing is to be sent back
+static int simPrint(SimDrive *d, const char *args, char *reply, size_t replySize)
+{
+	char name[SIM_LINE_LEN], item[SIM_LINE_LEN];
+	const char *p = args;
+	size_t len = 0;
+	int numItems = 0;
+
+	reply[0] = '\0';
+
+	// PR IS lists the input setup, one line per input
+	if (!strcmp(args, "IS")) {
+		for (int i=1; i<=SIM_NUM_INPUTS; i++) {
+			len += epicsSnprintf(reply + len, replySize - len, "IS = %d, %d, 1\r\n", i, d->inputType[i]);
+		}
+		epicsSnprintf(reply + len, replySize - len, "IS = 6, 0, 1\r\n");
+		return 1;
+	}
+
+	while (*p) {
+		while (*p == ' ') p++;
+		if (*p == '"') {  // text
+			const char *end = strchr(p+1, '"');
+			if (!end) { d->errorCode = 24; return 0; }
+			len += epicsSnprintf(reply + len, replySize - len, "%.*s", (int)(end - p - 1), p + 1);
+			p = end + 1;
+		} else {  // variable
+			size_t n = 0;
+			while (isalnum((unsigned char)*p) && n < sizeof(name)-1) name[n++] = *p++;
+			name[n] = '\0';
+			if (!simPrintItem(d, name, item, sizeof(item))) { d->errorCode = 35; return 0; }
+			len += epicsSnprintf(reply + len, replySize - len, "%s", item);
+		}
+		numItems++;
+		while (*p == ' ') p++;
+		if (*p == ',') p++;
+		else if (*p) { d->errorCode = 38; return 0; }
+		if (len >= replySize) { d->errorCode = 63; return 0; }
+	}
+	if (numItems > 1 && rejectCombinedPrint) { // answered with the ? prompt of a command the firmware doesn't take
+		d->errorCode = 38;
+		epicsSnprintf(reply, replySize, "?\r\n");
+		return 1;
+	}
+	if (numItems == 0) {
+		d->errorCode = 38;
+		return 0;
+	}
+	epicsSnprintf(reply + len, replySize - len, "\r\n");
+	return 1;
+}
+
+////////////////////////////////////////////////////////
+// program space
+////////////////////////////////////////////////////////
+
+// copy the text of the program's PR "... <word>" line to out, returns 0 if there is none
+static int simProgramText(SimDrive *d, const char *word, char *out, size_t outSize)
+{
+	const char *line, *start, *end;
+	size_t wordLen = strlen(word);
+
+	for (line = d->program; line < d->program + d->programLen; line = strchr(line, '\n') + 1) {
+		while (*line == ' ') line++;
+		if (strncmp(line, "PR", 2)) continue;
+		start = strchr(line, '"');
+		if (!start || start > strchr(line, '\n')) continue;
+		end = strchr(start + 1, '"');
+		if (!end || end > strchr(line, '\n')) continue;
+		if ((size_t)(end - start - 1) < wordLen || strncmp(end - wordLen, word, wordLen)) continue;
+		epicsSnprintf(out, outSize, "%.*s\r\n", (int)(end - start - 1), start + 1);
+		return 1;
+	}
+	return 0;
+}
+
+// 1 if the program contains LB <label>
+static int simProgramLabel(SimDrive *d, const char *label)
+{
+	const char *line;
+	char name[8];
+
+	for (line = d->program; line < d->program + d->programLen; line = strchr(line, '\n') + 1) {
+		if (sscanf(line, " LB %7s", name) == 1 && !strcmp(name, label)) return 1;
+	}
+	return 0;
+}
+
+// let the running program see the end of a move, must be called with the drive locked
+static void simCheckEvent(SimDrive *d)
+{
+	int moving = d->mode != simIdle;
+
+	if (d->programRunning && d->eventMoving && !moving && !d->event[0]) {
+		if (d->errorCode == 83 || d->errorCode == 84) simProgramText(d, "LIMIT", d->event, sizeof(d->event));
+		else simProgramText(d, "DONE", d->event, sizeof(d->event));
+	}
+	d->eventMoving = moving;
+}
+
+// process one command line, reply is left empty for commands that are not acknowledged
+static void simCommand(SimDrive *d, char *line, char *reply, size_t replySize)
+{
+	char name[8];
+	size_t n = 0;
+	char *p = line;
+	long value = 0;
+	int hasValue = 0, assign = 0;
+
+	reply[0] = '\0';
+	epicsMutexLock(d->lock);
+	simUpdate(d);
+
+	while (*p == ' ') p++;
+	if (d->programMode) {  // store the line, a bare PG ends program mode
+		if (toupper((unsigned char)p[0]) == 'P' && toupper((unsigned char)p[1]) == 'G' && strspn(p + 2, " ") == strlen(p + 2)) {
+			d->programMode = 0;
+		} else if (d->programLen + strlen(p) + 1 >= sizeof(d->program)) {
+			d->errorCode = 45;
+		} else {
+			d->programLen += sprintf(d->program + d->programLen, "%s\n", p);
+		}
+		epicsMutexUnlock(d->lock);
+		return;
+	}
+
+	while (isalnum((unsigned char)*p) && n < sizeof(name)-1) name[n++] = toupper((unsigned char)*p++);
+	name[n] = '\0';
+	while (*p == ' ') p++;
+
+	if (!strcmp(name, "PR")) {
+		simPrint(d, p, reply, replySize);
+		epicsMutexUnlock(d->lock);
+		return;
+	}
+
+	if (*p == '=') {
+		assign = 1;
+		p++;
+	}
+	if (*p) {
+		char *end;
+		value = strtol(p, &end, 10);
+		hasValue = (end != p);
+	}
+
+	if (assign) {
+		if (!hasValue) d->errorCode = 21;
+		else if (!strcmp(name, "P")) { if (d->mode == simIdle) d->position = value; }
+		else if (!strcmp(name, "C1")) d->c1 = value;
+		else if (!strcmp(name, "C2")) d->c2 = value;
+		else if (!strcmp(name, "VI")) { if (value >= d->vm) d->errorCode = 22; else d->vi = value; }
+		else if (!strcmp(name, "VM")) { if (value <= d->vi) d->errorCode = 23; else d->vm = value; }
+		else if (!strcmp(name, "A")) d->accel = value;
+		else if (!strcmp(name, "EE")) d->ee = value ? 1 : 0;
+		else if (!strcmp(name, "ER")) d->errorCode = value;
+		else d->errorCode = 20;
+	} else if (!strcmp(name, "MA") || !strcmp(name, "MR")) {
+		if (!hasValue) d->errorCode = 38;
+		else if (d->mode == simHomeSeek || d->mode == simHomeCreep) d->errorCode = 85;
+		else {
+			d->target = (name[1] == 'A') ? value : d->position + value;
+			d->mode = simMove;
+		}
+	} else if (!strcmp(name, "SL")) {
+		if (!hasValue) d->errorCode = 38;
+		else if (value != 0 || d->mode != simIdle) {
+			d->jogVelocity = value;
+			d->mode = simJog;
+		}
+	} else if (!strcmp(name, "HM")) {
+		if (d->mode != simIdle) d->errorCode = 85;
+		else if (!simHomeInput(d)) d->errorCode = 80;
+		else {
+			// HM 1/2 search in minus direction, HM 3/4 in plus direction
+			d->homeDirection = (value >= 3) ? 1 : -1;
+			d->mode = simInputActive(d, simHomeInput(d)) ? simHomeCreep : simHomeSeek;
+		}
+	} else if (!strcmp(name, "S")) {
+		if (d->mode != simIdle) d->errorCode = 73;
+	} else if (!strcmp(name, "CP")) {
+		if (d->mode != simIdle) d->errorCode = 74;
+		else if (d->programRunning) d->errorCode = 44;
+		else d->programLen = 0;
+	} else if (!strcmp(name, "PG")) {
+		if (!hasValue) d->errorCode = 46;
+		else if (d->programRunning) d->errorCode = 44;
+		else d->programMode = 1;
+	} else if (!strcmp(name, "EX")) {
+		char label[8] = "";
+		sscanf(p, "%7s", label);
+		if (!simProgramLabel(d, label)) d->errorCode = 30;
+		else {
+			d->programRunning = 1;
+			d->eventMoving = d->mode != simIdle;
+		}
+	} else if (!strcmp(name, "CF")) {
+		d->lockedRotor = 0;
+		d->errorCode = 0;
+	} else if (name[0]) {
+		d->errorCode = 20;
+	}
+	epicsMutexUnlock(d->lock);
+}
+
+////////////////////////////////////////////////////////
+// TCP server, one listening socket per drive and one thread per client
+////////////////////////////////////////////////////////
+
+static void simClientThread(void *pPvt)
+{
+	SimClient *pClient = (SimClient *)pPvt;
+	char inbuff[SIM_LINE_LEN];
+	char reply[SIM_LINE_LEN];
+	char buff[SIM_LINE_LEN];
+	size_t len = 0;
+	int n;
+	fd_set readFds;
+	struct timeval timeout;
+
+	while (1) {
+		// wake up now and then to send the lines printed by a running program
+		FD_ZERO(&readFds);
+		FD_SET(pClient->sock, &readFds);
+		timeout.tv_sec = 0;
+		timeout.tv_usec = (long)(SIM_EVENT_CHECK * 1e6);
+		n = select((int)pClient->sock + 1, &readFds, NULL, NULL, &timeout);
+		if (n < 0) break;
+		for (SimDrive *d = pClient->pDrive; d; d = d->pNextParty) {
+			epicsMutexLock(d->lock);
+			if (d->programRunning) {
+				simUpdate(d);
+				simCheckEvent(d);
+			}
+			if (d->event[0]) {
+				send(pClient->sock, d->event, strlen(d->event), 0);
+				d->event[0] = '\0';
+			}
+			epicsMutexUnlock(d->lock);
+		}
+		if (n == 0) continue;
+		if ((n = recv(pClient->sock, buff, sizeof(buff), 0)) <= 0) break;
+		for (int i=0; i<n; i++) {
+			if (buff[i] == 0x1b) {  // ESC stops the program and motion straight away
+				for (SimDrive *d = pClient->pDrive; d; d = d->pNextParty) {
+					epicsMutexLock(d->lock);
+					d->programRunning = 0;
+					simStop(d);
+					epicsMutexUnlock(d->lock);
+				}
+			} else if (buff[i] == '\r' || buff[i] == '\n') {  // end of command
+				inbuff[len] = '\0';
+				SimDrive *d = pClient->pDrive;
+				char *pCmd = inbuff;
+				if (d->name) {  // party mode, first character selects the drive, others stay silent
+					while (d && d->name != inbuff[0]) d = d->pNextParty;
+					pCmd++;
+				}
+				if (len > 0 && d) {
+					simCommand(d, pCmd, reply, sizeof(reply));
+					// a move that ended before the command is reported ahead of its reply, as the drive would
+					epicsMutexLock(d->lock);
+					simCheckEvent(d);
+					if (d->event[0]) {
+						send(pClient->sock, d->event, strlen(d->event), 0);
+						d->event[0] = '\0';
+					}
+					epicsMutexUnlock(d->lock);
+					if (reply[0] && replyDelay > 0) epicsThreadSleep(replyDelay);
+					if (reply[0]) send(pClient->sock, reply, strlen(reply), 0);
+				}
+				len = 0;
+			} else if (len < sizeof(inbuff)-1) {
+				inbuff[len++] = buff[i];
+			}
+		}
+	}
+	epicsSocketDestroy(pClient->sock);
+	delete pClient;
+}
+
+////////////////////////////////////////////////////////
+// Modbus/TCP, one thread per client
+////////////////////////////////////////////////////////
+
+// one entry of the register map; item is read with PR, command is run when the value is written
+struct SimRegister
+{
+	int addr;
+	int width;              // registers, 2 for 32 bit values
+	const char *item;       // NULL if the register reads as 0
+	const char *command;    // value is appended if it ends with '=' or ' ', NULL if read only
+};
+
+static const SimRegister simRegisters[] = {
+	{LEXIUM_MB_P, 2, "P", NULL},
+	{LEXIUM_MB_MV, 1, "MV", NULL},
+	{LEXIUM_MB_IN, 1, NULL, NULL},      // inputs, see simReadRegister()
+	{LEXIUM_MB_ER, 1, "ER", NULL},
+	{LEXIUM_MB_LR, 1, "LR", NULL},
+	{LEXIUM_MB_ST, 1, "ST", NULL},
+	{LEXIUM_MB_VI, 2, "VI", "VI="},
+	{LEXIUM_MB_VM, 2, "VM", "VM="},
+	{LEXIUM_MB_A, 2, "A", "A="},
+	{LEXIUM_MB_EE, 1, "EE", "EE="},
+	{LEXIUM_MB_VR, 1, "VR", NULL},
+	{LEXIUM_MB_IS, LEXIUM_MB_NUM_INPUTS, NULL, NULL},  // input types, see simReadRegister()
+	{LEXIUM_MB_MA, 2, NULL, "MA "},
+	{LEXIUM_MB_MR, 2, NULL, "MR "},
+	{LEXIUM_MB_SL, 2, NULL, "SL "},
+	{LEXIUM_MB_HM, 1, NULL, "HM "},
+	{LEXIUM_MB_PSET, 2, "P", "P="},
+	{LEXIUM_MB_C1, 2, "C1", "C1="},
+	{LEXIUM_MB_C2, 2, "C2", "C2="},
+	{LEXIUM_MB_CF, 1, NULL, "CF"},
+	{LEXIUM_MB_S, 1, NULL, "S"},
+};
+
+static const SimRegister *simFindRegister(int addr)
+{
+	for (size_t i=0; i<sizeof(simRegisters)/sizeof(simRegisters[0]); i++) {
+		if (addr >= simRegisters[i].addr && addr < simRegisters[i].addr + simRegisters[i].width) return &simRegisters[i];
+	}
+	return NULL;
+}
+
+static void simPut16(unsigned char *p, unsigned value)
+{
+	p[0] = (unsigned char)(value >> 8);
+	p[1] = (unsigned char)value;
+}
+
+static unsigned simGet16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+// value of one register, must be called with the drive locked; returns 0 if addr is not in the map
+static int simReadRegister(SimDrive *d, int addr, unsigned *value)
+{
+	const SimRegister *r = simFindRegister(addr);
+	char text[SIM_LINE_LEN];
+	long v = 0;
+
+	if (!r) return 0;
+	if (r->addr == LEXIUM_MB_IN) {
+		for (int i=1; i<=SIM_NUM_INPUTS; i++) v |= simInputActive(d, i) << (i-1);
+	} else if (r->addr == LEXIUM_MB_IS) {
+		v = d->inputType[addr - LEXIUM_MB_IS + 1];
+	} else if (r->item && simPrintItem(d, r->item, text, sizeof(text))) {
+		v = strchr(text, '.') ? (long)floor(atof(text) * 1000 + 0.5) : atol(text);  // VR in thousandths
+	}
+	if (r->width == 2) v = (addr == r->addr) ? (long)(((unsigned long)v >> 16) & 0xFFFF) : (v & 0xFFFF);
+	*value = (unsigned)v & 0xFFFF;
+	return 1;
+}
+
+// run the writes of one request in register order; returns the exception code, 0 if all were done
+static int simWriteRegisters(SimDrive *d, int addr, const unsigned char *data, int count)
+{
+	char line[SIM_LINE_LEN], reply[SIM_LINE_LEN];
+	int exception = 0;
+
+	epicsMutexLock(d->lock);  // recursive, simCommand() takes it again
+	for (int i=0; i<count && !exception; ) {
+		const SimRegister *r = simFindRegister(addr + i);
+		if (!r || !r->command || r->addr != addr + i || i + r->width > count) {
+			exception = 2;  // illegal data address, also for half a 32 bit value
+			break;
+		}
+		long value = simGet16(data + 2*i);
+		if (r->width == 2) value = (long)(epicsInt32)((value << 16) | simGet16(data + 2*i + 2));
+		size_t len = strlen(r->command);
+		if (r->command[len-1] == '=' || r->command[len-1] == ' ') epicsSnprintf(line, sizeof(line), "%s%ld", r->command, value);
+		else epicsSnprintf(line, sizeof(line), "%s", r->command);
+
+		// a command that sets ER is refused with an exception, otherwise ER keeps its last value
+		int savedError = d->errorCode;
+		d->errorCode = 0;
+		simCommand(d, line, reply, sizeof(reply));
+		if (d->errorCode) exception = 4;  // server device failure
+		else d->errorCode = savedError;
+		i += r->width;
+	}
+	epicsMutexUnlock(d->lock);
+	return exception;
+}
+
+// receive exactly len bytes, returns 0 if the client has gone
+static int simRecvAll(SOCKET sock, unsigned char *buff, size_t len)
+{
+	int n;
+
+	for (size_t got=0; got<len; got+=n) {
+		if ((n = recv(sock, (char *)buff + got, len - got, 0)) <= 0) return 0;
+	}
+	return 1;
+}
+
+static void simModbusThread(void *pPvt)
+{
+	SimClient *pClient = (SimClient *)pPvt;
+	SimDrive *d = pClient->pDrive;
+	unsigned char request[LEXIUM_MB_MAX_FRAME], response[LEXIUM_MB_MAX_FRAME];
+	unsigned length, addr, count, value;
+	size_t responseLen;
+	int exception;
+
+	while (simRecvAll(pClient->sock, request, LEXIUM_MB_HEADER_LEN)) {
+		length = simGet16(request + 4);
+		if (simGet16(request + 2) != 0 || length < 2 || length > LEXIUM_MB_MAX_FRAME - 6) break;  // not Modbus/TCP, drop the client
+		if (!simRecvAll(pClient->sock, request + LEXIUM_MB_HEADER_LEN, length - 1)) break;
+
+		memcpy(response, request, LEXIUM_MB_HEADER_LEN);
+		response[7] = request[7];
+		addr = simGet16(request + 8);
+		count = simGet16(request + 10);
+		exception = 0;
+		responseLen = 0;
+
+		if (request[7] == LEXIUM_MB_READ && length == 6) {
+			if (count < 1 || count > 125) exception = 3;
+			epicsMutexLock(d->lock);
+			simUpdate(d);
+			for (unsigned i=0; i<count && !exception; i++) {
+				if (!simReadRegister(d, addr + i, &value)) exception = 2;
+				simPut16(response + 9 + 2*i, value);
+			}
+			epicsMutexUnlock(d->lock);
+			response[8] = (unsigned char)(2 * count);
+			responseLen = 9 + 2 * count;
+		} else if (request[7] == LEXIUM_MB_WRITE && length >= 7) {
+			if (count < 1 || count > 123 || request[12] != 2 * count || length != 7 + 2 * count) exception = 3;
+			else exception = simWriteRegisters(d, addr, request + 13, count);
+			memcpy(response + 8, request + 8, 4);  // echo address and count
+			responseLen = 12;
+		} else {
+			exception = 1;  // illegal function
+		}
+
+		if (exception) {
+			response[7] = request[7] | 0x80;
+			response[8] = (unsigned char)exception;
+			responseLen = 9;
+		}
+		simPut16(response + 4, (unsigned)responseLen - 6);
+		if (replyDelay > 0) epicsThreadSleep(replyDelay);
+		send(pClient->sock, (char *)response, responseLen, 0);
+	}
+	epicsSocketDestroy(pClient->sock);
+	delete pClient;
+}
+
+static void simListenThread(void *pPvt)
+{
+	SimDrive *pDrive = (SimDrive *)pPvt;
+	osiSockAddr addr;
+	SOCKET listenSock, sock;
+	osiSocklen_t addrSize;
+	char threadName[20];
+	int flag = 1;
+
+	listenSock = epicsSocketCreate(AF_INET, SOCK_STREAM, 0);
+	if (listenSock == INVALID_SOCKET) {
+		fprintf(stderr, "lexiumSim: can't create socket for drive %d\n", pDrive->index);
+		return;
+	}
+	epicsSocketEnableAddressReuseDuringTimeWaitState(listenSock);
+	memset(&addr, 0, sizeof(addr));
+	addr.ia.sin_family = AF_INET;
+	addr.ia.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.ia.sin_port = htons(pDrive->port);
+	if (bind(listenSock, &addr.sa, sizeof(addr.ia)) || listen(listenSock, 5)) {
+		fprintf(stderr, "lexiumSim: can't listen on port %d: %s\n", pDrive->port, strerror(SOCKERRNO));
+		epicsSocketDestroy(listenSock);
+		return;
+	}
+
+	while (1) {
+		addrSize = sizeof(addr.ia);
+		sock = epicsSocketAccept(listenSock, &addr.sa, &addrSize);
+		if (sock == INVALID_SOCKET) continue;
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *)&flag, sizeof(flag));
+		SimClient *pClient = new SimClient;
+		pClient->pDrive = pDrive;
+		pClient->sock = sock;
+		sprintf(threadName, "simClient%d", pDrive->index);
+		epicsThreadCreate(threadName, epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackSmall),
+						  (EPICSTHREADFUNC)(modbusMode ? simModbusThread : simClientThread), (void *)pClient);
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: lexiumSim [-p basePort] [-n numDrives] [-l limit] [-c] [-y names] [-s delay] [-m]\n"
+					"  -p  TCP port of the first drive (default %d)\n"
+					"  -n  number of drives, or of party mode links with -y (default %d)\n"
+					"  -l  limit switches at +/- this position in counts (default %d)\n"
+					"  -c  reject PR with more than one item\n"
+					"  -y  party mode, one drive per character of names on each port\n"
+					"  -s  send every reply this many ms late\n"
+					"  -m  Modbus/TCP instead of MCode, not with -y\n",
+					SIM_DEFAULT_PORT, SIM_DEFAULT_DRIVES, SIM_DEFAULT_LIMIT);
+}
+
+int main(int argc, char *argv[])
+{
+	int basePort = SIM_DEFAULT_PORT;
+	int numDrives = SIM_DEFAULT_DRIVES;
+	double limit = SIM_DEFAULT_LIMIT;
+	const char *partyNames = "";
+	char threadName[20];
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:n:l:cy:s:mh")) != -1) {
+		switch (opt) {
+		case 'p': basePort = atoi(optarg); break;
+		case 'n': numDrives = atoi(optarg); break;
+		case 'l': limit = atof(optarg); break;
+		case 'c': rejectCombinedPrint = 1; break;
+		case 'y': partyNames = optarg; break;
+		case 's': replyDelay = atof(optarg) / 1000.; break;
+		case 'm': modbusMode = 1; break;
+		default: usage(); return 1;
+		}
+	}
+	if (numDrives < 1 || basePort < 1 || (modbusMode && partyNames[0])) {
+		usage();
+		return 1;
+	}
+	if (!osiSockAttach()) {
+		fprintf(stderr, "lexiumSim: can't initialise sockets\n");
+		return 1;
+	}
+
+	for (int i=0; i<numDrives; i++) {
+		SimDrive *pFirst = NULL;
+		int partySize = strlen(partyNames);
+		// drives on one link are created last to first so the list is in name order
+		for (int j=(partySize ? partySize-1 : 0); j>=0; j--) {
+			SimDrive *d = new SimDrive;
+			memset(d, 0, sizeof(*d));
+			d->index = i;
+			d->port = basePort + i;
+			d->name = partySize ? partyNames[j] : 0;
+			d->pNextParty = pFirst;
+			d->lock = epicsMutexMustCreate();
+			epicsTimeGetCurrent(&d->lastUpdate);
+			d->mode = simIdle;
+			d->vi = 1000;         // factory defaults
+			d->vm = 768000;
+			d->accel = 1000000;
+			d->inputType[1] = 1;  // home
+			d->inputType[2] = 2;  // + limit
+			d->inputType[3] = 3;  // - limit
+			d->plusLimit = limit;
+			d->minusLimit = -limit;
+			d->homePosition = 0;
+			pFirst = d;
+		}
+		sprintf(threadName, "simListen%d", i);
+		epicsThreadCreate(threadName, epicsThreadPriorityMedium, epicsThreadGetStackSize(epicsThreadStackSmall),
+						  (EPICSTHREADFUNC)simListenThread, (void *)pFirst);
+		if (partySize) printf("lexiumSim: party mode drives %s on port %d\n", partyNames, pFirst->port);
+		else printf("lexiumSim: drive %d on port %d%s\n", i, pFirst->port, modbusMode ? ", Modbus/TCP" : "");
+	}
+
+	while (1) epicsThreadSleep(1.0);
+	return 0;
+}
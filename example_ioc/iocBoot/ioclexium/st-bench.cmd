@@ -0,0 +1,39 @@
+#!../../bin/linux-x86_64/lexium
+
+# Poll throughput and latency benchmark against simulated drives, no hardware needed.
+# Start the simulator first (built in LexiumSimApp):
+#   lexiumSim -p 5030 -n 4 &
+# Results are appended to bench.json, one line per axis.
+
+< envPaths
+
+cd ${TOP}
+## Register all support components
+dbLoadDatabase("dbd/lexium.dbd")
+lexium_registerRecordDeviceDriver(pdbbase) 
+
+# Uncomment to compare driver modes
+#LexiumCreatePollGroup(2)
+#LexiumBackgroundStartup(1)
+
+##########################################
+# Set up ASYN ports, one per simulated drive
+drvAsynIPPortConfigure("P1","127.0.0.1:5030",0,0,0)
+drvAsynIPPortConfigure("P2","127.0.0.1:5031",0,0,0)
+drvAsynIPPortConfigure("P3","127.0.0.1:5032",0,0,0)
+drvAsynIPPortConfigure("P4","127.0.0.1:5033",0,0,0)
+
+# Set up Motor Controller
+#LexiumCreateController("MotorPort", "AsynPort", "", MovingPoll_ms, IdlePoll_ms)
+LexiumCreateController("M1", "P1", "", 100, 1000)
+LexiumCreateController("M2", "P2", "", 100, 1000)
+LexiumCreateController("M3", "P3", "", 100, 1000)
+LexiumCreateController("M4", "P4", "", 100, 1000)
+
+cd ${TOP}/iocBoot/${IOC}
+
+iocInit()
+
+#LexiumBenchmark(Seconds, MoveDistance_counts, "OutputFile")
+LexiumBenchmark(10, 0, "bench.json")
+LexiumBenchmark(10, 20000, "bench.json")
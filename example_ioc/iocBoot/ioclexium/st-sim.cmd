@@ -0,0 +1,39 @@
+#!../../bin/linux-x86_64/lexium
+
+# Example IOC against simulated drives on this host, no hardware needed.
+# Start the simulator first (built in LexiumSimApp):
+#   lexiumSim -p 5030 -n 4 &
+
+< envPaths
+
+epicsEnvSet("SYS",           "SIM")
+
+cd ${TOP}
+## Register all support components
+dbLoadDatabase("dbd/lexium.dbd")
+lexium_registerRecordDeviceDriver(pdbbase) 
+
+
+##########################################
+# Set up ASYN ports, one per simulated drive
+drvAsynIPPortConfigure("P1","127.0.0.1:5030",0,0,0)
+drvAsynIPPortConfigure("P2","127.0.0.1:5031",0,0,0)
+drvAsynIPPortConfigure("P3","127.0.0.1:5032",0,0,0)
+drvAsynIPPortConfigure("P4","127.0.0.1:5033",0,0,0)
+
+# Set up Motor Controller
+#LexiumCreateController("MotorPort", "AsynPort", "", MovingPoll_ms, IdlePoll_ms)
+LexiumCreateController("M1", "P1", "", 100, 1000)
+LexiumCreateController("M2", "P2", "", 100, 1000)
+LexiumCreateController("M3", "P3", "", 100, 1000)
+LexiumCreateController("M4", "P4", "", 100, 1000)
+
+## Load record instances, positions in drive counts
+dbLoadRecords("db/motor.db","P=$(SYS),M={Sim-Ax:1}Mtr,MOTOR=M1,DTYP=asynMotor,ADDR=0,DESC=Sim 1,EGU=cts,MRES=1,PREC=0,ALIAS=sim:m1")
+dbLoadRecords("db/motor.db","P=$(SYS),M={Sim-Ax:2}Mtr,MOTOR=M2,DTYP=asynMotor,ADDR=0,DESC=Sim 2,EGU=cts,MRES=1,PREC=0,ALIAS=sim:m2")
+dbLoadRecords("db/motor.db","P=$(SYS),M={Sim-Ax:3}Mtr,MOTOR=M3,DTYP=asynMotor,ADDR=0,DESC=Sim 3,EGU=cts,MRES=1,PREC=0,ALIAS=sim:m3")
+dbLoadRecords("db/motor.db","P=$(SYS),M={Sim-Ax:4}Mtr,MOTOR=M4,DTYP=asynMotor,ADDR=0,DESC=Sim 4,EGU=cts,MRES=1,PREC=0,ALIAS=sim:m4")
+
+cd ${TOP}/iocBoot/${IOC}
+
+iocInit()
@@ -22,8 +22,17 @@ drvAsynIPPortConfigure("P3","192.168.0.73:503",0,0,0)
 drvAsynIPPortConfigure("P4","192.168.0.74:503",0,0,0)
 
 # Set up Motor Controller
+# Optional: poll all Lexium controllers from a shared pool of worker threads
+# instead of one poller thread per controller. Must come before LexiumCreateController.
+#LexiumCreatePollGroup(4)
+# Optional: check drives in background threads so iocInit is not held up by unplugged motors
+#LexiumBackgroundStartup(1)
+# Optional: seconds between background position saves to NVM, over all drives (default 5)
+#LexiumNVMSaveInterval(5)
 #LexiumCreateController("MotorPort", "AsynPort", "", MovingPoll_ms, IdlePoll_ms)
 #ethernet motors do not support party mode, so set arg3 to "".
+#for a party mode (PY=1) RS-485 chain list the device names, one axis (ADDR) per drive:
+#LexiumCreateController("M5", "S1", "A,B,C", 100, 1000)
 LexiumCreateController("M1", "P1", "", 100, 1000)
 LexiumCreateController("M2", "P2", "", 100, 1000)
 LexiumCreateController("M3", "P3", "", 100, 1000)
@@ -32,6 +41,8 @@ LexiumCreateController("M4", "P4", "", 100, 1000)
 ## Load record instances
 dbLoadTemplate("db/motor.substitutions")
 dbLoadTemplate("db/clearlock.substitutions")
+dbLoadTemplate("db/lexiumIOStats.substitutions")
+dbLoadTemplate("db/lexiumCapture.substitutions")
 dbLoadRecords("db/asynComm.substitutions")
 
 ## autosave/restore machinery